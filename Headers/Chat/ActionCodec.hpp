@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+
+#include "Core/Types.hpp"
+#include "ActionData.hpp"
+#include "Networking/Serialization/Serializer.hpp"
+
+namespace Chat
+{
+	// Wire formats of the action batches exchanged by the network threads
+	enum class ProtocolVersion : u8
+	{
+		LEGACY = 0, // u8 type and u64 size before each action, payloads as built in memory
+		COMPACT = 1, // Varint framing, ids, timestamps and string sizes of the known payloads as varints
+		CONTENT_HASHES = 2, // COMPACT batches, files are only streamed to the peers sending a FILE_REQUEST for them
+		HISTORY_PAGES = 3, // CONTENT_HASHES, joiners only get the latest messages and send a HISTORY_REQUEST for each older page
+	};
+	constexpr ProtocolVersion CurrentProtocolVersion = ProtocolVersion::HISTORY_PAGES;
+
+	// Clients and server don't lay out every action the same way
+	enum class ActionOrigin : u8
+	{
+		CLIENT,
+		SERVER,
+	};
+
+	// Converts batches of actions from and to the wire
+	// A peer only gets COMPACT batches once it announced it understands them with a PROTOCOL_VERSION action
+	class ActionCodec
+	{
+	public:
+		// Appends a batch made of the given actions, nothing if there are none
+		static void Encode(const ActionData* actions, size_t count, ProtocolVersion version, ActionOrigin origin, Networking::Serialization::Serializer& sr);
+		static void Encode(const std::vector<ActionData>& list, ProtocolVersion version, ActionOrigin origin, Networking::Serialization::Serializer& sr);
+		// Appends the actions of a batch of any known version, with their payloads in the in memory layout
+		// Returns false if the batch is corrupted, the actions read until then are kept
+		static bool Decode(const u8* data, u64 size, ActionOrigin origin, std::vector<ActionData>& out);
+
+		// Announces CurrentProtocolVersion
+		static ActionData MakeVersionAction();
+		// Version to use with the peer that sent the action
+		static bool ReadVersionAction(const ActionData& action, ProtocolVersion& version);
+	};
+}
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <vector>
 
 #include "Core/Types.hpp"
+#include "Core/BufferPool.hpp"
 
 namespace Chat
 {
@@ -18,15 +19,24 @@ namespace Chat
 		USER_UPDATE_COLOR,
 		USER_UPDATE_ICON,
 		FILE_DATA,
+		PROTOCOL_VERSION, // Highest wire version the sender understands, see ActionCodec
+		FILE_REQUEST, // Content hash of a described file the sender doesn't hold yet
+		HISTORY_REQUEST, // Timestamp and id of the oldest message the client holds, the server sends the page of messages before it
+		HISTORY_PAGE, // Ends a page of messages from the server, whether there are older ones
 	};
 
 	class ActionData
 	{
 	public:
 		ActionData() = default;
-		ActionData(Action typeIn, const u8* dataIn, u64 szIn) : type(typeIn), data(dataIn, dataIn + szIn) { }
+		ActionData(Action typeIn, const u8* dataIn, u64 szIn) : type(typeIn), data(Core::BufferPool::Acquire(szIn)) { data.insert(data.cend(), dataIn, dataIn + szIn); }
+		ActionData(const ActionData&) = default;
+		ActionData(ActionData&&) noexcept = default;
+		ActionData& operator=(const ActionData&) = default;
+		ActionData& operator=(ActionData&&) noexcept = default;
 
-		~ActionData() = default;
+		// The data buffer goes back to the pool, actions are created and dropped for every message
+		~ActionData() { Core::BufferPool::Release(std::move(data)); }
 
 		Chat::Action type = Action::PING;
 		std::vector<u8> data;
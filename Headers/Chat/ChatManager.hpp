@@ -2,13 +2,16 @@
 
 #include <unordered_map>
 #include <memory>
-#include <list>
+#include <vector>
 
 #include "ChatMessage.hpp"
+#include "MessageStore.hpp"
 #include "ChatNetworkThread.hpp"
 
 #include "UserManager.hpp"
 #include "Resources/TextureManager.hpp"
+#include "Resources/HistoryLog.hpp"
+#include "Resources/SaveFile.hpp"
 
 namespace ImGui
 {
@@ -43,24 +46,39 @@ namespace Chat
 
 		void ReceiveMessage(std::unique_ptr<ChatMessage>&& mess);
 
-		const std::list<std::unique_ptr<ChatMessage>>& GetAllMessages();
+		const MessageStore& GetAllMessages() const { return messages; }
+
+		const Resources::HistoryLog& GetHistory() const { return history; }
 
 	protected:
 		UserManager* users;
 		Resources::TextureManager* textures;
 		u64 selfID = 0;
 		ImGui::FileBrowser* browser = nullptr;
-		std::list<std::unique_ptr<ChatMessage>> messages;
+		MessageStore messages = MessageStore(MessageSpacing);
+		Resources::HistoryLog history; // Only opened by the server, the messages received are appended to it
+		std::vector<Resources::Texture*> pendingImages; // Sent once decoded, with the thumbnail made meanwhile
+		std::vector<Resources::Texture*> requestedImages; // Opened or saved by the user while drawing the messages, or evicted and lost, kept to reuse its storage
 		std::unique_ptr<ChatNetworkThread> ntwThread;
-		float totalHeight = 0.0f;
 		std::string currentText;
 		f32 lastHeight = 0;
+		f32 scrollY = 0;
+		f32 scrollShift = 0; // Height of the messages inserted above the view since the last frame, it is moved down by as much
 		TextureError lastError = TextureError::NONE;
 		bool setDown = false;
 		u16 serverPort = (std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count()) & 0xffff;
 		bool isIPV6 = false;
 
+		// Offset of the first message from the top of the channel
+		static constexpr f32 MessagesTop = 20.0f;
+		static constexpr f32 MessageSpacing = 10.0f;
+
 		void DrawPopup();
+		void SendPendingImages();
+		// Inserts a message without appending it to the history, false if it is already there
+		bool InsertMessage(std::unique_ptr<ChatMessage>&& mess);
+		// Called while the top of the channel is in view, to get the messages before the first one
+		virtual void LoadOlderMessages() {}
 	};
 
 	class ClientChatManager : public ChatManager
@@ -84,6 +102,7 @@ namespace Chat
 		std::string serverAddress;
 		bool rRandom = false;
 		void RenderConnectionScreen();
+		void LoadOlderMessages() override;
 	};
 
 	class ServerChatManager : public ChatManager
@@ -91,7 +110,7 @@ namespace Chat
 	public:
 		ServerChatManager(UserManager* users, Resources::TextureManager* textures, u64 s, ImGui::FileBrowser* br);
 
-		~ServerChatManager() override = default;
+		~ServerChatManager() override;
 
 		bool isHost() const override { return true; }
 
@@ -104,6 +123,15 @@ namespace Chat
 		void Update() override;
 
 	private:
+		// Messages read back from the history when the chat starts, then each time its top is reached
+		static constexpr u64 HistoryPageSize = 100;
+		static constexpr const char* HistoryPath = "Saved/History";
+
+		void LoadOlderMessages() override;
+
+		Resources::SaveFile userSave = Resources::SaveFile("Saved/History/Users");
+		size_t savedUsers = 0;
+		u64 firstLoaded = 0; // Index in the history of the oldest message read back
 	};
 
 }
\ No newline at end of file
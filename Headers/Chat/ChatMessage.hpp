@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <time.h>
 
 #include "Core/Types.hpp"
@@ -18,7 +19,8 @@ namespace Chat
 
 		virtual ~ChatMessage() = default;
 
-		virtual void Draw() const = 0;
+		// Full images the user opened or saved are added to downloads, their download is up to the chat
+		virtual void Draw(std::vector<Resources::Texture*>& downloads) const = 0;
 
 		virtual Chat::ActionData Serialize() const = 0;
 
@@ -41,13 +43,15 @@ namespace Chat
 	{
 	public:
 		TextMessage() = default;
-		TextMessage(std::string& textIn, User* userIn, s64 tm, u64 id = 0);
+		TextMessage(std::string_view textIn, User* userIn, s64 tm, u64 id = 0);
 
 		virtual ~TextMessage() override = default;
-		virtual void Draw() const override;
+		virtual void Draw(std::vector<Resources::Texture*>& downloads) const override;
 		Chat::ActionData Serialize() const override;
 
 		static float MaxWidth;
+		// Longest text sent, the server drops longer ones
+		static constexpr size_t MaxLength = 32768;
 	protected:
 		std::string message;
 	};
@@ -59,10 +63,15 @@ namespace Chat
 		ImageMessage(Resources::Texture* img, User* userIn, s64 tm, u64 id = 0);
 
 		virtual ~ImageMessage() override = default;
-		virtual void Draw() const override;
+		virtual void Draw(std::vector<Resources::Texture*>& downloads) const override;
 		Chat::ActionData Serialize() const override;
 		static void SetDefaultImage(Resources::Texture* imgIn);
+		// Description of the image followed by the one of its thumbnail, if any. Older peers stop reading before it
+		static void SerializeImage(const Resources::Texture* img, Networking::Serialization::Serializer& sr);
 	protected:
+		// Long side of the full image when opened
+		static constexpr float MaxViewSize = 800.0f;
+
 		Resources::Texture* tex;
 		float width = 200.0f;
 		static Resources::Texture* unloadedImg;
@@ -75,7 +84,7 @@ namespace Chat
 		ConnectionMessage(bool connected, User* userIn, s64 tm, u64 id = 0);
 
 		virtual ~ConnectionMessage() override = default;
-		virtual void Draw() const override;
+		virtual void Draw(std::vector<Resources::Texture*>& downloads) const override;
 		Chat::ActionData Serialize() const override;
 
 	protected:
@@ -1,8 +1,11 @@
 #pragma once
 
 #include <thread>
+#include <chrono>
+#include <string>
 #include <vector>
 #include <forward_list>
+#include <unordered_map>
 
 #include "Networking/Address.hpp"
 #include "Networking/UDP/Client.hpp"
@@ -14,6 +17,7 @@
 #include "Networking/Serialization/Serializer.hpp"
 #include "Networking/Serialization/Deserializer.hpp"
 #include "ActionData.hpp"
+#include "ActionCodec.hpp"
 #include "Resources/FileDataManager.hpp"
 
 namespace Chat
@@ -41,6 +45,9 @@ namespace Chat
 
 		virtual void TryConnect() = 0;
 
+		// Downloads the content of a described texture that wasn't requested with its message, as a full image behind a thumbnail
+		virtual void RequestFile(Resources::Texture* tex) = 0;
+
 		void PushAction(Action type, const u8* data, u64 dataSize);
 		void PushAction(ActionData&& action);
 
@@ -52,11 +59,42 @@ namespace Chat
 		void ResetState() { state = ChatNetworkState::DISCONNECTED; }
 		const char* GetLastError() { return lastError; }
 	protected:
+		// Upper bound of a network thread sleep, the client wakes it sooner when needed
+		static constexpr std::chrono::milliseconds NetworkWaitTimeout = std::chrono::milliseconds(500);
+		// File parts and messages taken from files for all the peers on each update, on top of the queue space of each one
+		static constexpr s64 MaxFileBytesPerUpdate = 0x400000;
+		// Queued to a peer even before its congestion window opens up
+		static constexpr s64 MinQueuedFileBytes = 0x10000;
+		// Payload bytes of the actions encoded in a batch, well below the UDP_STREAM_MAX_MESSAGE_SIZE of a message : longer lists go in several batches
+		static constexpr u64 MaxBatchSize = 0x100000;
+
+		// Bytes of files the connection can still take : about two congestion windows, minus what is queued and not sent yet
+		static s64 GetQueueSpace(const Networking::UDP::DistantClient::Stats& stats);
+		// End of the batch starting at the given action : at most MaxBatchSize bytes of payloads, or a single action
+		static size_t GetBatchEnd(const std::vector<ActionData>& list, size_t first);
+		// Sends the actions to the given address in as many batches as needed
+		void SendBatches(const Networking::Address& to, const std::vector<ActionData>& list, ProtocolVersion version, ActionOrigin origin);
+
+		// Called for each file described by an outgoing action : streams it to the peers that can't request it
+		virtual void ShareFile(const Resources::Texture* file, const User* owner) = 0;
+		// Asks for the content of a described file, listing the parts already held from an interrupted download
+		static ActionData MakeFileRequest(const Resources::LargeFile* file);
+		// Texture a peer describes under the given path, preloaded. nullptr if the description is damaged
+		// One complete or being sent is kept as is for the messages showing it : another content gets a texture of its own, under a path made from the given one
+		Resources::Texture* ReadDescription(Networking::Serialization::Deserializer& dr, std::string_view path);
+		// Texture the parts received under the given path go to
+		Resources::Texture* GetReceivingTexture(std::string_view path);
+		// Preloads the thumbnail described after an image, nullptr if there is none
+		Resources::Texture* ReadThumbnail(Networking::Serialization::Deserializer& dr);
+		// Content hash and held parts of a FILE_REQUEST
+		static bool ReadFileRequest(Networking::Serialization::Deserializer& dr, u64& hash, std::vector<bool>& heldParts);
+
 		std::thread t;
 		Networking::Address address;
 		Networking::UDP::Client client;
 		std::vector<ActionData> actionQueue;
 		std::vector<ActionData> actions;
+		std::vector<std::unique_ptr<Networking::Messages::Base>> polledMessages; // Kept to reuse its storage
 		Core::Signal signal = Core::Signal(false);
 		Core::Signal connect = Core::Signal(false);
 		Core::Signal shouldQuit = Core::Signal(false);
@@ -67,7 +105,8 @@ namespace Chat
 		UserManager* users = nullptr;
 		Resources::TextureManager* textures = nullptr;
 		Resources::FileDataManager files;
-		bool clientStallBool = false;
+		std::vector<std::pair<u64 /*networkID*/, Resources::FileDataManager::SharedPart>> fileParts; // Kept to reuse its storage
+		std::unordered_map<std::string /*path*/, Resources::Texture*> describedAgain; // Textures given another path by ReadDescription, until they are received
 	};
 
 	class ChatClientThread : public ChatNetworkThread
@@ -78,6 +117,11 @@ namespace Chat
 
 		void TryConnect() override;
 
+		void RequestFile(Resources::Texture* tex) override;
+
+		// Asks for the page of messages before the given one, if the server has older ones and no page is on its way
+		void RequestHistory(s64 time, u64 messID);
+
 		~ChatClientThread() override;
 
 		void Update();
@@ -90,6 +134,19 @@ namespace Chat
 		bool ProcessTextMessage(Networking::Serialization::Deserializer& dr);
 		bool ProcessImageMessage(Networking::Serialization::Deserializer& dr);
 		bool ProcessFilePart(Networking::Serialization::Deserializer& dr);
+		bool ProcessFileRequest(Networking::Serialization::Deserializer& dr);
+		bool ProcessHistoryPage(Networking::Serialization::Deserializer& dr);
+		// Completes a described texture from the local content, or asks the server for it
+		void RequestContent(Resources::Texture* tex);
+		void ShareFile(const Resources::Texture* file, const User* owner) override;
+
+		// Destination of the files sent to the server
+		static constexpr u64 ServerNetworkID = 0;
+
+		ProtocolVersion serverVersion = ProtocolVersion::LEGACY;
+		bool shareSelfIcon = false; // Until the server version is known
+		bool olderHistory = false; // As told by the last page received
+		bool historyRequested = false; // Until the page is received
 	};
 
 	class ChatServerThread : public ChatNetworkThread
@@ -101,9 +158,20 @@ namespace Chat
 		~ChatServerThread() override;
 
 		u64 GetMessageCounter();
+		// Ids of the new messages start from it, to follow the ones of the history
+		void SetMessageCounter(u64 next);
+
+		// Message saved in a record of the history, nullptr if the record is damaged
+		// Its images are completed from the disk cache, they aren't downloaded again
+		std::unique_ptr<ChatMessage> ReadHistoryRecord(const ActionData& record);
+		// Messages sent to a client when it joins, then for each of its HISTORY_REQUEST
+		static constexpr u64 HistoryPageSize = 100;
 
 		void TryConnect() override;
 
+		// The server already gets every full image, to serve them
+		void RequestFile(Resources::Texture*) override {}
+
 		void Update();
 
 		void ThreadFunc();
@@ -116,8 +184,34 @@ namespace Chat
 		bool ProcessServerUserDisconnection(Networking::Serialization::Deserializer& dr);
 		bool ProcessServerUserConnection(const Networking::Address& clientIn, u64 clientNetworkID);
 		bool ProcessServerFilePart(Networking::Serialization::Deserializer& dr);
+		bool ProcessServerFileRequest(Networking::Serialization::Deserializer& dr);
+		bool ProcessServerHistoryRequest(Networking::Serialization::Deserializer& dr);
+		// Queues the messages before the given one to a client, at most a page of the last ones
+		// Older clients can't ask for the older pages : they get every message, in as many batches as their size needs
+		// Read from the history log when the server keeps one, else from the messages shown
+		void SendHistoryPage(u64 clientNetworkID, s64 beforeTime, u64 beforeID);
+		// Texture described by an image message of the history, completed from the disk cache. nullptr if the description is damaged
+		Resources::Texture* ReadHistoryImage(Networking::Serialization::Deserializer& dr);
+		// Keeps the content hashes of an image message sent from the log to a client, its texture is only made once the client requests it
+		void AddHistoryImage(u64 clientNetworkID, const ActionData& record, u64 recordIndex);
+		// Makes the texture of an image sent from the log to the client for a requested content, false if no such image was sent to it
+		bool LoadHistoryImage(u64 clientNetworkID, u64 hash);
+		// Completes a described texture from the local content, or asks its sender for it
+		void RequestContent(Resources::Texture* tex, const User* sender);
+		void ShareFile(const Resources::Texture* file, const User* owner) override;
+		ProtocolVersion GetPeerVersion(u64 clientNetworkID) const;
+		// Sends the actions to every connected client, each one in the wire version it understands
+		void BroadCastActions(const std::vector<ActionData>& list);
 
 		std::forward_list<u64> acceptedClients;
+		std::unordered_map<u64 /*networkID*/, ProtocolVersion> peerVersions; // Only written by the network thread
+		std::unordered_map<u64 /*content hash*/, std::vector<std::pair<u64 /*networkID*/, std::vector<bool>>>> waitingRequests; // Peers requesting a file still being received
+		std::unordered_map<u64 /*content hash*/, u64 /*networkID*/> contentSources; // Peer each file being received was requested from, asked again if the content doesn't match
+		// Images sent from the log to each client without a texture yet, forgotten when the client leaves
+		std::unordered_map<u64 /*networkID*/, std::unordered_map<u64 /*content hash*/, u64 /*record index*/>> historyImages;
+		std::vector<std::pair<u64 /*networkID*/, ActionData>> peerActionQueue; // Actions for a single client
+		std::vector<std::pair<u64 /*networkID*/, ActionData>> peerActions;
+		std::vector<ActionData> peerBatch; // Kept to reuse its storage
 	};
 
 }
\ No newline at end of file
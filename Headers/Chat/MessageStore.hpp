@@ -0,0 +1,91 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Core/Types.hpp"
+#include "ChatMessage.hpp"
+
+namespace Chat
+{
+	// Messages sorted by timestamp then id, in chunks of contiguous pointers
+	// Inserting anywhere only moves the chunk it lands in, plus the chunk bounds after it
+	// Each message also has its vertical offset in the channel, for the visible ones to be found by a binary search
+	class MessageStore
+	{
+	public:
+		// Chunks are split in two once they reach it
+		static constexpr size_t MaxChunkSize = 512;
+
+		// spacing is added below each message
+		explicit MessageStore(f32 spacing);
+
+		// Returns false if a message with the same timestamp and id is already stored, as when the history is sent again
+		bool Insert(std::unique_ptr<ChatMessage>&& mess);
+
+		size_t Size() const { return chunkStarts.back(); }
+		bool Empty() const { return Size() == 0; }
+		ChatMessage* At(size_t index) const;
+		ChatMessage* Back() const { return Empty() ? nullptr : chunks.back().messages.back().get(); }
+		// nullptr if there is none
+		ChatMessage* Find(u64 messageID) const;
+		// Size() if there is none
+		size_t IndexOf(u64 messageID) const;
+		// Index of the first message not sorting before the given timestamp and id, Size() if there is none
+		size_t LowerBound(s64 time, u64 id) const;
+		// Offset of the message at the given index from the top of the first one
+		f32 OffsetOf(size_t index) const;
+		// Heights and spacings of all the messages
+		f32 GetTotalHeight() const { return chunkOffsets.back(); }
+
+		template<class F>
+		void ForEach(F&& f) const
+		{
+			for (auto& chunk : chunks)
+			{
+				for (auto& mess : chunk.messages) f(mess.get());
+			}
+		}
+
+		// Calls f(message, offset) for the messages overlapping [top, bottom), in order
+		template<class F>
+		void ForEachInRange(f32 top, f32 bottom, F&& f) const
+		{
+			size_t c = std::upper_bound(chunkOffsets.begin() + 1, chunkOffsets.end(), top) - chunkOffsets.begin() - 1;
+			for (; c < chunks.size() && chunkOffsets[c] < bottom; c++)
+			{
+				const Chunk& chunk = chunks[c];
+				const f32 base = chunkOffsets[c];
+				size_t i = std::upper_bound(chunk.offsets.begin() + 1, chunk.offsets.end(), top - base) - chunk.offsets.begin() - 1;
+				for (; i < chunk.messages.size() && base + chunk.offsets[i] < bottom; i++)
+				{
+					f(chunk.messages[i].get(), base + chunk.offsets[i]);
+				}
+			}
+		}
+
+	private:
+		struct Chunk
+		{
+			std::vector<std::unique_ptr<ChatMessage>> messages;
+			std::vector<f32> offsets = std::vector<f32>(1, 0.0f); // Prefix sums of the heights and spacings in the chunk, one more than the messages
+		};
+
+		// Whether the message sorts before the given timestamp and id
+		static bool IsBefore(const ChatMessage* mess, s64 time, u64 id);
+		// Chunk the given key belongs in : the first one not ending before it, the last one if they all do
+		size_t FindChunk(s64 time, u64 id) const;
+		// Recomputes the offsets of a chunk from the given message on
+		void UpdateOffsets(Chunk& chunk, size_t from);
+		// Recomputes the bounds of the chunks from the given one on
+		void UpdateChunkBounds(size_t from);
+
+		f32 spacing = 0.0f;
+		std::vector<Chunk> chunks;
+		std::vector<f32> chunkOffsets = std::vector<f32>(1, 0.0f); // Offset of each chunk, one more than the chunks
+		std::vector<size_t> chunkStarts = std::vector<size_t>(1, 0); // Index of the first message of each chunk, one more than the chunks
+		std::unordered_map<u64 /*messageID*/, ChatMessage*> byID;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+
+#include "Core/Types.hpp"
+
+namespace Core
+{
+	// Process wide recycling of the buffers handed from the socket to the chat for each message, so that steady traffic doesn't hit the heap
+	// Byte buffers are sorted by power of two capacity, small objects (network messages, shared_ptr control blocks, deque chunks) by 16 bytes steps
+	// Can be called from any thread
+	class BufferPool
+	{
+	public:
+		// Empty buffer able to hold at least size bytes without reallocating
+		static std::vector<u8> Acquire(size_t size);
+		// Keeps the buffer capacity for a later Acquire, the buffer is left empty
+		static void Release(std::vector<u8>&& buffer);
+		// Immutable shared buffer, its storage goes back to the pool with the last reference
+		static std::shared_ptr<const std::vector<u8>> Share(std::vector<u8>&& buffer);
+
+		static void* AllocateBlock(size_t size);
+		static void FreeBlock(void* block, size_t size);
+
+		struct Stats
+		{
+			u64 heapAllocations = 0; // Requests the pool had nothing for
+			u64 reused = 0;
+		};
+		static Stats GetStats();
+
+		// Standard allocator over AllocateBlock, for allocate_shared and the shared_ptr control blocks
+		template<class T>
+		struct BlockAllocator
+		{
+			using value_type = T;
+			BlockAllocator() = default;
+			template<class U>
+			BlockAllocator(const BlockAllocator<U>&) {}
+			T* allocate(size_t n) { return static_cast<T*>(AllocateBlock(n * sizeof(T))); }
+			void deallocate(T* ptr, size_t n) { FreeBlock(ptr, n * sizeof(T)); }
+			template<class U>
+			bool operator==(const BlockAllocator<U>&) const { return true; }
+			template<class U>
+			bool operator!=(const BlockAllocator<U>&) const { return false; }
+		};
+	};
+}
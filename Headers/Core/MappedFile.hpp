@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include "Core/Types.hpp"
+
+namespace Core
+{
+	// A whole file mapped in memory : its pages are read from the disk when accessed and can be dropped by the system under pressure
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+		~MappedFile();
+
+		// Maps an existing file read only, false if it is missing or empty
+		bool Open(const std::string& path);
+		// Maps a file for reading and writing, created or resized to size bytes first. What it held is kept
+		bool Create(const std::string& path, u64 size);
+		void Close();
+
+		bool IsOpen() const { return data != nullptr; }
+		u8* GetData() const { return data; }
+		u64 GetSize() const { return size; }
+	private:
+		u8* data = nullptr;
+		u64 size = 0;
+	};
+}
\ No newline at end of file
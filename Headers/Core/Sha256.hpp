@@ -0,0 +1,31 @@
+#pragma once
+
+#include <array>
+
+#include "Core/Types.hpp"
+
+namespace Core
+{
+	// SHA-256 (FIPS 180-4), fed in as many pieces as needed
+	class Sha256
+	{
+	public:
+		using Digest = std::array<u8, 32>;
+
+		Sha256();
+
+		void Update(const u8* data, u64 size);
+		// Ends the hash, the object has to be reset before being fed again
+		Digest Final();
+		void Reset();
+
+		static Digest Hash(const u8* data, u64 size);
+	private:
+		void ProcessBlock(const u8* block);
+
+		u32 state[8];
+		u8 buffer[64];
+		u64 bufferSize = 0;
+		u64 totalSize = 0;
+	};
+}
\ No newline at end of file
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+#include "Core/Types.hpp"
+
+namespace Core
+{
+	class ThreadPool
+	{
+	public:
+		ThreadPool(u32 threadCount);
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+		~ThreadPool();
+
+		// Queues a task to be run by one of the workers
+		void Push(std::function<void()>&& task);
+		// Runs task(i) for each i in [0, count) on the workers and the calling thread, returns once every call is done
+		void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+		u32 GetThreadCount() const { return static_cast<u32>(threads.size()); }
+	private:
+		void WorkerFunc();
+
+		std::vector<std::thread> threads;
+		std::deque<std::function<void()>> tasks;
+		std::mutex tasksLock;
+		std::condition_variable tasksCondition;
+		bool shouldQuit = false;
+	};
+}
@@ -30,11 +30,18 @@ namespace Networking
 		bool operator==(const Address& other) const;
 		bool operator!=(const Address& other) const { return !(*this == other); }
 
+		// Hashes the ip and port, for use in unordered containers
+		struct Hash
+		{
+			size_t operator()(const Address& addr) const;
+		};
+
 		Type type() const { return mType; }
 		bool isValid() const { return mType != Type::None; }
 		std::string address() const;
 		uint16_t port() const { return mPort; }
 		std::string toString() const;
+		const sockaddr_storage& storage() const { return mStorage; }
 
 		// Connecte le socket en paramtre  ladresse interne
 			// Retourne true si la connexion russit ou dbute (socket non bloquant), false sinon
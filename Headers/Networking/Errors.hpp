@@ -17,9 +17,11 @@ namespace Networking::Sockets
 #ifdef _WIN32
 		WOULDBLOCK = WSAEWOULDBLOCK,
 		INPROGRESS = WSAEINPROGRESS,
+		NOBUFS = WSAENOBUFS,
 #else
-		WOULDBLOCK = EWOULDBLOCK
+		WOULDBLOCK = EWOULDBLOCK,
 		INPROGRESS = EINPROGRESS,
+		NOBUFS = ENOBUFS,
 #endif
 	};
 	Errors GetErrorCasted();
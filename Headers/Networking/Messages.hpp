@@ -1,10 +1,12 @@
 #pragma once
 
 #include <vector>
+#include <new>
 
 #include "NetworkSettings.hpp"
 #include "Core/Types.hpp"
 #include "Address.hpp"
+#include "Core/BufferPool.hpp"
 
 namespace Networking::Messages
 {
@@ -27,6 +29,10 @@ namespace Networking::Messages
 
 		virtual ~Base() = default;
 
+		// One message is created for each one received : they are recycled instead of going through the heap
+		static void* operator new(size_t size) { return Core::BufferPool::AllocateBlock(size); }
+		static void operator delete(void* ptr, size_t size) { Core::BufferPool::FreeBlock(ptr, size); }
+
 		enum class Type {
 			IncomingConnection,
 			Connection,
@@ -127,7 +133,7 @@ namespace Networking::Messages
 		UserData& operator=(const UserData&) = delete;
 		UserData(const Address& emitter, u64 emitterid, std::vector<unsigned char>&& d, u8 channel) : Base(Type::UserData, emitter, emitterid), data(std::move(d)), channelId(channel) {}
 
-		virtual ~UserData() override = default;
+		virtual ~UserData() override { Core::BufferPool::Release(std::move(data)); }
 
 		std::vector<unsigned char> data;
 		u8 channelId;
@@ -5,6 +5,44 @@
 // Default UDP timeout
 #define UDP_TIMEOUT std::chrono::milliseconds(2000)
 
+// Delay after which an idle connection sends a keep alive
+#define UDP_KEEPALIVE_INTERVAL std::chrono::milliseconds(100)
+
+// Bounds of the retransmission timeout, estimated from the round trip time of each client
+#define UDP_INITIAL_RTO std::chrono::milliseconds(200)
+#define UDP_MIN_RTO std::chrono::milliseconds(20)
+#define UDP_MAX_RTO std::chrono::milliseconds(1000)
+
+// A datagram is considered lost once a datagram sent that many ids later is acked
+#define UDP_FAST_RETRANSMIT_THRESHOLD 3
+
+// Congestion window bounds, in datagrams in flight per client
+#define UDP_INITIAL_CWND 10
+#define UDP_MIN_CWND 2
+
+// Number of datagrams a client may send in a row once its pacing allows it
+#define UDP_PACING_BURST 4
+
+// Default number of reliable packets in flight per channel, see ReliableOrdered::SetWindowSize
+#define UDP_RELIABLE_WINDOW 1024
+
+// Largest message accepted by a ReliableStream channel, the receiver rebuilds it in memory for each channel of each peer
+// Larger messages are dropped on both ends, the chat splits its action batches well below it
+#define UDP_STREAM_MAX_MESSAGE_SIZE (4 * 1024 * 1024)
+
+// Maximum number of datagrams moved by a single system call when batched I/O is available
+#define UDP_IO_BATCH_SIZE 32
+
+// Use recvmmsg / sendmmsg to receive and send several datagrams per system call
+#ifdef __linux__
+#define UDP_BATCHED_IO 1
+#else
+#define UDP_BATCHED_IO 0
+#endif
+
+// Minimum number of distant clients per shard before the client processing is spread over several threads
+#define UDP_MIN_CLIENTS_PER_SHARD 64
+
 // Allow use of network simulator
 #define NETWORK_SIMULATOR 0
 
@@ -21,3 +59,51 @@
 #ifndef UDP_TIMEOUT
 #define UDP_TIMEOUT std::chrono::seconds(1)
 #endif
+
+#ifndef UDP_KEEPALIVE_INTERVAL
+#define UDP_KEEPALIVE_INTERVAL std::chrono::milliseconds(100)
+#endif
+
+#ifndef UDP_INITIAL_RTO
+#define UDP_INITIAL_RTO std::chrono::milliseconds(200)
+#endif
+
+#ifndef UDP_MIN_RTO
+#define UDP_MIN_RTO std::chrono::milliseconds(20)
+#endif
+
+#ifndef UDP_MAX_RTO
+#define UDP_MAX_RTO std::chrono::milliseconds(1000)
+#endif
+
+#ifndef UDP_FAST_RETRANSMIT_THRESHOLD
+#define UDP_FAST_RETRANSMIT_THRESHOLD 3
+#endif
+
+#ifndef UDP_INITIAL_CWND
+#define UDP_INITIAL_CWND 10
+#endif
+
+#ifndef UDP_MIN_CWND
+#define UDP_MIN_CWND 2
+#endif
+
+#ifndef UDP_PACING_BURST
+#define UDP_PACING_BURST 4
+#endif
+
+#ifndef UDP_RELIABLE_WINDOW
+#define UDP_RELIABLE_WINDOW 1024
+#endif
+
+#ifndef UDP_STREAM_MAX_MESSAGE_SIZE
+#define UDP_STREAM_MAX_MESSAGE_SIZE (4 * 1024 * 1024)
+#endif
+
+#ifndef UDP_MIN_CLIENTS_PER_SHARD
+#define UDP_MIN_CLIENTS_PER_SHARD 64
+#endif
+
+#ifndef UDP_IO_BATCH_SIZE
+#define UDP_IO_BATCH_SIZE 1
+#endif
@@ -2,6 +2,10 @@
 
 #include "Core/Types.hpp"
 
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
 namespace Networking::Serialization::Conversion
 {
 	void ToNetwork(u16 in, u16& out);
@@ -15,4 +19,20 @@ namespace Networking::Serialization::Conversion
 	void ToLocal(u64 in, u64& out);
 	void ToLocal(u32 in, f32& out);
 	void ToLocal(u64 in, f64& out);
+
+	// Inlined conversions for the serialization hot paths, giving the same bytes as ToNetwork
+	// The swap is its own inverse : they also convert back to local order
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	inline u16 NetworkOrder(u16 in) { return in; }
+	inline u32 NetworkOrder(u32 in) { return in; }
+	inline u64 NetworkOrder(u64 in) { return in; }
+#elif defined(_MSC_VER)
+	inline u16 NetworkOrder(u16 in) { return _byteswap_ushort(in); }
+	inline u32 NetworkOrder(u32 in) { return _byteswap_ulong(in); }
+	inline u64 NetworkOrder(u64 in) { return _byteswap_uint64(in); }
+#else
+	inline u16 NetworkOrder(u16 in) { return __builtin_bswap16(in); }
+	inline u32 NetworkOrder(u32 in) { return __builtin_bswap32(in); }
+	inline u64 NetworkOrder(u64 in) { return __builtin_bswap64(in); }
+#endif
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <string_view>
 #include "Conversion.hpp"
 
 namespace Networking::Serialization
@@ -27,7 +28,20 @@ namespace Networking::Serialization
 		bool Read(f32& in);
 		bool Read(f64& in);
 		bool Read(u8* dataIn, u64 dataSize);
+
+		// Views into the deserialized buffer, no copy : they are only valid as long as the buffer is
+		bool ReadView(const u8*& dataOut, u64 dataSize);
+		bool ReadView(std::string_view& out, u64 size);
+		// String written as its u64 size followed by its characters
+		bool ReadString(std::string_view& out);
+
+		// See Serializer::WriteVarInt
+		bool ReadVarInt(u64& in);
+		bool ReadVarInt(s64& in);
 	private:
+		template<class T>
+		bool ReadValue(T& out);
+
 		const u8* buffer;
 		const u64 bufferSize;
 		u64 cPos = 0;
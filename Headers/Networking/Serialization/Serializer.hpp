@@ -9,11 +9,27 @@ namespace Networking::Serialization
 	{
 	public:
 		Serializer() = default;
+		// Reserves capacity bytes up front : a serializer sized right never reallocates
+		explicit Serializer(u64 capacity);
+		// Writes in place into a buffer owned by the caller (a datagram payload, an action...), which never grows
+		// Writes that don't fit are dropped and mark the serializer as overflowed
+		Serializer(u8* externalBuffer, u64 capacity) : data(externalBuffer), capacity(capacity), external(true) {}
 
-		~Serializer() = default;
+		Serializer(const Serializer&) = delete;
+		Serializer& operator=(const Serializer&) = delete;
 
-		const u8* GetBuffer() const { return buffer.data(); }
-		const u64 GetBufferSize() const { return buffer.size(); }
+		~Serializer();
+
+		const u8* GetBuffer() const { return data; }
+		const u64 GetBufferSize() const { return size; }
+		bool Overflowed() const { return overflow; }
+
+		void Reserve(u64 newCapacity);
+		// Empties the serializer, keeping its storage
+		void Clear() { size = 0; overflow = false; }
+		// Moves the written bytes out without copying them, the serializer is left empty
+		// With an external buffer, the bytes are copied instead
+		std::vector<u8> TakeBuffer();
 
 		void Write(u8 in);
 		void Write(s8 in);
@@ -26,8 +42,31 @@ namespace Networking::Serialization
 		void Write(f32 in);
 		void Write(f64 in);
 		void Write(const u8* dataIn, u64 dataSize);
+
+		// Arrays of values, converted to network order in a single pass
+		void WriteArray(const u16* values, u64 count);
+		void WriteArray(const u32* values, u64 count);
+		void WriteArray(const u64* values, u64 count);
+		void WriteArray(const f32* values, u64 count);
+		void WriteArray(const f64* values, u64 count);
+
+		// LEB128 : 7 bits per byte, small values take a single byte. Signed values are zigzag encoded first
+		void WriteVarInt(u64 in);
+		void WriteVarInt(s64 in);
 	private:
-		std::vector<u8> buffer;
+		// Returns where to write count bytes, nullptr if they don't fit in an external buffer
+		u8* Claim(u64 count);
+		template<class T>
+		void WriteValue(T networkValue);
+		template<class T, class U>
+		void WriteValues(const U* values, u64 count);
+
+		std::vector<u8> buffer; // Owned storage, always sized to its capacity
+		u8* data = nullptr;
+		u64 capacity = 0;
+		u64 size = 0;
+		bool external = false;
+		bool overflow = false;
 	};
 
 }
\ No newline at end of file
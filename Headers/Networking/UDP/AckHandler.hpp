@@ -20,7 +20,8 @@ namespace Networking::UDP
 
 		uint16_t lastAck() const;
 		uint64_t previousAcksMask() const;
-		std::vector<uint16_t> getNewAcks() const;
+		// Fills newAcks, oldest first
+		void getNewAcks(std::vector<uint16_t>& newAcks) const;
 		std::vector<uint16_t>& loss(); // loss.png
 
 
@@ -28,6 +28,7 @@ namespace Networking::UDP
 
 		// Multiplexeur
 		void queue(std::vector<u8>&& msgData, u32 canalIndex);
+		void queue(const SharedData& msgData, u32 canalIndex);
 		u16 serialize(u8* buffer, u16 buffersize, Datagram::ID datagramId
 #if NETWORK_INTERRUPTION
 			, bool connectionInterrupted
@@ -39,7 +40,11 @@ namespace Networking::UDP
 
 		// Demultiplexeur
 		void onDataReceived(const u8* data, u16 datasize);
-		std::vector<std::tuple<u8 /*ChannelId*/, std::vector<u8>>> process(bool isConnected);
+		// Appends the messages ready to messages
+		void process(bool isConnected, std::vector<std::tuple<u8 /*ChannelId*/, std::vector<u8>>>& messages);
+
+		// Bytes queued in all the channels and never sent yet
+		size_t unsentBytes() const;
 
 		template<class T>
 		void registerChannel(u8 channelID)
@@ -49,5 +54,6 @@ namespace Networking::UDP
 
 	private:
 		std::vector<std::unique_ptr<Protocols::IProtocol>> mChannels;
+		std::vector<std::vector<u8>> mProtocolMessages; // Kept to reuse its storage
 	};
 }
@@ -4,18 +4,25 @@
 #include <vector>
 #include <functional>
 #include <unordered_set>
+#include <unordered_map>
 #include <assert.h>
 
 #include "Networking/Sockets.hpp"
 #include "Networking/Address.hpp"
 #include "Networking/NetworkSettings.hpp"
 #include "Networking/UDP/Simulator.hpp"
+#include "Core/BufferPool.hpp"
 #include "DistantClient.hpp"
 
 #if NETWORK_THREAD_SAFE
 #include <mutex>
 #endif
 
+namespace Core
+{
+	class ThreadPool;
+}
+
 namespace Networking
 {
 	namespace Messages {
@@ -48,6 +55,9 @@ namespace Networking
 
 			// Initialise socket to send and receive data on the given port
 			bool init(u16 port);
+			// Spreads the distant clients processing over workerCount threads, once there are enough clients for it to pay off
+			// 1 (default) processes everything on the calling thread. Must not be called while calling receive or processSend
+			void setWorkerCount(u32 workerCount);
 			void release();
 
 			static void SetTimeout(std::chrono::milliseconds timeout);
@@ -60,20 +70,47 @@ namespace Networking
 			void disconnectAll();
 			// Can be called anytime from any thread ONLY IF NETWORK_THREAD_SAFE is defined in newtork settings
 			void sendTo(const Address& target, std::vector<u8>&& data, u32 channelIndex);
-			void sendTo(const Address& target, const u8* data, size_t dataSize, u32 channelIndex) { sendTo(target, std::vector<u8>(data, data + dataSize), channelIndex); }
+			void sendTo(const Address& target, const u8* data, size_t dataSize, u32 channelIndex);
+			// The buffer is referenced by the channel instead of copied, the same one can go to several clients
+			void sendTo(const Address& target, const SharedData& data, u32 channelIndex);
 
 			void broadCast(std::vector<u8>&& data, u32 channelIndex);
-			void broadCast(const u8* data, size_t dataSize, u32 channelIndex) { broadCast(std::vector<u8>(data, data + dataSize), channelIndex); }
+			void broadCast(const u8* data, size_t dataSize, u32 channelIndex);
 
 			// This performs operations on existing clients. Must not be called while calling receive
 			void processSend();
 			// This performs operations on existing clients. Must not be called while calling processSend
 			void receive();
+			// Blocks until a datagram can be received, wakeUp is called or the next client deadline is reached, never longer than maxTimeout
+			// If watchSocket is false, only wakeUp and the timeout end the wait
+			void wait(std::chrono::milliseconds maxTimeout, bool watchSocket = true);
+			// Ends the current or next call to wait. Can be called anytime from any thread
+			void wakeUp();
 			// Extract ready messages. Each message is unique and polled only once.
 			// Can be called anytime from any thread ONLY IF NETWORK_THREAD_SAFE is defined in newtork settings
 			std::vector<std::unique_ptr<Messages::Base>> poll();
+			// Same, appending the messages to the given vector so that its storage is reused from one call to the other
+			void poll(std::vector<std::unique_ptr<Messages::Base>>& messages);
 
 			const Address& GetClientAddress(u64 clientID);
+			// Congestion control and loss of the given client, empty if it doesn't exist
+			DistantClient::Stats GetClientStats(u64 clientID) const;
+			DistantClient::Stats GetClientStats(const Address& clientAddr);
+
+			// System calls counters, to check how many datagrams each call actually moves
+			struct IOStats
+			{
+				u64 receiveCalls = 0;
+				u64 receivedDatagrams = 0;
+				u64 sendCalls = 0;
+				u64 sentDatagrams = 0;
+
+				float datagramsPerReceiveCall() const { return receiveCalls ? static_cast<float>(receivedDatagrams) / receiveCalls : 0.f; }
+				float datagramsPerSendCall() const { return sendCalls ? static_cast<float>(sentDatagrams) / sendCalls : 0.f; }
+			};
+			// Updated by receive and processSend only
+			const IOStats& ioStats() const { return mIOStats; }
+			void resetIOStats() { mIOStats = IOStats(); }
 
 #if NETWORK_INTERRUPTION
 			inline void enableNetworkInterruption() { setNetworkInterruptionEnabled(true); }
@@ -88,13 +125,31 @@ namespace Networking
 		private:
 			DistantClient* getClient(const Address& clientAddr, bool create = false);
 			void setupChannels(DistantClient& client);
+			void initWakeUp();
+			void releaseWakeUp();
+			void onDatagramReceived(Datagram& datagram, u16 receivedSize, const Address& from);
+			// Datagrams are queued by the distant clients and sent all at once at the end of processSend
+			void queueDatagram(const DistantClient& client, const Datagram& dgram);
 
 		private:
+			// Called from the client's shard
 			void onMessageReady(std::unique_ptr<Messages::Base>&& msg);
 
 		private:
 			SOCKET mSocket = INVALID_SOCKET;
+			// Loopback socket used to interrupt wait from other threads
+			SOCKET mWakeUpSocket = INVALID_SOCKET;
+			Address mWakeUpAddress;
 			std::vector<std::unique_ptr<DistantClient>> mClients;
+			// Lookup indices over mClients, kept in sync when clients are created or removed
+			std::unordered_map<Address, DistantClient*, Address::Hash> mClientsByAddress;
+			std::vector<DistantClient*> mClientsById; // Ids are generated sequentially, nullptr once removed
+			std::chrono::milliseconds mNextDeadline = std::chrono::milliseconds::max();
+			bool mOutgoingPending = false; // The socket was full, some datagrams wait for the next pass
+#if UDP_BATCHED_IO
+			std::vector<Datagram> mReceiveBuffers;
+#endif
+			IOStats mIOStats;
 			u64 mClientIdsGenerator{ 0 };
 #if NETWORK_THREAD_SAFE
 			std::mutex mMessagesLock;
@@ -120,7 +175,8 @@ namespace Networking
 			public:
 				static Operation Connect(const Address& target) { return Operation(Type::Connect, target); }
 				static Operation SendTo(const Address& target, std::vector<u8>&& data, u32 channel) { return Operation(Type::SendTo, target, std::move(data), channel); }
-				static Operation BroadCast(std::vector<u8>&& data, u32 channel) { return Operation(Type::BroadCast, Address(), std::move(data), channel); }
+				static Operation SendTo(const Address& target, SharedData data, u32 channel) { return Operation(Type::SendTo, target, std::move(data), channel); }
+				static Operation BroadCast(std::vector<u8>&& data, u32 channel) { return Operation(Type::BroadCast, Address(), Core::BufferPool::Share(std::move(data)), channel); }
 				static Operation Disconnect(const Address& target) { return Operation(Type::Disconnect, target); }
 				static Operation DisconnectAll() { return Operation(Type::DisconnectAll, Address()); }
 
@@ -134,10 +190,17 @@ namespace Networking
 					, mData(std::move(data))
 					, mChannel(channel)
 				{}
+				Operation(Type type, const Address& target, SharedData&& data, u32 channel)
+					: mType(type)
+					, mTarget(target)
+					, mSharedData(std::move(data))
+					, mChannel(channel)
+				{}
 
 				Type mType;
 				Address mTarget;
 				std::vector<u8> mData;
+				SharedData mSharedData; // Broadcast or shared payload, referenced by every client instead of copied
 				u32 mChannel = 0;
 			};
 #if NETWORK_THREAD_SAFE
@@ -145,6 +208,30 @@ namespace Networking
 			using OperationsLock = std::lock_guard<decltype(mOperationsLock)>;
 #endif
 			std::vector<Operation> mPendingOperations;
+			std::vector<Operation> mProcessingOperations; // Swapped with mPendingOperations, both keep their storage
+
+			// Clients are split by id into shards, each one being processed by a single thread at a time
+			// A shard buffers everything its clients hand to the Client until the shards are merged back
+			struct Shard
+			{
+				std::vector<DistantClient*> clients;
+				std::vector<std::pair<DistantClient*, Datagram>> received;
+				std::vector<std::pair<Address, Datagram>> outgoing; // Kept from a pass to the next while the socket is full
+				std::vector<std::unique_ptr<Messages::Base>> messages;
+				std::chrono::milliseconds nextDeadline = std::chrono::milliseconds::max();
+				IOStats stats;
+			};
+			std::vector<Shard> mShards;
+			size_t mActiveShards = 1;
+			std::unique_ptr<Core::ThreadPool> mWorkers;
+
+			Shard& shardOf(const DistantClient& client) { return mShards[client.id() % mActiveShards]; }
+			void prepareShards();
+			void runShards(const std::function<void(Shard&)>& task);
+			void processShardSend(Shard& shard, std::vector<Operation>& operations);
+			// Sends the datagrams of the shard, those the socket can't take yet are kept for the next pass
+			void flushDatagrams(Shard& shard);
+			void flushMessages();
 
 #if NETWORK_SIMULATOR
 			Simulator mSimulator;
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include <array>
 #include <chrono>
 
 #include "Datagram.hpp"
@@ -30,8 +31,11 @@ namespace Networking::UDP
 		void connect();
 		void disconnect();
 		void send(std::vector<uint8_t>&& data, u32 canalIndex);
+		void send(const SharedData& data, u32 canalIndex);
 		void processSend(u8 maxDatagrams = 0);
 		void onDatagramReceived(Datagram&& datagram);
+		// Next time processSend has something to do (keep alive, ack, timeout) if no datagram is received meanwhile
+		std::chrono::milliseconds nextDeadline() const;
 		bool isConnected() const { return mState == State::Connected; }
 		bool isConnecting() const { return mState == State::ConnectionReceived || mState == State::ConnectionSent; }
 		inline bool isDisconnecting() const { return mState == State::Disconnecting; }
@@ -43,6 +47,25 @@ namespace Networking::UDP
 
 		const Address& address() const { return mAddress; }
 		u64 id() const { return mClientId; }
+		// Smoothed round trip time, zero until a first data datagram is acked
+		std::chrono::milliseconds rtt() const { return std::chrono::duration_cast<std::chrono::milliseconds>(mSmoothedRtt); }
+		std::chrono::milliseconds retransmitTimeout() const { return mRetransmitTimeout; }
+
+		struct Stats
+		{
+			u32 congestionWindow = 0; // Datagrams
+			u32 slowStartThreshold = 0;
+			u32 inFlight = 0;
+			u64 pacingRate = 0; // Bytes per second
+			std::chrono::milliseconds rtt{ 0 };
+			std::chrono::milliseconds retransmitTimeout{ 0 };
+			u64 sentDatagrams = 0; // Data datagrams only
+			u64 lostDatagrams = 0;
+			u64 unsentBytes = 0; // Queued in the reliable channels, never sent yet
+
+			float lossRate() const { return sentDatagrams ? static_cast<float>(lostDatagrams) / sentDatagrams : 0.f; }
+		};
+		Stats stats() const;
 
 		template<class T>
 		void registerChannel(u8 channelId = 0)
@@ -78,6 +101,8 @@ namespace Networking::UDP
 		AckHandler mSentAcks;
 		std::chrono::milliseconds mConnectionStartTime; // Connection start time, for connection timeout
 		std::chrono::milliseconds mLastKeepAlive; // Last time this connection has been marked alive, for timeout disconnection
+		std::chrono::milliseconds mLastDatagramSent; // Last time we sent anything to this client, to space keep alives
+		bool mShouldAck = false; // Data has been received since our last datagram, the other end is waiting for its ack
 		static std::chrono::milliseconds sTimeout; // Timeout is same for all clients
 		State mState = State::None;
 #if NETWORK_INTERRUPTION
@@ -85,6 +110,37 @@ namespace Networking::UDP
 		bool mDistantInterrupted = false; // Whether this client has its connectivity interrupted with one of its clients
 #endif
 		DisconnectionReason mDisconnectionReason = DisconnectionReason::None;
+		// Data datagrams sent and not acked yet, to estimate the round trip time and detect losses
+		// Slots are reused in a ring indexed by datagram id
+		struct SentDatagram
+		{
+			Datagram::ID id = 0;
+			std::chrono::milliseconds sentTime;
+			bool pending = false;
+		};
+		static constexpr size_t SentDatagramsRingSize = 1024; // Must divide the datagram id range
+		std::array<SentDatagram, SentDatagramsRingSize> mSentDatagrams;
+		Datagram::ID mOldestSentDatagram = 0; // No datagram older than this one is pending
+		std::chrono::microseconds mSmoothedRtt{ 0 };
+		std::chrono::microseconds mRttVariation{ 0 };
+		std::chrono::milliseconds mRetransmitTimeout = UDP_INITIAL_RTO;
+		// Congestion control (AIMD with slow start) : data datagrams in flight are limited by the congestion window
+		u32 mCongestionWindow = UDP_INITIAL_CWND;
+		u32 mSlowStartThreshold = SentDatagramsRingSize;
+		u32 mCongestionAvoidanceAcks = 0; // Acks counted since the last window increase
+		u32 mInFlight = 0;
+		u32 mConsecutiveTimeouts = 0;
+		Datagram::ID mRecoveryStart = 0; // Losses of datagrams sent before this one belong to the congestion event already handled
+		bool mInRecovery = false;
+		u64 mSentDataDatagrams = 0;
+		u64 mLostDataDatagrams = 0;
+		// Pacing : token bucket spreading the congestion window over the round trip time
+		s64 mPacingTokens = UDP_PACING_BURST * Datagram::BufferMaxSize; // Bytes
+		std::chrono::milliseconds mLastPacingRefill;
+		bool mPacingLimited = false; // Data is waiting for tokens
+		// Scratch buffers of the reception, kept to reuse their storage
+		std::vector<Datagram::ID> mNewAcks;
+		std::vector<std::tuple<u8, std::vector<u8>>> mReceivedMessages;
 		std::vector<std::unique_ptr<Messages::Base>> mPendingMessages; // Stocke les messages avant que la connexion ne soit accepte
 
 	private:
@@ -107,12 +163,22 @@ namespace Networking::UDP
 		void onConnectionRefused();
 		void onConnectionTimedOut();
 
+		void onDatagramSent(Datagram::ID datagramId, std::chrono::milliseconds now);
+		void onRttSample(std::chrono::milliseconds rtt);
+		void onDataDatagramAcked(Datagram::ID datagramId);
+		void onDataDatagramLost(Datagram::ID datagramId);
+		void onRetransmitTimeout();
+		u64 pacingRate() const;
+		bool canSendData(std::chrono::milliseconds now);
+		// Reports as lost the pending datagrams followed by enough acked ones, or waiting for longer than the retransmission timeout
+		void detectLostDatagrams(std::chrono::milliseconds now);
 		void onDatagramSentAcked(Datagram::ID datagramId);
 		void onDatagramSentLost(Datagram::ID datagramId);
 		void onDatagramReceivedLost(Datagram::ID datagramId);
 		void onDataReceived(const u8* data, u16 datasize);
 		void onMessageReady(std::unique_ptr<Messages::Base>&& msg);
 
+		bool isKeepAliveDue(std::chrono::milliseconds now) const { return mShouldAck || now >= mLastDatagramSent + UDP_KEEPALIVE_INTERVAL; }
 		void fillKeepAlive(Datagram& dgram);
 		void handleKeepAlive(const u8* data, const u16 datasize);
 
@@ -1,11 +1,18 @@
 #pragma once
 
 #include <vector>
+#include <memory>
 
 #include "Networking/UDP/Datagram.hpp"
 #include "Networking/NetworkSettings.hpp"
 #include "Core/Types.hpp"
 
+namespace Networking::UDP
+{
+	// Immutable message payload, shared by every client it is sent to
+	using SharedData = std::shared_ptr<const std::vector<u8>>;
+}
+
 namespace Networking::UDP::Protocols
 {
 	class IProtocol
@@ -17,6 +24,8 @@ namespace Networking::UDP::Protocols
 		u8 channelId() const { return mChannelId; }
 
 		virtual void queue(std::vector<uint8_t>&& msgData) = 0;
+		// Protocols able to reference the payload instead of copying it should override this
+		virtual void queue(const SharedData& msgData) { queue(std::vector<u8>(*msgData)); }
 #if NETWORK_INTERRUPTION
 		virtual u16 serialize(uint8_t* buffer, u16 buffersize, Datagram::ID datagramId, bool connectionInterrupted) = 0;
 #else
@@ -27,9 +36,12 @@ namespace Networking::UDP::Protocols
 		virtual void onDatagramLost(Datagram::ID /*datagramId*/) {}
 
 		virtual void onDataReceived(const uint8_t* data, u16 datasize) = 0;
-		virtual std::vector<std::vector<uint8_t>> process() = 0;
+		// Appends the messages ready to messages
+		virtual void process(std::vector<std::vector<uint8_t>>& messages) = 0;
 
 		virtual bool isReliable() const = 0;
+		// Bytes queued and never sent yet, for the producers to hold back instead of piling up messages
+		virtual size_t unsentBytes() const { return 0; }
 	private:
 		u8 mChannelId;
 	};
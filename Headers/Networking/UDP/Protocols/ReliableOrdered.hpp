@@ -1,19 +1,23 @@
 #pragma once
 
-#include <set>
+#include <deque>
+#include <array>
+#include <memory>
 
 #include "ProtocolInterface.hpp"
 #include "Packet.hpp"
+#include "Core/BufferPool.hpp"
 
 namespace Networking::UDP::Protocols
 {
 	class ReliableOrdered : public IProtocol
 	{
 	public:
-		ReliableOrdered(u8 channelId) : IProtocol(channelId) {}
+		ReliableOrdered(u8 channelId) : ReliableOrdered(channelId, Packet::MaxMessageSize) {}
 		~ReliableOrdered() override = default;
 
 		void queue(std::vector<u8>&& msgData) override;
+		void queue(const SharedData& msgData) override;
 #if NETWORK_INTERRUPTION
 		u16 serialize(u8* buffer, u16 buffersize, Datagram::ID datagramId, bool connectionInterrupted) override;
 #else
@@ -24,17 +28,29 @@ namespace Networking::UDP::Protocols
 		void onDatagramLost(Datagram::ID datagramId) override;
 
 		void onDataReceived(const u8* data, u16 datasize) override;
-		std::vector<std::vector<u8>> process() override;
+		void process(std::vector<std::vector<u8>>& messages) override;
 
 		bool isReliable() const override { return true; }
+		size_t unsentBytes() const override { return multiplexer.unsentBytes(); }
+
+		// Maximum number of packets in flight, bounding both the sending queue and the reassembly buffer
+		// Must be a power of two and identical on both ends. Set it before any client is created
+		static void SetWindowSize(u16 packets);
+		static u16 GetWindowSize() { return sWindowSize; }
+	protected:
+		// Messages are fragmented as they are sent and rebuilt as they are received, their size is only bounded by maxMessageSize
+		// A larger message is dropped by the sender, and by the receiver if it comes from a peer ignoring the limit : the next ones are still delivered
+		ReliableOrdered(u8 channelId, size_t maxMessageSize) : IProtocol(channelId), multiplexer(maxMessageSize), demultiplexer(maxMessageSize) {}
 	private:
+		static u16 sWindowSize;
+
 		class RMultiplexer
 		{
 		public:
-			RMultiplexer() = default;
+			RMultiplexer(size_t maxMessageSize) : mMaxMessageSize(maxMessageSize) {}
 			~RMultiplexer() = default;
 
-			void queue(std::vector<u8>& msgData);
+			void queue(const SharedData& msgData);
 #if NETWORK_INTERRUPTION
 			u16 serialize(u8* buffer, u16 buffersize, Datagram::ID datagramId, bool connectionInterrupted);
 #else
@@ -43,23 +59,60 @@ namespace Networking::UDP::Protocols
 
 			void onDatagramAcked(Datagram::ID datagramId);
 			void onDatagramLost(Datagram::ID datagramId);
+
+			size_t unsentBytes() const { return mUnsentBytes; }
 		private:
 			class ReliablePacket
 			{
 			public:
-				Packet& packet() { return mPacket; }
-				const Packet& packet() const { return mPacket; }
+				ReliablePacket(Packet::ID id, Packet::Type type, const SharedData& data, size_t offset, u16 size);
 
-				void onSent(Datagram::ID datagramId) { mDatagramsIncluding.insert(datagramId); mShouldSend = false; }
-				bool isIncludedIn(Datagram::ID datagramId) const { return mDatagramsIncluding.find(datagramId) != mDatagramsIncluding.cend(); }
+				Packet::ID id() const { return mHeader.id; }
+				u16 size() const { return Packet::HeaderSize + mHeader.size; }
+				u16 dataSize() const { return mHeader.size; }
+				void setType(Packet::Type type) { mHeader.type = type; }
+				// Writes the packet header followed by its slice of the message
+				void write(u8* buffer) const;
+
+				void onSent() { mShouldSend = false; }
+				void onAcked() { mAcked = true; mShouldSend = false; }
+				bool isAcked() const { return mAcked; }
 				void resend() { mShouldSend = true; }
-				bool shouldSend() { return mShouldSend; }
+				bool shouldSend() const { return mShouldSend; }
 			private:
-				Packet mPacket;
-				std::set<Datagram::ID> mDatagramsIncluding;
+				Packet::Header mHeader;
+				SharedData mData; // Whole message, shared by its fragments and by every client it is broadcast to
+				size_t mOffset;
 				bool mShouldSend = true;
+				bool mAcked = false;
 			};
-			std::vector<ReliablePacket> mQueue;
+			// Packets included in a sent datagram, until it is acked or lost
+			// Slots are reused in a ring indexed by datagram id, their vector keeping its capacity
+			struct SentDatagram
+			{
+				Datagram::ID id = 0;
+				bool pending = false;
+				std::vector<Packet::ID> packets;
+			};
+			static constexpr size_t SentDatagramsRingSize = 1024; // Must divide the datagram id range
+
+			ReliablePacket* find(Packet::ID packetId);
+			void onPacketsLost(SentDatagram& datagram);
+			// Cuts the queued messages into packets, as far as the sending window allows
+			void fillQueue();
+
+			// The deques are used as FIFOs and allocate a new chunk each time the tail crosses one : the chunks are recycled
+			template<class T>
+			using Queue = std::deque<T, Core::BufferPool::BlockAllocator<T>>;
+
+			const size_t mMaxMessageSize;
+			Queue<SharedData> mPendingMessages; // Messages not entirely cut into packets yet
+			size_t mPendingOffset = 0; // Size of the first pending message already cut into packets
+			Queue<ReliablePacket> mQueue; // Contiguous ids : mQueue[i] is packet mQueue.front().id() + i
+			Queue<Packet::ID> mResendQueue;
+			size_t mNextNewPacket = 0; // Index in mQueue of the first packet never sent
+			size_t mUnsentBytes = 0; // Message bytes not sent once yet
+			std::array<SentDatagram, SentDatagramsRingSize> mSentDatagrams;
 			Packet::ID mNextId = 0;
 			Packet::ID mFirstAllowedPacket = 0;
 		};
@@ -67,19 +120,27 @@ namespace Networking::UDP::Protocols
 		class RDemultiplexer
 		{
 		public:
-			RDemultiplexer() = default;
+			RDemultiplexer(size_t maxMessageSize) : mMaxMessageSize(maxMessageSize) {}
 			~RDemultiplexer() = default;
 
 			void onDataReceived(const u8* data, u16 datasize);
-			std::vector<std::vector<u8>> process();
+			// Appends the packets received in order to the message being rebuilt and extracts the completed messages
+			void process(std::vector<std::vector<u8>>& messagesReady);
 
-			static constexpr size_t QueueSize = 512 * Packet::MaxPacketsPerMessage; // Tma la taille de la queue
 		private:
 			void onPacketReceived(const Packet* pckt);
+			std::unique_ptr<Packet>& slot(Packet::ID id) { return mWindow[id % mWindow.size()]; }
+			void releasePacket(std::unique_ptr<Packet>& packet);
+			void appendToMessage(const Packet& packet);
+			void dropPartialMessage();
 
-			std::array<Packet, QueueSize> mPendingQueue;
+			const size_t mMaxMessageSize;
+			// Ring over the window following mLastProcessed. Packets are only allocated once received
+			std::vector<std::unique_ptr<Packet>> mWindow;
+			std::vector<std::unique_ptr<Packet>> mFreePackets;
 			Packet::ID mLastProcessed = std::numeric_limits<Packet::ID>::max();
-			bool isMessageFull(size_t index, Networking::UDP::Datagram::ID packetID, const size_t& startIndexOffset) const;
+			std::vector<u8> mPartialMessage; // Fragments of the message being rebuilt, received in order
+			bool mHasPartialMessage = false;
 		};
 		RMultiplexer multiplexer;
 		RDemultiplexer demultiplexer;
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ReliableOrdered.hpp"
+
+namespace Networking::UDP::Protocols
+{
+	// Reliable and ordered like ReliableOrdered, for messages of any size up to UDP_STREAM_MAX_MESSAGE_SIZE
+	// Only the packets within the window exist at a time on each end, but messages are whole : the sender keeps each one until it is sent,
+	// and the receiver rebuilds it before handing it over. Each channel of each peer may hold up to UDP_STREAM_MAX_MESSAGE_SIZE that way,
+	// larger contents are to be split in several messages, as the file parts and the action batches are. Larger messages are dropped
+	class ReliableStream : public ReliableOrdered
+	{
+	public:
+		ReliableStream(u8 channelId) : ReliableOrdered(channelId, UDP_STREAM_MAX_MESSAGE_SIZE) {}
+		~ReliableStream() override = default;
+	};
+}
@@ -19,7 +19,7 @@ namespace Networking::UDP::Protocols
 #endif
 
 		void onDataReceived(const uint8_t* data, u16 datasize) override;
-		std::vector<std::vector<uint8_t>> process() override;
+		void process(std::vector<std::vector<uint8_t>>& messages) override;
 
 		bool isReliable() const override { return false; }
 	private:
@@ -43,7 +43,7 @@ namespace Networking::UDP::Protocols
 			~UDemultiplexer() = default;
 
 			void onDataReceived(const uint8_t* data, u16 datasize);
-			std::vector<std::vector<uint8_t>> process();
+			void process(std::vector<std::vector<uint8_t>>& messagesReady);
 
 		private:
 			void onPacketReceived(const Packet* pckt);
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Core/Types.hpp"
+#include "Core/MappedFile.hpp"
+
+namespace Resources
+{
+	// Files received from the network, stored on disk under their content hash so they survive restarts
+	class ContentCache
+	{
+	public:
+		ContentCache(const char* directoryIn) : directory(directoryIn) {};
+
+		~ContentCache() = default;
+
+		// Whether the file with the given hash is fully written with the expected size
+		bool Contains(u64 hash, u64 size) const;
+		// Whether a complete file of any size is stored under the hash : it is never downloaded into in place
+		bool IsComplete(u64 hash) const;
+		// Written aside then renamed over the entry, the mappings of the entry keep the content they had
+		// Windows refuses the rename while the entry is mapped, it is then left as is
+		void Write(u64 hash, const u8* data, u64 size) const;
+		// Copies a local file into the cache, under the hash of its content. False if it can't be read or written
+		bool Import(const std::string& sourcePath, u64& hash) const;
+		// Where the file with the given hash is, or will be written
+		std::string GetFilePath(u64 hash) const;
+
+		// Downloads in progress are written in place, a .part file beside holds the bitmap of the parts written so far
+		// The bitmap stays mapped until the download is complete, marking a part doesn't touch the file system
+		// Reads the bitmap into parts, sized to the parts count. False if there is no download of this size in progress
+		bool ReadPartial(u64 hash, std::vector<bool>& parts);
+		// Starts a download, or starts it over : no part written yet
+		bool StartPartial(u64 hash, u32 partsCount);
+		// Marks a part as written, once it is in the file
+		void WritePartial(u64 hash, u32 partIndex);
+		// Marks the file as complete
+		void RemovePartial(u64 hash);
+
+	private:
+		std::string GetPartialPath(u64 hash) const;
+
+		std::string directory;
+		std::unordered_map<u64, Core::MappedFile> partials; // Bitmaps of the downloads in progress
+	};
+
+}
\ No newline at end of file
@@ -1,49 +1,94 @@
 #pragma once
 
+#include <deque>
+#include <functional>
 #include <list>
+#include <memory>
 #include <unordered_map>
-#include <variant>
 
 #include "LargeFile.hpp"
-#include "Chat/ActionData.hpp"
-#include "Chat/ChatMessage.hpp"
+#include "Chat/ActionCodec.hpp"
 
 namespace Resources
 {
-	struct FileHolder
+	struct FileTransfer
 	{
 		const LargeFile* file = nullptr;
 		u32 currentPacket = 0;
+		std::vector<bool> heldParts; // Already held by the receiver, skipped
 
-		FileHolder(const LargeFile* in) : file(in) {}
-	};
-
-	struct UserTransferDataHolder
-	{
-		std::variant<const LargeFile*, const Chat::ChatMessage*> object;
-		u32 currentPacket = 0;
-
-		UserTransferDataHolder(const LargeFile* in) : object(in) {}
-		UserTransferDataHolder(const Chat::ChatMessage* in) : object(in) {}
+		FileTransfer(const LargeFile* in, std::vector<bool>&& held) : file(in), heldParts(std::move(held)) { file->AddReader(); }
+		FileTransfer(FileTransfer&& other) noexcept : file(other.file), currentPacket(other.currentPacket), heldParts(std::move(other.heldParts)) { other.file = nullptr; }
+		FileTransfer(const FileTransfer&) = delete;
+		FileTransfer& operator=(const FileTransfer&) = delete;
+		~FileTransfer() { if (file) file->RemoveReader(); }
 	};
 
+	// Streams files to each user, several at once
+	// Users are served in turn with deficit round robin, so a large transfer to one of them doesn't stall the others
+	// For a given user, the small files (user icons) go first and the large ones last, interleaved by parts
+	// A part is encoded once for all the users it is sent to in the same format, they share its buffer
 	class FileDataManager
 	{
 	public:
+		using SharedPart = std::shared_ptr<const std::vector<u8>>;
+		// Files up to this size go before the larger ones
+		static constexpr u64 SmallFileSize = 0x40000;
+		// Bytes added to the allowance of a user on each of its turns, above the size of a part
+		static constexpr s64 Quantum = 0x10000;
+
 		FileDataManager() = default;
 
 		~FileDataManager() = default;
 
-		bool HasPendingFiles() const;
-		void AddFileToBroadCast(const LargeFile* fileIn);
-		void AddFileToUser(u64 userNetworkID, const LargeFile* fileIn);
-		void AddMessageToUser(u64 userNetworkID, const Chat::ChatMessage* messIn);
-		Chat::ActionData GetNextFilePart();
-		bool HasUserPendingData(u64 userNetworkID);
-		Chat::ActionData GetNextUserDataPart(u64 userNetworkID);
+		bool HasPendingData() const;
+		// heldParts lists the parts the receiver already has, empty if it has none
+		void AddFileToUser(u64 userNetworkID, const LargeFile* fileIn, std::vector<bool>&& heldParts = {});
+		void RemoveUser(u64 userNetworkID);
+		// Appends the next encoded parts to send with their receiver, until budget bytes are taken or every user is out of space
+		// queueSpace gives how many bytes can still be queued to a user, the last part may go over it and over budget
+		void GetNextParts(const std::function<s64(u64 /*userNetworkID*/)>& queueSpace, const std::function<Chat::ProtocolVersion(u64 /*userNetworkID*/)>& userVersion,
+			Chat::ActionOrigin origin, s64 budget, std::vector<std::pair<u64 /*userNetworkID*/, SharedPart>>& out);
 	private:
-		std::list<FileHolder> broadcastedFiles;
-		std::unordered_map<u64, std::list<UserTransferDataHolder>> files;
+		struct UserTransfers
+		{
+			std::list<FileTransfer> smallFiles;
+			std::list<FileTransfer> largeFiles;
+			s64 deficit = 0;
+			s64 space = 0; // Left for the current GetNextParts call
+
+			bool IsEmpty() const { return smallFiles.empty() && largeFiles.empty(); }
+		};
+
+		// Parts are told apart by content hash as well, a file holding other content sends other parts
+		struct PartKey
+		{
+			const LargeFile* file = nullptr;
+			u64 contentHash = 0;
+			u32 packet = 0;
+			bool legacy = false;
+
+			bool operator==(const PartKey& other) const { return file == other.file && contentHash == other.contentHash && packet == other.packet && legacy == other.legacy; }
+			struct Hash
+			{
+				size_t operator()(const PartKey& key) const { return std::hash<const void*>()(key.file) ^ std::hash<u64>()(key.contentHash ^ (static_cast<u64>(key.packet) << 1 | key.legacy)); }
+			};
+		};
+
+		// Takes the next file part of the user, which must have one. nullptr if its file can't be read, the file is then dropped
+		SharedPart TakeNextPart(UserTransfers& user, Chat::ProtocolVersion version, Chat::ActionOrigin origin);
+		// Encodes the current part of the file at the front of the list, then moves it to the back or drops it once sent
+		// Reuses the buffer of the same part while another user still has it queued. nullptr, dropping the file, if its content isn't held
+		SharedPart TakeFilePart(std::list<FileTransfer>& list, Chat::ProtocolVersion version, Chat::ActionOrigin origin);
+		// First part from the given one the receiver doesn't hold
+		static u32 NextMissingPart(const std::vector<bool>& heldParts, u32 packet);
+
+		std::unordered_map<u64, UserTransfers> users;
+		std::deque<u64> activeUsers; // Turn order, only users with pending data
+		static constexpr size_t MinSharedPartsSweepSize = 0x100;
+		// Parts encoded for a user, alive as long as one of the connections holds them
+		std::unordered_map<PartKey, std::weak_ptr<const std::vector<u8>>, PartKey::Hash> sharedParts;
+		size_t sharedPartsSweepSize = MinSharedPartsSweepSize; // The expired parts are dropped once there are this many
 	};
 
 }
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Core/Types.hpp"
+#include "Core/MappedFile.hpp"
+#include "Chat/ActionData.hpp"
+
+namespace Resources
+{
+	// Append only log of the chat messages, kept as serialized for the network so the history survives restarts
+	// Records are written one after the other in segment files, an index file gives where each one starts
+	// Both are mapped : opening the log and reading its last records doesn't depend on the history size
+	class HistoryLog
+	{
+	public:
+		// Size of the segment files, a record that doesn't fit in the last one starts a new one
+		static constexpr u64 SegmentSize = 0x400000;
+		// Type and payload size before each record in its segment
+		static constexpr u64 RecordHeaderSize = sizeof(u8) + sizeof(u32);
+
+		HistoryLog() = default;
+		HistoryLog(const HistoryLog&) = delete;
+		HistoryLog& operator=(const HistoryLog&) = delete;
+		~HistoryLog() = default;
+
+		// Opens the log held in the given directory, created if needed. False if it can't be written
+		bool Open(const std::string& directoryIn);
+		void Close();
+		bool IsOpen() const { return index.IsOpen(); }
+
+		// Appends a serialized message : its payload starts with its timestamp, the id of its sender and its own id
+		// The record is only counted once written, a crash of the process meanwhile loses it but not the ones before
+		// Nothing is flushed : the system writes the mapped pages back in any order, so after a system crash the count can be ahead of records that never reached the disk
+		// Open only drops the last ones whose header doesn't fit in their segment, or whose id isn't above the one of the record before
+		// Closes the log if the index can't grow
+		bool Append(const Chat::ActionData& record);
+		// Records count
+		u64 Size() const { return count; }
+		// Copies the record at the given index, false if it is damaged
+		bool Read(u64 recordIndex, Chat::ActionData& record) const;
+		s64 GetTimeStamp(u64 recordIndex) const;
+		u64 GetMessageID(u64 recordIndex) const;
+		// First record whose message id isn't below the given one, Size() if there is none
+		// Records are in the order of their ids : the server gives them in sequence, and continues from the last one after a restart
+		u64 LowerBound(u64 messageID) const;
+
+	private:
+		struct Entry
+		{
+			u32 segment = 0;
+			u32 offset = 0; // Of the record header in its segment
+			s64 time = 0;
+			u64 messageID = 0;
+		};
+
+		static constexpr u32 Magic = 0x43484c47; // "CHLG"
+		static constexpr u32 Version = 1;
+		// Magic, version and records count before the entries
+		static constexpr u64 IndexHeaderSize = 2 * sizeof(u32) + sizeof(u64);
+		static constexpr u64 EntrySize = 2 * sizeof(u32) + sizeof(s64) + sizeof(u64);
+		// Entries the index file is first sized for, it doubles when full
+		static constexpr u64 MinIndexCapacity = 0x1000;
+
+		std::string GetIndexPath() const;
+		std::string GetSegmentPath(u32 segment) const;
+		u64 GetIndexCapacity() const { return (index.GetSize() - IndexHeaderSize) / EntrySize; }
+		bool ReadEntry(u64 recordIndex, Entry& entry) const;
+		void WriteEntry(u64 recordIndex, const Entry& entry);
+		void WriteCount();
+		// Mapped when first read, nullptr if it is missing
+		const Core::MappedFile* GetSegment(u32 segment) const;
+		// Maps the segment records are appended to, for writing
+		bool OpenLastSegment(u32 segment);
+		// Where the record of the entry ends in its segment, 0 if it is damaged
+		u64 GetRecordEnd(const Entry& entry) const;
+
+		std::string directory;
+		Core::MappedFile index;
+		mutable std::vector<Core::MappedFile> segments; // Indexed by segment, the last one is mapped for writing
+		u64 count = 0;
+		u32 lastSegment = 0;
+		u64 lastSegmentSize = 0; // Bytes of the last segment used by records
+	};
+
+}
\ No newline at end of file
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <atomic>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "Core/Types.hpp"
 #include "Core/Signal.hpp"
+#include "Core/MappedFile.hpp"
 #include "Networking/Serialization/Serializer.hpp"
 #include "Networking/Serialization/Deserializer.hpp"
 
@@ -13,27 +16,84 @@ namespace Resources
 	class LargeFile
 	{
 	public:
+		// Bytes written by SerializePacket at most : index, size and 32 KB of data
+		static constexpr u64 MaxSerializedPacketSize = sizeof(u32) + sizeof(u16) + 0x8000;
+		// Largest content a peer can describe, as the images the chat sends : it sizes the buffer or the cache file it is received in
+		static constexpr u64 MaxContentSize = 0x800000;
+
 		LargeFile();
 
+		// First 64 bits of the SHA-256 of the content, identifies a file by its content whatever its path
+		// Peers exchange files by this hash : matching a content someone else sent takes about 2^64 tries,
+		// but a sender choosing both contents finds two with the same hash in about 2^32, so it tells contents apart rather than authenticating them
+		static u64 HashContent(const u8* data, u64 size);
+		// Bitmap of the parts a receiver holds, sent with its request so that only the missing ones are streamed
+		static void SerializeParts(const std::vector<bool>& parts, Networking::Serialization::Serializer& sr);
+		static bool DeserializeParts(Networking::Serialization::Deserializer& dr, std::vector<bool>& parts);
+		// Bytes of content held by all the files, on the heap or mapped
+		static u64 GetTotalContentSize() { return totalContentSize.load(); }
+
 		virtual ~LargeFile();
 
-		virtual bool PreLoad(Networking::Serialization::Deserializer& dr, const std::string& path);
-		virtual bool AcceptPacket(Networking::Serialization::Deserializer& dr);
+		// Describes the file for its content to be received. Refused once complete or while it is sent, the content must stay as is
+		virtual bool PreLoad(Networking::Serialization::Deserializer& dr, std::string_view path);
+		bool CanPreLoad() const { return !complete && !HasReaders(); }
+		virtual bool AcceptPacket(Networking::Serialization::Deserializer& dr, u32& packetIndex);
+		// Copies a part received or read back from a partial download
+		virtual bool AcceptPart(u32 packetIndex, const u8* data, u32 size);
+		// False if the content isn't held
 		virtual bool SerializePacket(u32 packetIndex, Networking::Serialization::Serializer& sr) const;
 		virtual bool SerializeFile(Networking::Serialization::Serializer& sr) const;
+		// Fills a preloaded file at once, the content must match its size and hash
+		virtual bool AcceptContent(const u8* data, u64 size);
+		// Same, with the content of a file mapped in place of a copy
+		virtual bool MapContent(const std::string& filePath);
+		// Receives a preloaded file straight into the given file, mapped and sized to the content, instead of the heap
+		// What the file held is kept : the parts already written to it are then marked with RestoreParts
+		bool MapReceiveBuffer(const std::string& filePath);
+		virtual bool RestoreParts(const std::vector<bool>& parts);
+		bool IsMapped() const { return mapping.IsOpen(); }
 		bool IsComplete() const { return complete; }
+		// Set when every part was received but the content doesn't match the hash : the parts are all missing again
+		bool IsContentRejected() const { return contentRejected; }
 		u32 GetPacketsCount() const;
 		u32 GetLastPacketSize() const;
+		u32 GetPacketSize(u32 packetIndex) const;
+		static u64 GetPacketOffset(u32 packetIndex) { return (u64)packetIndex << 15; }
+		const std::vector<bool>& GetReceivedParts() const { return receivedParts; }
 		const std::string& GetPath() const { return path; }
 		const std::string& GetFileType() const { return fileType; }
+		// 0 when unknown, as with files described by older peers
+		u64 GetContentHash() const { return contentHash; }
+		const u8* GetContentData() const { return FileData; }
+		u64 GetContentSize() const { return dataSize; }
 		float GetLoadingCompletion() const;
+		// Counts the transfers reading the content from the network thread, it isn't released while there are any
+		void AddReader() const { readers++; }
+		void RemoveReader() const { readers--; }
+		bool HasReaders() const { return readers.load() != 0; }
 	protected:
+		// Serves a local file from a read only mapping of its copy in the cache
+		bool MapSource(const std::string& filePath);
+		// Sets the content, of dataSize bytes, counted in the total until released
+		void SetContent(u8* data);
+		// Frees the content, mapped or not
+		void ReleaseContent();
+		// Once every part is received : checks the hash, or marks all the parts missing again if it doesn't match
+		bool CheckContent();
+
 		u8* FileData = nullptr;
 		u64 dataSize = 0;
+		u64 contentHash = 0;
 		bool complete = false;
+		bool contentRejected = false;
 		std::string fileType;
 		std::string path;
 		std::vector<bool> receivedParts;
+		Core::MappedFile mapping; // Holds FileData when it is open
+		mutable std::atomic<u32> readers = 0;
+
+		static inline std::atomic<u64> totalContentSize = 0;
 	};
 
 }
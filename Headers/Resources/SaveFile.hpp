@@ -1,12 +1,12 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
 
-#include "Chat/User.hpp"
+#include "Chat/UserManager.hpp"
 
 namespace Resources
 {
+	// Names and colors of the users, for the messages of the history to show who sent them
 	class SaveFile
 	{
 	public:
@@ -15,8 +15,10 @@ namespace Resources
 
 		~SaveFile() = default;
 
-		void LoadData(std::unordered_map<u64, Chat::User>& userList);
-		void SaveData(std::unordered_map<u64, Chat::User>& userList);
+		// Adds the saved users missing from the list, as disconnected. False if there is no valid save
+		bool LoadData(Chat::UserManager& userList);
+		// Replaces the save with the users of the list
+		bool SaveData(Chat::UserManager& userList);
 
 	private:
 		std::string path;
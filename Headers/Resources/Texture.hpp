@@ -1,6 +1,7 @@
 #pragma once
 
-
+#include <condition_variable>
+#include <mutex>
 
 #include "LargeFile.hpp"
 #include "Maths/Maths.hpp"
@@ -38,21 +39,48 @@ enum class TextureError : u8
 
 namespace Resources
 {
+	class ContentCache;
+
 	class Texture : public LargeFile
 	{
 	public:
+		// Long side of the thumbnails sent ahead of larger images
+		static constexpr s32 ThumbnailSize = 256;
 
 		Texture();
 		virtual ~Texture() override;
 
 		static const char* GetError(TextureError error);
 		static const char* GetSTBIError();
-		static TextureError TryLoad(const char* path, Texture* ptr, Maths::Vec2 minSize = Maths::Vec2(0,0), Maths::Vec2 maxSize = Maths::Vec2(0,0), u64 maxFileSize = -1);
-
-		virtual bool PreLoad(Networking::Serialization::Deserializer& dr, const std::string& path) override;
-		virtual bool AcceptPacket(Networking::Serialization::Deserializer& dr) override;
+		// Checks the file and reads the image size, its pixels are decoded afterwards by TextureManager::Decode
+		// The file is copied into the cache and served from there, it can be edited or deleted while it is sent
+		static TextureError TryLoad(const char* path, Texture* ptr, const ContentCache& cache, Maths::Vec2 minSize = Maths::Vec2(0,0), Maths::Vec2 maxSize = Maths::Vec2(0,0), u64 maxFileSize = -1);
+		// Decodes an image file to RGBA pixels, from any thread. nullptr if it is invalid
+		static u8* DecodeImage(const u8* data, u64 size, s32& width, s32& height);
+		static void FreeImage(u8* pixels);
+		// Box filtered copy of RGBA pixels, its long side brought down to maxSide. Freed with FreeImage
+		static u8* Downscale(const u8* pixels, s32 width, s32 height, s32 maxSide, s32& outWidth, s32& outHeight);
+		// Encodes RGBA pixels to a JPEG file, or to a PNG one when they aren't opaque
+		static bool EncodeImage(const u8* pixels, s32 width, s32 height, std::vector<u8>& file, std::string& type);
+
+		virtual bool PreLoad(Networking::Serialization::Deserializer& dr, std::string_view path) override;
+		// Content hash of a description, read past without a texture : it follows its path. 0 if it has none
+		static u64 ReadContentHash(Networking::Serialization::Deserializer& dr);
 		virtual bool SerializeFile(Networking::Serialization::Serializer& sr) const override;
-		TextureError LoadFromMemory();
+		// Uploads pixels decoded from the content, taking them. On the GL thread
+		TextureError EndDecode(u8* pixels, s32 width, s32 height);
+		// Gives the texture a content made locally along with its pixels, taking them. On the GL thread
+		TextureError LoadGenerated(std::string_view path, std::string_view type, const u8* data, u64 size, u8* pixels, s32 width, s32 height);
+		// Smaller copy of the image, drawn until the full one is downloaded. nullptr if it has none
+		Texture* GetThumbnail() const { return thumbnail; }
+		void SetThumbnail(Texture* thumb) { thumbnail = thumb; }
+		// Set while a worker reads the content, which must not be released until then
+		void SetDecoding(bool v);
+		bool IsDecoding() const { return decoding.Load(); }
+		// Sleeps until the worker is done with the content
+		void WaitForDecode() const;
+		// Changes each time the texture gets another content, decoded pixels of an older one are dropped
+		u32 GetContentGeneration() const { return contentGeneration; }
 		TextureError GetLastError() { return lastError; }
 
 		virtual void Load(const char* path);
@@ -61,6 +89,34 @@ namespace Resources
 		virtual void UnLoad();
 		bool IsLoaded() const { return loaded.Load(); }
 
+		// Drawn this frame : textures drawn with it are evicted by the TextureManager once over its budget, least recently drawn first
+		// They are loaded again the frame after they are drawn, the others are never evicted
+		void MarkUsed() const;
+		u32 GetLastUse() const { return lastUse; }
+		// Textures drawn, least recently drawn first : MarkUsed moves a texture to the back
+		static Texture* GetLeastRecentlyUsed() { return usedFirst; }
+		static Texture* GetMostRecentlyUsed() { return usedLast; }
+		Texture* GetNextUsed() const { return usedNext; }
+		Texture* GetPreviousUsed() const { return usedPrev; }
+		// Out of the list until drawn again, for textures with nothing left to evict
+		void RemoveFromUsed();
+		// Back in the list of a texture drawn before, at the front : for a content loaded again without being drawn
+		void AddToLeastUsed();
+		static u32 GetCurrentFrame() { return currentFrame; }
+		static void NextFrame() { currentFrame++; }
+		// Bytes of the uploaded texture with its mipmaps, 0 if it isn't
+		u64 GetUploadedSize() const;
+		// Over all the textures, kept up to date as they are uploaded and evicted
+		static u64 GetTotalUploadedSize() { return totalUploadedSize; }
+		static u32 GetUploadedCount() { return uploadedCount; }
+		static u32 GetEvictedCount() { return evictedCount; }
+		// Frees the GL texture, the content is kept to decode it again once drawn
+		void EvictUpload();
+		// Frees the content too : the texture is then as if it was only described, until its content is mapped back from the cache
+		void EvictContent();
+		bool IsEvicted() const { return evicted; }
+		void ClearEvicted() { SetEvicted(false); }
+
 		void DeleteData();
 
 		u64 GetTextureID() const;
@@ -101,9 +157,27 @@ namespace Resources
 		bool ShouldFlipTexture = false;
 		bool IsTextureLoading = false;
 		u8* ImageData = nullptr;
+		Texture* thumbnail = nullptr;
+		mutable u32 lastUse = 0; // Frame it was last drawn, 0 if it never was
+		bool evicted = false;
 		Core::Signal loaded;
+		Core::Signal decoding;
+		mutable std::mutex decodingLock;
+		mutable std::condition_variable decodingDone;
+		u32 contentGeneration = 0;
 		TextureError lastError = TextureError::NONE;
-
+		mutable Texture* usedPrev = nullptr;
+		mutable Texture* usedNext = nullptr;
+
+		// Counted in the totals
+		void SetLoaded(bool v);
+		void SetEvicted(bool v);
+
+		static inline Texture* usedFirst = nullptr;
+		static inline Texture* usedLast = nullptr;
+		static inline u64 totalUploadedSize = 0;
+		static inline u32 uploadedCount = 0;
+		static inline u32 evictedCount = 0;
 		static inline s32 MAX_TEXTURE_UNIT = 16;
 		static inline s32 TEXTURE_UPPER = 4;
 		static inline s32 CUBEMAP_UPPER = 8;
@@ -113,5 +187,6 @@ namespace Resources
 		static inline s32 currentCubeUnit = 0;
 		static inline s32 currentShadowUnit = 0;
 		static inline s32 currentCubeShadowUnit = 0;
+		static inline u32 currentFrame = 1;
 	};
 }
\ No newline at end of file
@@ -2,21 +2,40 @@
 
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "Texture.hpp"
+#include "ContentCache.hpp"
+
+namespace Core
+{
+	class ThreadPool;
+}
 
 namespace Resources
 {
 	class TextureManager
 	{
 	public:
+		struct Stats
+		{
+			u64 uploadedBytes = 0; // GL textures, mipmaps included
+			u64 contentBytes = 0; // File contents held, on the heap or mapped
+			u32 resident = 0; // Textures uploaded
+			u32 evicted = 0; // Textures evicted and not drawn since
+			u64 evictions = 0; // Since the start
+		};
+
 		TextureManager();
 
-		~TextureManager() = default;
+		~TextureManager();
 
-		Texture* GetTexture(std::string key);
+		Texture* GetTexture(std::string_view key);
 
-		Texture* GetOrCreateTexture(std::string key);
+		Texture* GetOrCreateTexture(std::string_view key);
 
 		Texture* GetDefaultUserTexture();
 
@@ -26,8 +45,73 @@ namespace Resources
 
 		void EmplaceTexture(std::string& key, std::unique_ptr<Texture>&& tex);
 
+		// Texture::TryLoad with the cache of the manager
+		TextureError TryLoad(const char* path, Texture* tex, Maths::Vec2 minSize, Maths::Vec2 maxSize, u64 maxFileSize);
+
+		// A texture holding the given content, nullptr if none. Also looks at the ones still being received if onlyComplete is false
+		// An evicted texture with that content gets it mapped back from the cache
+		const Texture* FindContent(u64 hash, bool onlyComplete = true);
+		// Completes a preloaded texture from the disk cache, mapped, or from another texture with the same content
+		// Returns false if its content, or the parts missing from a previous download, have to be downloaded
+		// It is then received straight into its cache file, unless prepareDownload is false as it isn't requested yet
+		bool LoadContent(Texture* tex, bool prepareDownload = true);
+		void StoreContent(const Texture* tex);
+		// Saves a received part, for the download to resume after a disconnection or a restart
+		void StorePart(const Texture* tex, u32 packetIndex);
+		// Forgets the parts saved for a download whose content was rejected, they are all downloaded again
+		void RestartDownload(const Texture* tex);
+
+		// Decodes a complete texture on the workers, it is uploaded by the first Update after that
+		// With makeThumbnail, images larger than Texture::ThumbnailSize also get a thumbnail, set on them by Update
+		void Decode(Texture* tex, bool makeThumbnail = false);
+		// Uploads the textures decoded since the last call, once per frame on the GL thread
+		// Then evicts the textures drawn least recently while over budget, and loads again the evicted ones drawn since the last call
+		void Update();
+		// Evicted textures drawn again whose content is gone from the cache, since the last call. Their download is up to the chat
+		void TakeLostContents(std::vector<Texture*>& out);
+
+		// Bytes of uploaded textures and of file contents above which the textures marked as used are evicted
+		void SetBudget(u64 uploadBytes, u64 contentBytes);
+		Stats GetStats() const { return stats; }
+
 	private:
+		struct DecodedImage
+		{
+			Texture* tex = nullptr;
+			u32 generation = 0;
+			u8* pixels = nullptr;
+			s32 width = 0;
+			s32 height = 0;
+			std::vector<u8> thumbnailFile; // Encoded, empty if it has no thumbnail
+			std::string thumbnailType;
+			u8* thumbnailPixels = nullptr;
+			s32 thumbnailWidth = 0;
+			s32 thumbnailHeight = 0;
+		};
+
+		static constexpr u32 MaxDecodeThreads = 4;
+		static constexpr u64 DefaultUploadBudget = 0x10000000; // 256 MB
+		static constexpr u64 DefaultContentBudget = 0x8000000; // 128 MB
+
+		// Only walks the textures drawn this frame, and the least recently drawn ones while over budget
+		void UpdateResidency();
+		// Maps the content of an evicted texture back from the cache, the texture stays marked as evicted until it is drawn
+		bool RestoreContent(Texture* tex);
+		static bool CanEvictContent(const Texture* tex);
+		// Lists the texture under its content hash for FindContent, textures only get one once described, loaded or received
+		void IndexContent(Texture* tex);
+
 		std::unordered_map<std::string, std::unique_ptr<Resources::Texture>> textures;
+		std::unordered_multimap<u64, Texture*> contents; // By content hash, the entries of textures described again since are dropped when met
+		ContentCache cache = ContentCache("Saved/Cache");
+		std::mutex decodedLock;
+		std::vector<DecodedImage> decoded; // Filled by the workers
+		std::vector<DecodedImage> uploads; // Kept to reuse its storage
+		std::vector<Texture*> lostContents;
+		u64 uploadBudget = DefaultUploadBudget;
+		u64 contentBudget = DefaultContentBudget;
+		Stats stats;
+		std::unique_ptr<Core::ThreadPool> decoders; // Last : joined before the textures are destroyed
 	};
 
 }
\ No newline at end of file
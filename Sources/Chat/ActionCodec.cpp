@@ -0,0 +1,244 @@
+#include "Chat/ActionCodec.hpp"
+
+#include <algorithm>
+
+#include "Networking/Serialization/Deserializer.hpp"
+#include "Core/BufferPool.hpp"
+
+using namespace Chat;
+using namespace Networking::Serialization;
+
+namespace
+{
+	// Legacy action types are below it : a batch starting with this bit set is compact, the low bits hold its format
+	constexpr u8 CompactBatchMarker = 0x80;
+
+	enum class Field : u8
+	{
+		TIME, // s64, written as the difference with the previous time of the batch
+		ID, // u64
+		STRING, // u64 size and characters
+	};
+
+	struct Layout
+	{
+		u8 count = 0;
+		Field fields[4] = {};
+	};
+
+	// Leading fields of the payloads re-encoded in compact batches, the bytes after them are copied as is
+	// A payload that doesn't match its layout is sent as is : the layouts only matter for the size
+	Layout GetLayout(Action type, ActionOrigin origin)
+	{
+		switch (type)
+		{
+		case Action::MESSAGE_TEXT:
+			if (origin == ActionOrigin::CLIENT)
+				return { 2, { Field::ID, Field::STRING } };
+			return { 4, { Field::TIME, Field::ID, Field::ID, Field::STRING } };
+		case Action::MESSAGE_IMAGE: // Followed by the file description
+			return { 4, { Field::TIME, Field::ID, Field::ID, Field::STRING } };
+		case Action::USER_CONNECT:
+		case Action::USER_DISCONNECT:
+			return { 3, { Field::TIME, Field::ID, Field::ID } };
+		case Action::USER_UPDATE_NAME:
+			return { 2, { Field::ID, Field::STRING } };
+		case Action::USER_UPDATE_COLOR:
+			return { 1, { Field::ID } };
+		case Action::USER_UPDATE_ICON: // Path, file type, file size then the image size
+			return { 4, { Field::ID, Field::STRING, Field::STRING, Field::ID } };
+		case Action::FILE_DATA:
+			return { 1, { Field::STRING } };
+		case Action::HISTORY_REQUEST:
+			return { 2, { Field::TIME, Field::ID } };
+		default:
+			return {};
+		}
+	}
+
+	bool CompactPayload(const ActionData& action, const Layout& layout, s64& lastTime, Serializer& out)
+	{
+		Deserializer dr(action.data);
+		s64 time = lastTime;
+		for (u8 i = 0; i < layout.count; i++)
+		{
+			switch (layout.fields[i])
+			{
+			case Field::TIME:
+			{
+				s64 value;
+				if (!dr.Read(value)) return false;
+				out.WriteVarInt(static_cast<s64>(static_cast<u64>(value) - static_cast<u64>(time)));
+				time = value;
+			} break;
+			case Field::ID:
+			{
+				u64 value;
+				if (!dr.Read(value)) return false;
+				out.WriteVarInt(value);
+			} break;
+			case Field::STRING:
+			{
+				std::string_view value;
+				if (!dr.ReadString(value)) return false;
+				out.WriteVarInt(static_cast<u64>(value.size()));
+				out.Write(reinterpret_cast<const u8*>(value.data()), value.size());
+			} break;
+			}
+		}
+		out.Write(action.data.data() + dr.CursorPos(), dr.BufferSize() - dr.CursorPos());
+		lastTime = time;
+		return true;
+	}
+
+	bool ExpandPayload(const u8* data, u64 size, const Layout& layout, s64& lastTime, Serializer& out)
+	{
+		Deserializer dr(data, size);
+		for (u8 i = 0; i < layout.count; i++)
+		{
+			switch (layout.fields[i])
+			{
+			case Field::TIME:
+			{
+				s64 delta;
+				if (!dr.ReadVarInt(delta)) return false;
+				lastTime = static_cast<s64>(static_cast<u64>(lastTime) + static_cast<u64>(delta));
+				out.Write(lastTime);
+			} break;
+			case Field::ID:
+			{
+				u64 value;
+				if (!dr.ReadVarInt(value)) return false;
+				out.Write(value);
+			} break;
+			case Field::STRING:
+			{
+				u64 length;
+				std::string_view value;
+				if (!dr.ReadVarInt(length) || !dr.ReadView(value, length)) return false;
+				out.Write(static_cast<u64>(value.size()));
+				out.Write(reinterpret_cast<const u8*>(value.data()), value.size());
+			} break;
+			}
+		}
+		out.Write(data + dr.CursorPos(), size - dr.CursorPos());
+		return true;
+	}
+
+	bool DecodeLegacy(Deserializer& dr, std::vector<ActionData>& out)
+	{
+		while (dr.CursorPos() < dr.BufferSize())
+		{
+			ActionData action;
+			u64 size;
+			const u8* payload;
+			if (!dr.Read(reinterpret_cast<u8&>(action.type)) || !dr.Read(size) || !dr.ReadView(payload, size)) return false;
+			action.data = Core::BufferPool::Acquire(size);
+			action.data.insert(action.data.cend(), payload, payload + size);
+			out.push_back(std::move(action));
+		}
+		return true;
+	}
+
+	bool DecodeCompact(Deserializer& dr, ActionOrigin origin, std::vector<ActionData>& out)
+	{
+		s64 lastTime = 0;
+		while (dr.CursorPos() < dr.BufferSize())
+		{
+			u64 tag;
+			u64 size;
+			const u8* payload;
+			if (!dr.ReadVarInt(tag) || tag >> 1 > 0xff || !dr.ReadVarInt(size) || !dr.ReadView(payload, size)) return false;
+			ActionData action;
+			action.type = static_cast<Action>(tag >> 1);
+			if (tag & 1)
+			{
+				const Layout layout = GetLayout(action.type, origin);
+				Serializer sr(size + layout.count * sizeof(u64));
+				if (!ExpandPayload(payload, size, layout, lastTime, sr)) return false;
+				action.data = sr.TakeBuffer();
+			}
+			else
+			{
+				action.data = Core::BufferPool::Acquire(size);
+				action.data.insert(action.data.cend(), payload, payload + size);
+			}
+			out.push_back(std::move(action));
+		}
+		return true;
+	}
+}
+
+void Chat::ActionCodec::Encode(const ActionData* actions, size_t count, ProtocolVersion version, ActionOrigin origin, Serializer& sr)
+{
+	if (count == 0) return;
+	if (version == ProtocolVersion::LEGACY)
+	{
+		u64 total = sr.GetBufferSize();
+		for (size_t i = 0; i < count; i++)
+		{
+			total += sizeof(u8) + sizeof(u64) + actions[i].data.size();
+		}
+		sr.Reserve(total);
+		for (size_t i = 0; i < count; i++)
+		{
+			sr.Write(static_cast<u8>(actions[i].type));
+			sr.Write(static_cast<u64>(actions[i].data.size()));
+			sr.Write(actions[i].data.data(), actions[i].data.size());
+		}
+		return;
+	}
+
+	sr.Write(static_cast<u8>(CompactBatchMarker | static_cast<u8>(ProtocolVersion::COMPACT)));
+	s64 lastTime = 0;
+	Serializer payload;
+	for (size_t i = 0; i < count; i++)
+	{
+		const ActionData& action = actions[i];
+		const Layout layout = GetLayout(action.type, origin);
+		payload.Clear();
+		const bool compacted = layout.count > 0 && CompactPayload(action, layout, lastTime, payload);
+		sr.WriteVarInt(static_cast<u64>(action.type) << 1 | (compacted ? 1 : 0));
+		if (compacted)
+		{
+			sr.WriteVarInt(payload.GetBufferSize());
+			sr.Write(payload.GetBuffer(), payload.GetBufferSize());
+		}
+		else
+		{
+			sr.WriteVarInt(static_cast<u64>(action.data.size()));
+			sr.Write(action.data.data(), action.data.size());
+		}
+	}
+}
+
+void Chat::ActionCodec::Encode(const std::vector<ActionData>& list, ProtocolVersion version, ActionOrigin origin, Serializer& sr)
+{
+	Encode(list.data(), list.size(), version, origin, sr);
+}
+
+bool Chat::ActionCodec::Decode(const u8* data, u64 size, ActionOrigin origin, std::vector<ActionData>& out)
+{
+	Deserializer dr(data, size);
+	if (size == 0 || !(data[0] & CompactBatchMarker))
+	{
+		return DecodeLegacy(dr, out);
+	}
+	u8 marker;
+	dr.Read(marker);
+	if ((marker & ~CompactBatchMarker) != static_cast<u8>(ProtocolVersion::COMPACT)) return false;
+	return DecodeCompact(dr, origin, out);
+}
+
+ActionData Chat::ActionCodec::MakeVersionAction()
+{
+	const u8 version = static_cast<u8>(CurrentProtocolVersion);
+	return ActionData(Action::PROTOCOL_VERSION, &version, sizeof(version));
+}
+
+bool Chat::ActionCodec::ReadVersionAction(const ActionData& action, ProtocolVersion& version)
+{
+	if (action.type != Action::PROTOCOL_VERSION || action.data.empty()) return false;
+	version = static_cast<ProtocolVersion>(std::min(action.data[0], static_cast<u8>(CurrentProtocolVersion)));
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,163 @@
+// Standalone benchmark of the bytes sent per action by each ActionCodec format
+// Excluded from the application build, built on its own with the codec sources, on Windows as Conversion.cpp uses the WinSock htonll and htonf :
+//   cl /std:c++17 /O2 /EHsc /IHeaders Sources/Chat/ActionCodecBenchmark.cpp Sources/Chat/ActionCodec.cpp Sources/Networking/Serialization/Serializer.cpp Sources/Networking/Serialization/Deserializer.cpp Sources/Networking/Serialization/Conversion.cpp Sources/Core/BufferPool.cpp Ws2_32.lib
+// The corpus is read from the text file given as argument, one chat line per line
+// Without one, short lines are generated : no recorded traffic ships with the repository
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Chat/ActionCodec.hpp"
+
+using namespace Chat;
+using namespace Networking::Serialization;
+
+namespace
+{
+	struct Corpus
+	{
+		std::vector<ActionData> fromClient;
+		std::vector<ActionData> fromServer;
+	};
+
+	ActionData MakeAction(Action type, Serializer& sr)
+	{
+		const std::vector<u8> buffer = sr.TakeBuffer();
+		return ActionData(type, buffer.data(), buffer.size());
+	}
+
+	void WriteString(Serializer& sr, const std::string& text)
+	{
+		sr.Write(static_cast<u64>(text.size()));
+		sr.Write(reinterpret_cast<const u8*>(text.data()), text.size());
+	}
+
+	std::vector<std::string> GenerateLines(std::mt19937_64& rng)
+	{
+		const char* words[] = { "ok", "lol", "yes", "the", "build", "is", "green", "again", "see", "you", "tomorrow", "thanks", "what", "about", "that", "image" };
+		std::vector<std::string> lines(2000);
+		for (std::string& line : lines)
+		{
+			const u64 wordCount = 1 + rng() % 8;
+			for (u64 i = 0; i < wordCount; i++)
+			{
+				if (i) line += ' ';
+				line += words[rng() % 16];
+			}
+		}
+		return lines;
+	}
+
+	// The payloads the chat builds for these lines, as laid out in memory, with a few user actions mixed in
+	Corpus BuildCorpus(const std::vector<std::string>& lines, std::mt19937_64& rng)
+	{
+		Corpus corpus;
+		// Ids and timestamps are in ms since the epoch, as the chat generates them
+		s64 time = 1760000000000ll;
+		const u64 users[4] = { 1760000000123ull, 1760000004567ull, 1760000099999ull, 1760000123456ull };
+		for (const std::string& line : lines)
+		{
+			const u64 user = users[rng() % 4];
+			const u64 messageID = static_cast<u64>(time) + rng() % 1000;
+			time += rng() % 20000;
+			switch (rng() % 20)
+			{
+			case 0:
+			{
+				Serializer sr;
+				sr.Write(time);
+				sr.Write(user);
+				sr.Write(messageID);
+				corpus.fromServer.push_back(MakeAction(Action::USER_CONNECT, sr));
+			} break;
+			case 1:
+			{
+				Serializer sr;
+				sr.Write(user);
+				WriteString(sr, "user" + std::to_string(rng() % 100));
+				corpus.fromClient.push_back(MakeAction(Action::USER_UPDATE_NAME, sr));
+				corpus.fromServer.push_back(corpus.fromClient.back());
+			} break;
+			case 2:
+			{
+				Serializer sr;
+				sr.Write(user);
+				corpus.fromClient.push_back(MakeAction(Action::USER_UPDATE_COLOR, sr));
+			} break;
+			default:
+			{
+				Serializer client;
+				client.Write(messageID);
+				WriteString(client, line);
+				corpus.fromClient.push_back(MakeAction(Action::MESSAGE_TEXT, client));
+				Serializer server;
+				server.Write(time);
+				server.Write(user);
+				server.Write(messageID);
+				WriteString(server, line);
+				corpus.fromServer.push_back(MakeAction(Action::MESSAGE_TEXT, server));
+			} break;
+			}
+		}
+		return corpus;
+	}
+
+	// Encodes the actions in batches of the given size, false if one doesn't decode back to the same actions
+	bool Measure(const char* name, const std::vector<ActionData>& actions, ActionOrigin origin, size_t batchSize)
+	{
+		bool roundTrip = true;
+		u64 legacy = 0;
+		u64 compact = 0;
+		for (size_t first = 0; first < actions.size(); first += batchSize)
+		{
+			const size_t count = std::min(batchSize, actions.size() - first);
+			for (ProtocolVersion version : { ProtocolVersion::LEGACY, CurrentProtocolVersion })
+			{
+				Serializer sr;
+				ActionCodec::Encode(actions.data() + first, count, version, origin, sr);
+				(version == ProtocolVersion::LEGACY ? legacy : compact) += sr.GetBufferSize();
+				std::vector<ActionData> decoded;
+				roundTrip &= ActionCodec::Decode(sr.GetBuffer(), sr.GetBufferSize(), origin, decoded) && decoded.size() == count;
+				for (size_t i = 0; roundTrip && i < count; i++)
+					roundTrip = decoded[i].type == actions[first + i].type && decoded[i].data == actions[first + i].data;
+			}
+		}
+		const double count = static_cast<double>(std::max<size_t>(actions.size(), 1));
+		printf("%s, %zu action(s) per batch : %.1f -> %.1f B/action (%.0f%%)\n", name, batchSize, legacy / count, compact / count, legacy ? 100.0 * compact / legacy - 100.0 : 0.0);
+		return roundTrip;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::mt19937_64 rng(42);
+	std::vector<std::string> lines;
+	if (argc > 1)
+	{
+		std::ifstream file(argv[1]);
+		for (std::string line; std::getline(file, line);)
+		{
+			if (!line.empty()) lines.push_back(line);
+		}
+		if (lines.empty())
+		{
+			printf("Could not read a corpus from %s\n", argv[1]);
+			return 1;
+		}
+	}
+	else
+	{
+		lines = GenerateLines(rng);
+	}
+	const Corpus corpus = BuildCorpus(lines, rng);
+	bool roundTrip = true;
+	roundTrip &= Measure("client -> server", corpus.fromClient, ActionOrigin::CLIENT, 1);
+	roundTrip &= Measure("server -> client", corpus.fromServer, ActionOrigin::SERVER, 1);
+	roundTrip &= Measure("server -> client", corpus.fromServer, ActionOrigin::SERVER, 8);
+	printf("Round trip %s\n", roundTrip ? "OK" : "FAILED");
+	return roundTrip ? 0 : 1;
+}
@@ -1,5 +1,6 @@
 #include "Chat/ChatManager.hpp"
 
+#include <algorithm>
 #include <ImGUI/imgui.h>
 #include <ImGUI-FileBrowser/imfilebrowser.h>
 #include <ImGUI/imgui_stdlib.hpp>
@@ -58,6 +59,12 @@ void Chat::ClientChatManager::RenderConnectionScreen()
 void Chat::ServerChatManager::Update()
 {
 	reinterpret_cast<ChatServerThread*>(ntwThread.get())->Update();
+	// Renames are only saved when the chat closes
+	if (history.IsOpen() && users->GetAllUsers().size() != savedUsers)
+	{
+		userSave.SaveData(*users);
+		savedUsers = users->GetAllUsers().size();
+	}
 }
 
 Chat::ChatManager::ChatManager(UserManager* u, Resources::TextureManager* t, u64 s, ImGui::FileBrowser* br) : users(u), textures(t), selfID(s), browser(br)
@@ -82,33 +89,54 @@ void Chat::ChatManager::UpdateUserIcon()
 
 void ChatManager::Render()
 {
+	// Not before the view is brought down to the latest messages, it starts at the top
+	if (scrollY <= 0 && !setDown)
+	{
+		LoadOlderMessages();
+	}
 	if (setDown && lastHeight != 0)
 	{
 		setDown = false;
-		ImGui::SetNextWindowScroll(ImVec2(0, lastHeight + messages.back()->GetHeight() + 10));
+		scrollShift = 0;
+		ImGui::SetNextWindowScroll(ImVec2(0, lastHeight + messages.Back()->GetHeight() + MessageSpacing));
+	}
+	else if (scrollShift != 0)
+	{
+		ImGui::SetNextWindowScroll(ImVec2(0, scrollY + scrollShift));
+		scrollShift = 0;
 	}
 	if (ImGui::Begin("Channel", nullptr, ImGuiWindowFlags_NoCollapse))
 	{
 		Chat::TextMessage::MaxWidth = ImGui::GetContentRegionMax().x - ImGui::GetWindowContentRegionMin().x - 90;
 		ImGui::SetCursorPosX(70);
-		float pos = totalHeight + 10;
-		for (auto it = messages.rbegin(); it != messages.rend(); it++)
+		scrollY = ImGui::GetScrollY();
+		// Only the messages in view are drawn
+		const f32 top = scrollY - MessagesTop;
+		messages.ForEachInRange(top, top + ImGui::GetWindowHeight(), [this](const ChatMessage* mess, f32 offset)
+		{
+			ImGui::SetCursorPosY(MessagesTop + offset);
+			mess->Draw(requestedImages);
+		});
+		// Keeps the scroll range of the whole history
+		ImGui::SetCursorPosY(MessagesTop + messages.GetTotalHeight() - MessageSpacing);
+		ImGui::Dummy(ImVec2(0, 0));
+		textures->TakeLostContents(requestedImages);
+		for (Resources::Texture* tex : requestedImages)
 		{
-			pos -= it->get()->GetHeight();
-			ImGui::SetCursorPosY(pos);
-			it->get()->Draw();
-			pos -= 10;
-			ImGui::SetCursorPosY(pos);
+			ntwThread->RequestFile(tex);
 		}
+		requestedImages.clear();
 		ImGui::End();
 		ImGui::Begin("Channel", nullptr, ImGuiWindowFlags_NoCollapse);
 		lastHeight = ImGui::GetScrollMaxY();
+		// Nothing to scroll : already down
+		if (lastHeight == 0) setDown = false;
 		ImGui::End();
 	}
 	if (ImGui::Begin("Send Message", nullptr, ImGuiWindowFlags_NoCollapse))
 	{
 		bool valided = ImGui::InputTextMultiline("##textInput", &currentText, ImVec2(0,0), ImGuiInputTextFlags_CtrlEnterForNewLine | ImGuiInputTextFlags_EnterReturnsTrue);
-		if (currentText.size() > 32768) currentText.resize(32768);
+		if (currentText.size() > TextMessage::MaxLength) currentText.resize(TextMessage::MaxLength);
 		if ((ImGui::Button("Send Message") || valided) && !currentText.empty())
 		{
 			SendChatMessage();
@@ -124,10 +152,19 @@ void ChatManager::Render()
 			std::filesystem::path texPath = browser->GetSelected();
 			std::string path = texPath.string();
 			Resources::Texture* result = textures->GetOrCreateTexture(path);
-			lastError = Resources::Texture::TryLoad(path.c_str(), result, Maths::Vec2(), Maths::Vec2(), 0x800000);
+			lastError = textures->TryLoad(path.c_str(), result, Maths::Vec2(), Maths::Vec2(), Resources::LargeFile::MaxContentSize);
 			if (lastError == TextureError::NONE)
 			{
-				SendChatImage(result);
+				if (std::max(result->GetTextureWidth(), result->GetTextureHeight()) <= Resources::Texture::ThumbnailSize)
+				{
+					textures->Decode(result);
+					SendChatImage(result);
+				}
+				else if (std::find(pendingImages.begin(), pendingImages.end(), result) == pendingImages.end())
+				{
+					textures->Decode(result, true);
+					pendingImages.push_back(result);
+				}
 			}
 			else
 			{
@@ -135,6 +172,7 @@ void ChatManager::Render()
 			}
 			browser->ClearSelected();
 		}
+		SendPendingImages();
 		DrawPopup();
 		ImGui::End();
 	}
@@ -142,27 +180,55 @@ void ChatManager::Render()
 
 void Chat::ChatManager::ReceiveMessage(std::unique_ptr<ChatMessage>&& mess)
 {
-	for (auto it = messages.rbegin(); it != messages.rend(); it++)
+	const ChatMessage* received = mess.get();
+	if (!InsertMessage(std::move(mess))) return;
+	if (history.IsOpen())
 	{
-		if (mess->GetTimeStamp() >= it->get()->GetTimeStamp())
-		{
-			totalHeight += mess->GetHeight() + 10;
-			messages.emplace(it.base(), std::move(mess));
-			if (it == messages.rbegin())
-			{
-				lastHeight = 0;
-				setDown = true;
-			}
-			return;
-		}
+		history.Append(received->Serialize());
 	}
-	totalHeight += mess->GetHeight() + 10;
-	messages.push_front(std::move(mess));;
 }
 
-const std::list<std::unique_ptr<ChatMessage>>& ChatManager::GetAllMessages()
+bool Chat::ChatManager::InsertMessage(std::unique_ptr<ChatMessage>&& mess)
 {
-	return messages;
+	const ChatMessage* inserted = mess.get();
+	// Already received with the history
+	if (!messages.Insert(std::move(mess))) return false;
+	// The view starts at the latest messages and follows them
+	if (messages.Back() == inserted)
+	{
+		lastHeight = 0;
+		setDown = true;
+	}
+	else if (messages.OffsetOf(messages.IndexOf(inserted->GetID())) <= std::max(scrollY - MessagesTop, 0.0f))
+	{
+		// Keeps the same messages in view
+		scrollShift += inserted->GetHeight() + MessageSpacing;
+	}
+	return true;
+}
+
+void Chat::ChatManager::SendPendingImages()
+{
+	for (auto it = pendingImages.begin(); it != pendingImages.end();)
+	{
+		Resources::Texture* tex = *it;
+		if (tex->IsLoaded())
+		{
+			SendChatImage(tex);
+		}
+		else if (tex->IsDecoding() || tex->GetLastError() == TextureError::NONE)
+		{
+			// Not uploaded yet
+			it++;
+			continue;
+		}
+		else
+		{
+			lastError = tex->GetLastError();
+			ImGui::OpenPopup("Chat Texture Error");
+		}
+		it = pendingImages.erase(it);
+	}
 }
 
 void Chat::ChatManager::DrawPopup()
@@ -233,11 +299,19 @@ void Chat::ClientChatManager::SendChatImage(Resources::Texture* tex)
 	sr.Write((s64)0);
 	sr.Write(selfID);
 	sr.Write((u64)0);
-	tex->SerializeFile(sr);
+	ImageMessage::SerializeImage(tex, sr);
 	ntwThread->PushAction(Action::MESSAGE_IMAGE, sr.GetBuffer(), sr.GetBufferSize());
 	currentText.clear();
 }
 
+void Chat::ClientChatManager::LoadOlderMessages()
+{
+	// The latest ones come with the connection
+	if (messages.Empty()) return;
+	const ChatMessage* first = messages.At(0);
+	reinterpret_cast<ChatClientThread*>(ntwThread.get())->RequestHistory(first->GetTimeStamp(), first->GetID());
+}
+
 void Chat::ClientChatManager::Render()
 {
 	switch (ntwThread->GetState())
@@ -275,6 +349,39 @@ void Chat::ClientChatManager::Render()
 Chat::ServerChatManager::ServerChatManager(UserManager* users, Resources::TextureManager* textures, u64 s, ImGui::FileBrowser* br) : ChatManager(users, textures, s, br)
 {
 	ntwThread = std::make_unique<ChatServerThread>(users->GetUser(selfID), this, users, textures);
+	if (!history.Open(HistoryPath)) return;
+	// The users first, for the messages read back to show who sent them
+	userSave.LoadData(*users);
+	firstLoaded = history.Size();
+	LoadOlderMessages();
+	if (history.Size() > 0)
+	{
+		reinterpret_cast<ChatServerThread*>(ntwThread.get())->SetMessageCounter(history.GetMessageID(history.Size() - 1) + 1);
+	}
+}
+
+Chat::ServerChatManager::~ServerChatManager()
+{
+	if (history.IsOpen())
+	{
+		userSave.SaveData(*users);
+	}
+}
+
+void Chat::ServerChatManager::LoadOlderMessages()
+{
+	ChatServerThread* thread = reinterpret_cast<ChatServerThread*>(ntwThread.get());
+	const u64 first = firstLoaded > HistoryPageSize ? firstLoaded - HistoryPageSize : 0;
+	ActionData record;
+	for (u64 i = first; i < firstLoaded; i++)
+	{
+		if (!history.Read(i, record)) continue;
+		if (std::unique_ptr<ChatMessage> mess = thread->ReadHistoryRecord(record))
+		{
+			InsertMessage(std::move(mess));
+		}
+	}
+	firstLoaded = first;
 }
 
 void Chat::ServerChatManager::SendChatMessage()
@@ -299,11 +406,17 @@ void Chat::ServerChatManager::SendChatImage(Resources::Texture* tex)
 	u64 receivedTime = time(nullptr);
 	std::unique_ptr<Chat::ImageMessage> mess = std::make_unique<Chat::ImageMessage>(tex, users->GetUser(selfID), receivedTime, messID);
 	ReceiveMessage(std::move(mess));
+	// For the history to show it after a restart, like the images received
+	textures->StoreContent(tex);
+	if (tex->GetThumbnail())
+	{
+		textures->StoreContent(tex->GetThumbnail());
+	}
 	Networking::Serialization::Serializer sr;
 	sr.Write(receivedTime);
 	sr.Write(selfID);
 	sr.Write(messID);
-	tex->SerializeFile(sr);
+	ImageMessage::SerializeImage(tex, sr);
 	ntwThread->PushAction(Chat::Action::MESSAGE_IMAGE, sr.GetBuffer(), sr.GetBufferSize());
 }
 
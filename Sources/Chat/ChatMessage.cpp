@@ -1,5 +1,6 @@
 #include "Chat/ChatMessage.hpp"
 
+#include <algorithm>
 #include <time.h>
 
 #include "Networking/Serialization/Serializer.hpp"
@@ -8,8 +9,9 @@ using namespace Chat;
 
 float TextMessage::MaxWidth = 300.0f;
 
-Chat::TextMessage::TextMessage(std::string& textIn, User* userIn, s64 tm, u64 id) : ChatMessage(userIn, tm, id)
+Chat::TextMessage::TextMessage(std::string_view textIn, User* userIn, s64 tm, u64 id) : ChatMessage(userIn, tm, id)
 {
+	message.reserve(textIn.size());
 	std::vector<std::string> text;
 	height = ImGui::GetTextLineHeight() + 10;
 	auto reset = [&](bool newLine)
@@ -19,7 +21,7 @@ Chat::TextMessage::TextMessage(std::string& textIn, User* userIn, s64 tm, u64 id
 		height += ImGui::GetTextLineHeight();
 	};
 	reset(false);
-	for (auto& t : textIn)
+	for (char t : textIn)
 	{
 		if (t == '\n')
 		{
@@ -39,7 +41,7 @@ Chat::TextMessage::TextMessage(std::string& textIn, User* userIn, s64 tm, u64 id
 	if (height < 60) height = 60;
 }
 
-void TextMessage::Draw() const
+void TextMessage::Draw(std::vector<Resources::Texture*>&) const
 {
 	ImVec2 pos = ImGui::GetCursorPos();
 	DrawUser(pos);
@@ -70,7 +72,7 @@ Chat::ActionData Chat::TextMessage::Serialize() const
 	sr.Write(reinterpret_cast<const u8*>(message.data()), message.size());
 	Chat::ActionData action;
 	action.type = Chat::Action::MESSAGE_TEXT;
-	action.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	action.data = sr.TakeBuffer();
 	return action;
 }
 
@@ -81,16 +83,36 @@ Chat::ImageMessage::ImageMessage(Resources::Texture* img, User* userIn, s64 tm,
 }
 
 Resources::Texture* Chat::ImageMessage::unloadedImg = nullptr;
-void Chat::ImageMessage::Draw() const
+void Chat::ImageMessage::Draw(std::vector<Resources::Texture*>& downloads) const
 {
 	ImVec2 pos = ImGui::GetCursorPos();
 	DrawUser(pos);
-	if (tex->IsLoaded())
+	// The thumbnail is enough at this size, the full image is only downloaded once opened or saved
+	const Resources::Texture* thumbnail = tex->GetThumbnail();
+	const Resources::Texture* shown = thumbnail && thumbnail->IsLoaded() ? thumbnail : tex;
+	// Kept loaded while on screen, evicted first once scrolled away
+	if (ImGui::IsRectVisible(ImVec2(width, 200))) (thumbnail ? thumbnail : tex)->MarkUsed();
+	if (shown->IsLoaded())
 	{
-		ImGui::Image((ImTextureID)tex->GetTextureID(), ImVec2(width, 200));
+		ImGui::Image((ImTextureID)shown->GetTextureID(), ImVec2(width, 200));
+		ImGui::PushID(messageSTR);
+		if (ImGui::IsItemClicked(ImGuiMouseButton_Left))
+		{
+			if (!tex->IsComplete()) downloads.push_back(tex);
+			ImGui::OpenPopup("View");
+		}
+		ImGui::PopID();
 		if (ImGui::BeginPopupContextItem(messageSTR))
 		{
-			if (ImGui::Button("Save File"))
+			if (!tex->IsComplete())
+			{
+				if (ImGui::Button("Download"))
+				{
+					downloads.push_back(tex);
+					ImGui::CloseCurrentPopup();
+				}
+			}
+			else if (ImGui::Button("Save File"))
 			{
 				std::string path = std::string("Saved\\") + messageSTR;
 				tex->SaveFileData(path);
@@ -102,12 +124,29 @@ void Chat::ImageMessage::Draw() const
 			}
 			ImGui::EndPopup();
 		}
+		ImGui::PushID(messageSTR);
+		if (ImGui::BeginPopup("View"))
+		{
+			tex->MarkUsed();
+			if (tex->IsLoaded())
+			{
+				const float scale = std::min(1.0f, MaxViewSize / std::max(tex->GetTextureWidth(), tex->GetTextureHeight()));
+				ImGui::Image((ImTextureID)tex->GetTextureID(), ImVec2(tex->GetTextureWidth() * scale, tex->GetTextureHeight() * scale));
+			}
+			else
+			{
+				ImGui::TextUnformatted("Downloading...");
+				ImGui::ProgressBar(tex->GetLoadingCompletion(), ImVec2(200, 20));
+			}
+			ImGui::EndPopup();
+		}
+		ImGui::PopID();
 	}
 	else
 	{
 		ImGui::Image((ImTextureID)unloadedImg->GetTextureID(), ImVec2(200, 200));
 		ImGui::SetCursorPos(ImVec2(pos.x, pos.y + 100));
-		ImGui::ProgressBar(tex->GetLoadingCompletion(), ImVec2(200, 20));
+		ImGui::ProgressBar((thumbnail ? thumbnail : tex)->GetLoadingCompletion(), ImVec2(200, 20));
 	}
 	ImGui::SetCursorPosX(pos.x);
 }
@@ -118,10 +157,10 @@ Chat::ActionData Chat::ImageMessage::Serialize() const
 	sr.Write(unixTime);
 	sr.Write(sender->userID);
 	sr.Write(messageID);
-	tex->SerializeFile(sr);
+	SerializeImage(tex, sr);
 	Chat::ActionData action;
 	action.type = Chat::Action::MESSAGE_IMAGE;
-	action.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	action.data = sr.TakeBuffer();
 	return action;
 }
 
@@ -130,6 +169,15 @@ void Chat::ImageMessage::SetDefaultImage(Resources::Texture* imgIn)
 	unloadedImg = imgIn;
 }
 
+void Chat::ImageMessage::SerializeImage(const Resources::Texture* img, Networking::Serialization::Serializer& sr)
+{
+	img->SerializeFile(sr);
+	if (const Resources::Texture* thumbnail = img->GetThumbnail())
+	{
+		thumbnail->SerializeFile(sr);
+	}
+}
+
 Chat::ChatMessage::ChatMessage(User* s, s64 timeIn, u64 id) : sender(s), messageID(id)
 {
 	Maths::Util::GetHex(messageSTR, messageID);
@@ -164,7 +212,7 @@ Chat::ConnectionMessage::ConnectionMessage(bool connected, User* userIn, s64 tm,
 	height = ImGui::GetTextLineHeight() + 10;
 }
 
-void Chat::ConnectionMessage::Draw() const
+void Chat::ConnectionMessage::Draw(std::vector<Resources::Texture*>&) const
 {
 	ImVec2 pos = ImGui::GetCursorPos();
 	ImGui::SetCursorPos(ImVec2(pos.x, pos.y));
@@ -188,6 +236,6 @@ Chat::ActionData Chat::ConnectionMessage::Serialize() const
 	sr2.Write(messageID);
 	Chat::ActionData action;
 	action.type = connect ? Chat::Action::USER_CONNECT : Chat::Action::USER_DISCONNECT;
-	action.data = std::vector(sr2.GetBuffer(), sr2.GetBuffer() + sr2.GetBufferSize());
+	action.data = sr2.TakeBuffer();
 	return action;
 }
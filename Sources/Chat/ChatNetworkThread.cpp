@@ -1,8 +1,10 @@
 #include "Chat/ChatNetworkThread.hpp"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
-#include "Networking/UDP/Protocols/ReliableOrdered.hpp"
+#include "Networking/UDP/Protocols/ReliableStream.hpp"
 #include "Networking/Errors.hpp"
 #include "Networking/Messages.hpp"
 #include "Chat/ChatManager.hpp"
@@ -10,22 +12,20 @@
 Chat::ChatNetworkThread::ChatNetworkThread(User* selfUser, ChatManager* managerIn, UserManager* usersIn, Resources::TextureManager* texturesIn) :
 	self(selfUser), manager(managerIn), users(usersIn), textures(texturesIn)
 {
-	client.registerChannel<Networking::UDP::Protocols::ReliableOrdered>();
+	// Action batches, like the welcome bundle sent to a new user, aren't bounded by the packets count of a ReliableOrdered message
+	client.registerChannel<Networking::UDP::Protocols::ReliableStream>();
 }
 
 Chat::ChatNetworkThread::~ChatNetworkThread()
 {
 	shouldQuit.Store(true);
+	client.wakeUp();
 	t.join();
 }
 
 void Chat::ChatNetworkThread::Update()
 {
 	actions.clear();
-	if (files.HasPendingFiles() && !clientStallBool)
-	{
-		actionQueue.push_back(std::move(files.GetNextFilePart()));
-	}
 	for (size_t i = 0; i < actionQueue.size(); i++)
 	{
 		if (actionQueue[i].type == Action::USER_UPDATE_ICON)
@@ -37,7 +37,7 @@ void Chat::ChatNetworkThread::Update()
 				User* user = users->GetUser(userID);
 				if (user->userID != 0)
 				{
-					files.AddFileToBroadCast(user->userTex);
+					ShareFile(user->userTex, user);
 				}
 			}
 		}
@@ -45,24 +45,124 @@ void Chat::ChatNetworkThread::Update()
 		{
 			Networking::Serialization::Deserializer dr(actionQueue[i].data);
 			u64 userID;
-			u64 size;
 			u64 dummyTime;
 			s64 dummyID;
-			if (!dr.Read(dummyTime) || !dr.Read(userID) || !dr.Read(dummyID) || !dr.Read(size))
+			std::string_view tmp;
+			if (!dr.Read(dummyTime) || !dr.Read(userID) || !dr.Read(dummyID) || !dr.ReadString(tmp))
 			{
 				continue;
 			}
-			std::string tmp;
-			tmp.resize(size);
-			if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) continue;
 			Resources::Texture* tex = textures->GetTexture(tmp);
 			if (tex == textures->GetDefaultImage()) continue;
-			files.AddFileToBroadCast(tex);
+			ShareFile(tex, users->GetUser(userID));
 		}
 		actions.push_back(std::move(actionQueue[i]));
 	}
 	actionQueue.clear();
 	signal.Store(true);
+	client.wakeUp();
+}
+
+s64 Chat::ChatNetworkThread::GetQueueSpace(const Networking::UDP::DistantClient::Stats& stats)
+{
+	const s64 window = std::max<s64>(2 * static_cast<s64>(stats.congestionWindow) * Networking::UDP::Datagram::DataMaxSize, MinQueuedFileBytes);
+	return window - static_cast<s64>(stats.unsentBytes);
+}
+
+size_t Chat::ChatNetworkThread::GetBatchEnd(const std::vector<ActionData>& list, size_t first)
+{
+	u64 size = list[first].data.size();
+	size_t last = first + 1;
+	while (last < list.size() && size + list[last].data.size() <= MaxBatchSize)
+	{
+		size += list[last++].data.size();
+	}
+	return last;
+}
+
+void Chat::ChatNetworkThread::SendBatches(const Networking::Address& to, const std::vector<ActionData>& list, ProtocolVersion version, ActionOrigin origin)
+{
+	for (size_t first = 0; first < list.size();)
+	{
+		const size_t last = GetBatchEnd(list, first);
+		Networking::Serialization::Serializer sr;
+		ActionCodec::Encode(list.data() + first, last - first, version, origin, sr);
+		client.sendTo(to, sr.TakeBuffer(), 0);
+		first = last;
+	}
+}
+
+Resources::Texture* Chat::ChatNetworkThread::ReadDescription(Networking::Serialization::Deserializer& dr, std::string_view path)
+{
+	Resources::Texture* tex = textures->GetOrCreateTexture(path);
+	if (tex->CanPreLoad()) return tex->PreLoad(dr, path) ? tex : nullptr;
+	// Read ahead on a copy, the description is only skipped if it is kept
+	Networking::Serialization::Deserializer ahead = dr;
+	const u64 hash = Resources::Texture::ReadContentHash(ahead);
+	std::string key;
+	for (u64 i = 0; ; i++)
+	{
+		if (hash != 0 && tex->GetContentHash() == hash)
+		{
+			// Same content, as the same file sent again
+			Resources::Texture::ReadContentHash(dr);
+			return tex;
+		}
+		key = std::string(path) + "@" + Maths::Util::GetHex(i);
+		tex = textures->GetTexture(key);
+		if (tex == textures->GetDefaultImage()) break;
+	}
+	tex = textures->GetOrCreateTexture(key);
+	if (!tex->PreLoad(dr, key)) return nullptr;
+	describedAgain[std::string(path)] = tex;
+	return tex;
+}
+
+Resources::Texture* Chat::ChatNetworkThread::GetReceivingTexture(std::string_view path)
+{
+	// The peer still sends the parts of a texture described again under the path it knows
+	auto again = describedAgain.find(std::string(path));
+	if (again != describedAgain.end())
+	{
+		if (!again->second->IsComplete()) return again->second;
+		describedAgain.erase(again);
+	}
+	return textures->GetOrCreateTexture(path);
+}
+
+Resources::Texture* Chat::ChatNetworkThread::ReadThumbnail(Networking::Serialization::Deserializer& dr)
+{
+	// Missing from the messages of older peers
+	std::string_view thumbnailPath;
+	if (dr.CursorPos() >= dr.BufferSize() || !dr.ReadString(thumbnailPath)) return nullptr;
+	Resources::Texture* thumbnail = textures->GetOrCreateTexture(thumbnailPath);
+	// Already described by another message showing it
+	if (thumbnail->GetContentHash() != 0) return thumbnail;
+	if (!thumbnail->CanPreLoad()) return nullptr;
+	if (!thumbnail->PreLoad(dr, thumbnailPath) || thumbnail->GetContentHash() == 0) return nullptr;
+	return thumbnail;
+}
+
+Chat::ActionData Chat::ChatNetworkThread::MakeFileRequest(const Resources::LargeFile* file)
+{
+	const std::vector<bool>& parts = file->GetReceivedParts();
+	Networking::Serialization::Serializer sr(sizeof(u64) + sizeof(u32) + (parts.size() + 7) / 8);
+	sr.Write(file->GetContentHash());
+	if (std::find(parts.begin(), parts.end(), true) != parts.end())
+	{
+		Resources::LargeFile::SerializeParts(parts, sr);
+	}
+	Chat::ActionData action;
+	action.type = Chat::Action::FILE_REQUEST;
+	action.data = sr.TakeBuffer();
+	return action;
+}
+
+bool Chat::ChatNetworkThread::ReadFileRequest(Networking::Serialization::Deserializer& dr, u64& hash, std::vector<bool>& heldParts)
+{
+	if (!dr.Read(hash)) return false;
+	// No bitmap when nothing is held
+	return dr.CursorPos() == dr.BufferSize() || Resources::LargeFile::DeserializeParts(dr, heldParts);
 }
 
 void Chat::ChatNetworkThread::PushAction(Action type, const u8* data, u64 dataSize)
@@ -104,11 +204,8 @@ bool Chat::ChatClientThread::ProcessUserNameUpdate(Networking::Serialization::De
 		return false;
 	}
 	user = users->GetOrCreateUser(userID);
-	std::string tmp;
-	u64 size;
-	if (!dr.Read(size)) return false;
-	tmp.resize(size);
-	if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) return false;
+	std::string_view tmp;
+	if (!dr.ReadString(tmp)) return false;
 	user->userName = tmp;
 	return true;
 }
@@ -121,7 +218,7 @@ Chat::ActionData Chat::ChatNetworkThread::SendUserName(Chat::User* user)
 	sr.Write(user->userName.size());
 	sr.Write(reinterpret_cast<u8*>(user->userName.data()), user->userName.size());
 	data.type = Chat::Action::USER_UPDATE_NAME;
-	data.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	data.data = sr.TakeBuffer();
 	return data;
 }
 
@@ -147,7 +244,7 @@ Chat::ActionData Chat::ChatNetworkThread::SendUserColor(Chat::User* user)
 	sr.Write(user->userColor.y);
 	sr.Write(user->userColor.z);
 	data.type = Chat::Action::USER_UPDATE_COLOR;
-	data.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	data.data = sr.TakeBuffer();
 	return data;
 }
 
@@ -160,15 +257,13 @@ bool Chat::ChatClientThread::ProcessUserIconUpdate(Networking::Serialization::De
 		return false;
 	}
 	user = users->GetOrCreateUser(userID);
-	std::string texPath;
-	u64 nameSize;
-	if (!dr.Read(nameSize)) return false;
-	texPath.resize(nameSize);
-	if (!dr.Read(reinterpret_cast<u8*>(texPath.data()), nameSize)) return false;
+	std::string_view texPath;
+	if (!dr.ReadString(texPath)) return false;
 	if (!texPath.compare(0, textures->GetDefaultUserTexture()->GetPath().size(), textures->GetDefaultUserTexture()->GetPath())) return false;
-	Resources::Texture* tex = textures->GetOrCreateTexture(texPath);
-	if (!tex->PreLoad(dr, texPath)) return false;
+	Resources::Texture* tex = ReadDescription(dr, texPath);
+	if (!tex) return false;
 	user->userTex = tex;
+	RequestContent(tex);
 	return true;
 }
 
@@ -179,7 +274,7 @@ Chat::ActionData Chat::ChatNetworkThread::SendUserIcon(Chat::User* user)
 	sr.Write(user->userID);
 	user->userTex->SerializeFile(sr);
 	data.type = Chat::Action::USER_UPDATE_ICON;
-	data.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	data.data = sr.TakeBuffer();
 	return data;
 }
 
@@ -188,15 +283,12 @@ bool Chat::ChatClientThread::ProcessTextMessage(Networking::Serialization::Deser
 	u64 userID;
 	u64 messID;
 	s64 mTime;
-	std::string tmp;
-	u64 size;
+	std::string_view tmp;
 	if (!dr.Read(mTime) || !dr.Read(userID) || !dr.Read(messID))
 	{
 		return false;
 	}
-	if (!dr.Read(size)) return false;
-	tmp.resize(size);
-	if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) return false;
+	if (!dr.ReadString(tmp)) return false;
 	std::unique_ptr<Chat::TextMessage> mess = std::make_unique<Chat::TextMessage>(tmp, users->GetOrCreateUser(userID), mTime, messID);
 	manager->ReceiveMessage(std::move(mess));
 	return true;
@@ -207,15 +299,12 @@ bool Chat::ChatClientThread::ProcessImageMessage(Networking::Serialization::Dese
 	u64 userID;
 	u64 messID;
 	s64 mTime;
-	std::string tmp;
-	u64 size;
+	std::string_view tmp;
 	if (!dr.Read(mTime) || !dr.Read(userID) || !dr.Read(messID))
 	{
 		return false;
 	}
-	if (!dr.Read(size)) return false;
-	tmp.resize(size);
-	if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) return false;
+	if (!dr.ReadString(tmp)) return false;
 	std::cout << "Received texture: " << tmp << std::endl;
 	Resources::Texture* tex = textures->GetTexture(tmp);
 	if (tex != textures->GetDefaultImage())
@@ -229,6 +318,17 @@ bool Chat::ChatClientThread::ProcessImageMessage(Networking::Serialization::Dese
 	std::cout << "Creating texture..." << std::endl;
 	if (!tex->PreLoad(dr, tmp)) return false;
 	std::cout << "Texture created" << std::endl;
+	if (Resources::Texture* thumbnail = ReadThumbnail(dr))
+	{
+		// Only the thumbnail is downloaded now, the full image waits for RequestFile unless it is already here
+		tex->SetThumbnail(thumbnail);
+		RequestContent(thumbnail);
+		textures->LoadContent(tex, false);
+	}
+	else
+	{
+		RequestContent(tex);
+	}
 	std::unique_ptr<Chat::ImageMessage> mess = std::make_unique<Chat::ImageMessage>(tex, users->GetOrCreateUser(userID), mTime, messID);
 	manager->ReceiveMessage(std::move(mess));
 	return true;
@@ -236,30 +336,94 @@ bool Chat::ChatClientThread::ProcessImageMessage(Networking::Serialization::Dese
 
 bool Chat::ChatClientThread::ProcessFilePart(Networking::Serialization::Deserializer& dr)
 {
-	u64 strSize;
-	std::string filePath;
-	if (!dr.Read(strSize))
-	{
-		return false;
-	}
-	filePath.resize(strSize);
-	if (!dr.Read(reinterpret_cast<u8*>(filePath.data()), strSize)) return false;
+	std::string_view filePath;
+	if (!dr.ReadString(filePath)) return false;
 	std::cout << "Receiving file data for " << filePath << std::endl;
-	Resources::Texture* tex = textures->GetOrCreateTexture(filePath);
+	Resources::Texture* tex = GetReceivingTexture(filePath);
 	if (tex->IsLoaded())
 	{
 		std::cout << "Texture already exists!" << std::endl;
 		return false;
 	}
-	else if (!tex->AcceptPacket(dr))
+	u32 packetIndex;
+	if (!tex->AcceptPacket(dr, packetIndex))
 	{
 		std::cout << "Could not accept packet!" << std::endl;
+		if (tex->IsContentRejected())
+		{
+			// Doesn't match its hash once complete : downloaded again from scratch
+			textures->RestartDownload(tex);
+			if (serverVersion >= ProtocolVersion::CONTENT_HASHES) actionQueue.push_back(MakeFileRequest(tex));
+		}
 		return false;
 	}
 	std::cout << "Data received" << std::endl;
+	if (tex->IsComplete())
+	{
+		textures->StoreContent(tex);
+		textures->Decode(tex);
+	}
+	else textures->StorePart(tex, packetIndex);
+	return true;
+}
+
+bool Chat::ChatClientThread::ProcessFileRequest(Networking::Serialization::Deserializer& dr)
+{
+	u64 hash;
+	std::vector<bool> heldParts;
+	if (!ReadFileRequest(dr, hash, heldParts)) return false;
+	const Resources::Texture* tex = textures->FindContent(hash);
+	if (!tex) return false;
+	files.AddFileToUser(ServerNetworkID, tex, std::move(heldParts));
 	return true;
 }
 
+bool Chat::ChatClientThread::ProcessHistoryPage(Networking::Serialization::Deserializer& dr)
+{
+	u8 older;
+	if (!dr.Read(older)) return false;
+	olderHistory = older != 0;
+	historyRequested = false;
+	return true;
+}
+
+void Chat::ChatClientThread::RequestHistory(s64 time, u64 messID)
+{
+	// Older servers send the whole history when joining
+	if (!olderHistory || historyRequested || serverVersion < ProtocolVersion::HISTORY_PAGES) return;
+	historyRequested = true;
+	Networking::Serialization::Serializer sr;
+	sr.Write(time);
+	sr.Write(messID);
+	PushAction(Action::HISTORY_REQUEST, sr.GetBuffer(), sr.GetBufferSize());
+}
+
+void Chat::ChatClientThread::RequestContent(Resources::Texture* tex)
+{
+	if (tex->GetContentHash() == 0 || textures->LoadContent(tex)) return;
+	// Older servers stream every file without being asked
+	if (serverVersion >= ProtocolVersion::CONTENT_HASHES)
+	{
+		actionQueue.push_back(MakeFileRequest(tex));
+	}
+}
+
+void Chat::ChatClientThread::RequestFile(Resources::Texture* tex)
+{
+	// Already requested once it is received into its cache file
+	if (tex->IsComplete() || tex->IsMapped()) return;
+	RequestContent(tex);
+}
+
+void Chat::ChatClientThread::ShareFile(const Resources::Texture* file, const User*)
+{
+	// Otherwise sent once the server requests it
+	if (serverVersion < ProtocolVersion::CONTENT_HASHES || file->GetContentHash() == 0)
+	{
+		files.AddFileToUser(ServerNetworkID, file);
+	}
+}
+
 void Chat::ChatClientThread::Update()
 {
 	if (!signal.Load())
@@ -309,12 +473,17 @@ void Chat::ChatClientThread::Update()
 			case Action::FILE_DATA:
 				ProcessFilePart(dr);
 				break;
+			case Action::FILE_REQUEST:
+				ProcessFileRequest(dr);
+				break;
+			case Action::HISTORY_PAGE:
+				ProcessHistoryPage(dr);
+				break;
 			default:
 				std::cout << "Warning, Invalid action type" << std::endl;
 				break;
 			}
 		}
-		clientStallBool = !clientStallBool;
 		ChatNetworkThread::Update();
 	}
 }
@@ -334,32 +503,31 @@ void Chat::ChatClientThread::ThreadFunc()
 			std::vector<ActionData> response;
 			if (state == ChatNetworkState::CONNECTED)
 			{
-				Networking::Serialization::Serializer sr;
-				for (size_t i = 0; i < actions.size(); i++)
+				SendBatches(address, actions, serverVersion, ActionOrigin::CLIENT);
+				if (files.HasPendingData())
 				{
-					sr.Write(static_cast<u8>(actions[i].type));
-					sr.Write(actions[i].data.size());
-					if (actions[i].data.size() != 0)
+					const s64 space = GetQueueSpace(client.GetClientStats(address));
+					files.GetNextParts([space](u64) { return space; }, [this](u64) { return serverVersion; }, ActionOrigin::CLIENT, MaxFileBytesPerUpdate, fileParts);
+					for (auto& part : fileParts)
 					{
-						sr.Write(actions[i].data.data(), actions[i].data.size());
+						client.sendTo(address, part.second, 0);
 					}
-				}
-				if (sr.GetBufferSize() > 0)
-				{
-					client.sendTo(address, sr.GetBuffer(), sr.GetBufferSize(), 0);
+					fileParts.clear();
 				}
 			}
 			else if (connect.Load() && state == ChatNetworkState::DISCONNECTED)
 			{
 				client.connect(address);
+				files.RemoveUser(ServerNetworkID);
+				serverVersion = ProtocolVersion::LEGACY;
 				connect.Store(false);
 				state = ChatNetworkState::WAITING_CONNECTION;
 			}
 			actions.clear();
 			client.receive();
 			if (state == ChatNetworkState::CONNECTED || state == ChatNetworkState::WAITING_CONNECTION) client.processSend();
-			auto v = client.poll();
-			for (auto& m : v)
+			client.poll(polledMessages);
+			for (auto& m : polledMessages)
 			{
 				if (m->is<Networking::Messages::IncomingConnection>())
 				{
@@ -374,10 +542,11 @@ void Chat::ChatClientThread::ThreadFunc()
 						{
 						case Networking::Messages::Connection::Result::Success:
 							state = ChatNetworkState::CONNECTED;
+							response.push_back(ActionCodec::MakeVersionAction());
 							response.push_back(SendUserName(self));
 							response.push_back(SendUserColor(self));
 							response.push_back(SendUserIcon(self));
-							files.AddFileToBroadCast(self->userTex);
+							shareSelfIcon = true;
 							break;
 						case Networking::Messages::Connection::Result::Failed:
 							lastError = "Could not connect to server";
@@ -401,28 +570,20 @@ void Chat::ChatClientThread::ThreadFunc()
 				else if (m->is<Networking::Messages::UserData>())
 				{
 					auto ud = m->as<Networking::Messages::UserData>();
-					Networking::Serialization::Deserializer dr(ud->data.data(), ud->data.size());
-					while (dr.CursorPos() < dr.BufferSize())
+					const size_t firstReceived = actions.size();
+					if (!ActionCodec::Decode(ud->data.data(), ud->data.size(), ActionOrigin::SERVER, actions))
 					{
-						ActionData action;
-						u64 tmpSize;
-						if (!dr.Read(reinterpret_cast<u8&>(action.type)) || !dr.Read(tmpSize))
-						{
-							std::cout << "Warning, Corrupted message found!" << std::endl;
-							break;
-						}
-						if (tmpSize != 0)
-						{
-							action.data.resize(tmpSize);
-							if (!dr.Read(action.data.data(), action.data.size()))
-							{
-								std::cout << "Warning, Corrupted message found!" << std::endl;
-								break;
-							}
-						}
-						actions.push_back(std::move(action));
+						std::cout << "Warning, Corrupted message found!" << std::endl;
+					}
+					// The version is only needed here
+					const auto versionActions = std::remove_if(actions.begin() + firstReceived, actions.end(), [&](const ActionData& action) { return ActionCodec::ReadVersionAction(action, serverVersion); });
+					actions.erase(versionActions, actions.end());
+					if (shareSelfIcon && state == ChatNetworkState::CONNECTED)
+					{
+						// The server version comes first in its welcome bundle, older servers never announce it
+						shareSelfIcon = false;
+						if (serverVersion < ProtocolVersion::CONTENT_HASHES) files.AddFileToUser(ServerNetworkID, self->userTex);
 					}
-					
 				}
 				else if (m->is<Networking::Messages::Disconnection>())
 				{
@@ -434,20 +595,14 @@ void Chat::ChatClientThread::ThreadFunc()
 					{
 						lastError = "Connection lost with server";
 					}
+					// Paging starts again with the history sent when joining
+					olderHistory = false;
+					historyRequested = false;
 					state = ChatNetworkState::CONNECTION_LOST;
 				}
 			}
-			Networking::Serialization::Serializer sr;
-			for (size_t i = 0; i < response.size(); i++)
-			{
-				sr.Write(static_cast<u8>(response[i].type));
-				sr.Write(response[i].data.size());
-				if (response[i].data.size() != 0)
-				{
-					sr.Write(response[i].data.data(), response[i].data.size());
-				}
-			}
-			if(sr.GetBufferSize() > 0) client.sendTo(address, sr.GetBuffer(), sr.GetBufferSize(), 0);
+			SendBatches(address, response, serverVersion, ActionOrigin::CLIENT);
+			polledMessages.clear();
 			signal.Store(false);
 		}
 		else if (state == ChatNetworkState::CONNECTED || state == ChatNetworkState::WAITING_CONNECTION)
@@ -455,7 +610,8 @@ void Chat::ChatClientThread::ThreadFunc()
 			client.receive();
 			client.processSend();
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		// Sleep until a datagram arrives, the UI hands over new actions or a connection needs maintenance
+		client.wait(NetworkWaitTimeout, state == ChatNetworkState::CONNECTED || state == ChatNetworkState::WAITING_CONNECTION);
 	}
 	if (address.isValid())
 	{
@@ -468,6 +624,8 @@ void Chat::ChatClientThread::ThreadFunc()
 Chat::ChatServerThread::ChatServerThread(User* selfUser, ChatManager* managerIn, UserManager* usersIn, Resources::TextureManager* texturesIn) :
 	ChatNetworkThread(selfUser, managerIn, usersIn, texturesIn)
 {
+	// Only used once enough users are connected
+	client.setWorkerCount(std::max(1u, std::thread::hardware_concurrency() / 2));
 	t = std::thread(&ChatServerThread::ThreadFunc, this);
 }
 
@@ -481,6 +639,95 @@ u64 Chat::ChatServerThread::GetMessageCounter()
 	return messageCounter++;
 }
 
+void Chat::ChatServerThread::SetMessageCounter(u64 next)
+{
+	messageCounter = next;
+}
+
+std::unique_ptr<Chat::ChatMessage> Chat::ChatServerThread::ReadHistoryRecord(const ActionData& record)
+{
+	Networking::Serialization::Deserializer dr(record.data);
+	u64 userID;
+	u64 messID;
+	s64 mTime;
+	if (!dr.Read(mTime) || !dr.Read(userID) || !dr.Read(messID))
+	{
+		return nullptr;
+	}
+	User* user = users->GetOrCreateUser(userID);
+	switch (record.type)
+	{
+	case Action::USER_CONNECT:
+	case Action::USER_DISCONNECT:
+		return std::make_unique<Chat::ConnectionMessage>(record.type == Action::USER_CONNECT, user, mTime, messID);
+	case Action::MESSAGE_TEXT:
+	{
+		std::string_view tmp;
+		if (!dr.ReadString(tmp)) return nullptr;
+		return std::make_unique<Chat::TextMessage>(tmp, user, mTime, messID);
+	}
+	case Action::MESSAGE_IMAGE:
+	{
+		Resources::Texture* tex = ReadHistoryImage(dr);
+		if (!tex) return nullptr;
+		return std::make_unique<Chat::ImageMessage>(tex, user, mTime, messID);
+	}
+	default:
+		return nullptr;
+	}
+}
+
+Resources::Texture* Chat::ChatServerThread::ReadHistoryImage(Networking::Serialization::Deserializer& dr)
+{
+	std::string_view tmp;
+	if (!dr.ReadString(tmp)) return nullptr;
+	Resources::Texture* tex = textures->GetTexture(tmp);
+	if (tex != textures->GetDefaultImage()) return tex;
+	tex = textures->GetOrCreateTexture(tmp);
+	if (!tex->PreLoad(dr, tmp)) return nullptr;
+	if (Resources::Texture* thumbnail = ReadThumbnail(dr))
+	{
+		tex->SetThumbnail(thumbnail);
+		textures->LoadContent(thumbnail, false);
+	}
+	textures->LoadContent(tex, false);
+	return tex;
+}
+
+void Chat::ChatServerThread::AddHistoryImage(u64 clientNetworkID, const ActionData& record, u64 recordIndex)
+{
+	Networking::Serialization::Deserializer dr(record.data);
+	s64 mTime;
+	u64 userID;
+	u64 messID;
+	std::string_view path;
+	if (!dr.Read(mTime) || !dr.Read(userID) || !dr.Read(messID) || !dr.ReadString(path)) return;
+	// Shown or already requested
+	if (textures->GetTexture(path) != textures->GetDefaultImage()) return;
+	std::unordered_map<u64, u64>& images = historyImages[clientNetworkID];
+	if (const u64 hash = Resources::Texture::ReadContentHash(dr)) images[hash] = recordIndex;
+	// Missing from the messages of older peers
+	if (dr.CursorPos() >= dr.BufferSize() || !dr.ReadString(path)) return;
+	if (const u64 hash = Resources::Texture::ReadContentHash(dr)) images[hash] = recordIndex;
+}
+
+bool Chat::ChatServerThread::LoadHistoryImage(u64 clientNetworkID, u64 hash)
+{
+	auto images = historyImages.find(clientNetworkID);
+	if (images == historyImages.end()) return false;
+	auto it = images->second.find(hash);
+	if (it == images->second.end()) return false;
+	const u64 recordIndex = it->second;
+	images->second.erase(it);
+	ActionData record;
+	if (!manager->GetHistory().Read(recordIndex, record)) return false;
+	Networking::Serialization::Deserializer dr(record.data);
+	s64 mTime;
+	u64 userID;
+	u64 messID;
+	return dr.Read(mTime) && dr.Read(userID) && dr.Read(messID) && ReadHistoryImage(dr);
+}
+
 void Chat::ChatServerThread::TryConnect()
 {
 	if (!client.init(address.port()))
@@ -498,15 +745,12 @@ bool Chat::ChatServerThread::ProcessServerTextMessage(Networking::Serialization:
 {
 	u64 userID;
 	u64 messID = GetMessageCounter();
-	std::string tmp;
-	u64 size;
+	std::string_view tmp;
 	if (!dr.Read(userID))
 	{
 		return false;
 	}
-	if (!dr.Read(size)) return false;
-	tmp.resize(size);
-	if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) return false;
+	if (!dr.ReadString(tmp) || tmp.size() > TextMessage::MaxLength) return false;
 	s64 receivedTime = time(nullptr);
 	User* user = users->GetOrCreateUser(userID);
 	if (receivedTime > user->lastActivity)
@@ -524,17 +768,14 @@ bool Chat::ChatServerThread::ProcessServerImageMessage(Networking::Serialization
 {
 	u64 userID;
 	u64 messID = GetMessageCounter();
-	std::string tmp;
-	u64 size;
+	std::string_view tmp;
 	u64 dummyTime;
 	s64 dummyID;
 	if (!dr.Read(dummyTime) || !dr.Read(userID) || !dr.Read(dummyID))
 	{
 		return false;
 	}
-	if (!dr.Read(size)) return false;
-	tmp.resize(size);
-	if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) return false;
+	if (!dr.ReadString(tmp)) return false;
 	s64 receivedTime = time(nullptr);
 	User* user = users->GetOrCreateUser(userID);
 	if (receivedTime > user->lastActivity)
@@ -542,9 +783,16 @@ bool Chat::ChatServerThread::ProcessServerImageMessage(Networking::Serialization
 		user->isConnected = true;
 		user->lastActivity = receivedTime;
 	}
-	Resources::Texture* tex = textures->GetOrCreateTexture(tmp);
-	if (!tex->PreLoad(dr, tmp)) return false;
-	std::unique_ptr<Chat::ImageMessage> mess = std::make_unique<Chat::ImageMessage>(tex, users->GetOrCreateUser(userID), receivedTime, messID);
+	Resources::Texture* tex = ReadDescription(dr, tmp);
+	if (!tex) return false;
+	// The thumbnail first : it is what the clients show until they open the image
+	if (Resources::Texture* thumbnail = ReadThumbnail(dr))
+	{
+		tex->SetThumbnail(thumbnail);
+		RequestContent(thumbnail, user);
+	}
+	RequestContent(tex, user);
+	std::unique_ptr<Chat::ImageMessage> mess = std::make_unique<Chat::ImageMessage>(tex, user, receivedTime, messID);
 	actionQueue.push_back(std::move(mess->Serialize()));
 	manager->ReceiveMessage(std::move(mess));
 	return true;
@@ -567,7 +815,7 @@ bool Chat::ChatServerThread::ProcessServerUserColorUpdate(Networking::Serializat
 	sr.Write(user->userColor.z);
 	Chat::ActionData action;
 	action.type = Chat::Action::USER_UPDATE_COLOR;
-	action.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	action.data = sr.TakeBuffer();
 	actionQueue.push_back(std::move(action));
 	return true;
 }
@@ -582,11 +830,8 @@ bool Chat::ChatServerThread::ProcessServerUserNameUpdate(Networking::Serializati
 		return false;
 	}
 	user = users->GetOrCreateUser(userID);
-	std::string tmp;
-	u64 size;
-	if (!dr.Read(size)) return false;
-	tmp.resize(size);
-	if (!dr.Read(reinterpret_cast<u8*>(tmp.data()), size)) return false;
+	std::string_view tmp;
+	if (!dr.ReadString(tmp)) return false;
 	user->userName = tmp;
 	Networking::Serialization::Serializer sr;
 	sr.Write(user->userID);
@@ -609,13 +854,25 @@ bool Chat::ChatServerThread::ProcessServerUserNameUpdate(Networking::Serializati
 			std::unique_ptr<Chat::ConnectionMessage> mess = std::make_unique<Chat::ConnectionMessage>(true, users->GetOrCreateUser(userID), receivedTime, messID);
 			manager->ReceiveMessage(std::move(mess));
 
+			// Its version is known by now : newer clients request the icons described in the welcome bundle
+			if (GetPeerVersion(networkID) < ProtocolVersion::CONTENT_HASHES)
+			{
+				for (auto& u : users->GetAllUsers())
+				{
+					if (u.first == 0 || u.second.get() == user) continue;
+					files.AddFileToUser(networkID, u.second->userTex);
+				}
+			}
+			// Newer clients ask for the older pages when scrolling up
+			SendHistoryPage(networkID, std::numeric_limits<s64>::max(), std::numeric_limits<u64>::max());
+
 			Networking::Serialization::Serializer sr2;
 			sr2.Write(receivedTime);
 			sr2.Write(user->userID);
 			sr2.Write(messID);
 			Chat::ActionData action;
 			action.type = Chat::Action::USER_CONNECT;
-			action.data = std::vector(sr2.GetBuffer(), sr2.GetBuffer() + sr2.GetBufferSize());
+			action.data = sr2.TakeBuffer();
 			actionQueue.push_back(std::move(action));
 
 			acceptedClients.erase_after(last);
@@ -625,7 +882,7 @@ bool Chat::ChatServerThread::ProcessServerUserNameUpdate(Networking::Serializati
 	}
 	Chat::ActionData action;
 	action.type = Chat::Action::USER_UPDATE_NAME;
-	action.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	action.data = sr.TakeBuffer();
 	actionQueue.push_back(std::move(action));
 	
 	return true;
@@ -640,22 +897,20 @@ bool Chat::ChatServerThread::ProcessServerUserIconUpdate(Networking::Serializati
 		return false;
 	}
 	user = users->GetOrCreateUser(userID);
-	std::string texPath;
-	u64 nameSize;
-	if (!dr.Read(nameSize)) return false;
-	texPath.resize(nameSize);
-	if (!dr.Read(reinterpret_cast<u8*>(texPath.data()), nameSize)) return false;
+	std::string_view texPath;
+	if (!dr.ReadString(texPath)) return false;
 	if (!texPath.compare(0, textures->GetDefaultUserTexture()->GetPath().size(), textures->GetDefaultUserTexture()->GetPath())) return false;
 	//texPath = texPath + "@" + Maths::Util::GetHex(userID);
-	Resources::Texture* tex = textures->GetOrCreateTexture(texPath);
-	if (!tex->PreLoad(dr, texPath)) return false;
+	Resources::Texture* tex = ReadDescription(dr, texPath);
+	if (!tex) return false;
 	user->userTex = tex;
+	RequestContent(tex, user);
 	Chat::ActionData action;
 	Networking::Serialization::Serializer sr;
 	sr.Write(user->userID);
 	tex->SerializeFile(sr);
 	action.type = Chat::Action::USER_UPDATE_ICON;
-	action.data = std::vector(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize());
+	action.data = sr.TakeBuffer();
 	actionQueue.push_back(std::move(action));
 	return true;
 }
@@ -664,6 +919,7 @@ bool Chat::ChatServerThread::ProcessServerUserDisconnection(Networking::Serializ
 {
 	u64 netID;
 	if (!dr.Read(netID)) return false;
+	historyImages.erase(netID);
 	User* user = users->GetUserWithNetID(netID);
 	if (!user) return false;
 	u64 messID = GetMessageCounter();
@@ -682,54 +938,192 @@ bool Chat::ChatServerThread::ProcessServerUserDisconnection(Networking::Serializ
 bool Chat::ChatServerThread::ProcessServerUserConnection(const Networking::Address& clientIn, u64 clientNetworkID)
 {
 	std::vector<ActionData> tmpActions;
-	Networking::Serialization::Serializer sr;
+	// First, the client relies on it to know whether it will be asked for its files
+	tmpActions.push_back(ActionCodec::MakeVersionAction());
 	for (auto& u : users->GetAllUsers())
 	{
 		if (u.first == 0) continue; // no need to send the default users' data
 		tmpActions.push_back(SendUserName(u.second.get()));
 		tmpActions.push_back(SendUserColor(u.second.get()));
 		tmpActions.push_back(SendUserIcon(u.second.get()));
-		files.AddFileToUser(clientNetworkID, u.second->userTex);
 	}
-	for (auto& m : manager->GetAllMessages())
+	SendBatches(clientIn, tmpActions, GetPeerVersion(clientNetworkID), ActionOrigin::SERVER);
+	return true;
+}
+
+Chat::ProtocolVersion Chat::ChatServerThread::GetPeerVersion(u64 clientNetworkID) const
+{
+	auto res = peerVersions.find(clientNetworkID);
+	return res == peerVersions.end() ? ProtocolVersion::LEGACY : res->second;
+}
+
+void Chat::ChatServerThread::BroadCastActions(const std::vector<ActionData>& list)
+{
+	bool hasLegacyPeers = false;
+	bool hasCompactPeers = false;
+	for (auto& peer : peerVersions)
 	{
-		files.AddMessageToUser(clientNetworkID, m.get());
+		(peer.second == ProtocolVersion::LEGACY ? hasLegacyPeers : hasCompactPeers) = true;
 	}
-	for (size_t i = 0; i < tmpActions.size(); i++)
+	for (size_t first = 0; first < list.size();)
 	{
-		sr.Write(static_cast<u8>(tmpActions[i].type));
-		sr.Write(tmpActions[i].data.size());
-		if (tmpActions[i].data.size() != 0)
+		const size_t last = GetBatchEnd(list, first);
+		if (!hasLegacyPeers || !hasCompactPeers)
 		{
-			sr.Write(tmpActions[i].data.data(), tmpActions[i].data.size());
+			Networking::Serialization::Serializer sr;
+			ActionCodec::Encode(list.data() + first, last - first, hasCompactPeers ? CurrentProtocolVersion : ProtocolVersion::LEGACY, ActionOrigin::SERVER, sr);
+			client.broadCast(sr.TakeBuffer(), 0);
+			first = last;
+			continue;
 		}
+		// Mixed versions : encoded once per version, sent client by client
+		Networking::Serialization::Serializer legacy;
+		Networking::Serialization::Serializer compact;
+		ActionCodec::Encode(list.data() + first, last - first, ProtocolVersion::LEGACY, ActionOrigin::SERVER, legacy);
+		ActionCodec::Encode(list.data() + first, last - first, CurrentProtocolVersion, ActionOrigin::SERVER, compact);
+		for (auto& peer : peerVersions)
+		{
+			const Networking::Serialization::Serializer& sr = peer.second == ProtocolVersion::LEGACY ? legacy : compact;
+			client.sendTo(client.GetClientAddress(peer.first), sr.GetBuffer(), sr.GetBufferSize(), 0);
+		}
+		first = last;
 	}
-	if (sr.GetBufferSize() > 0)
-	{
-		client.sendTo(clientIn, sr.GetBuffer(), sr.GetBufferSize(), 0);
-	}
-	return true;
 }
 
 bool Chat::ChatServerThread::ProcessServerFilePart(Networking::Serialization::Deserializer& dr)
 {
-	u64 strSize;
-	std::string filePath;
-	if (!dr.Read(strSize))
+	std::string_view filePath;
+	if (!dr.ReadString(filePath)) return false;
+	Resources::Texture* tex = GetReceivingTexture(filePath);
+	u32 packetIndex;
+	if (tex->IsLoaded()) return false;
+	if (!tex->AcceptPacket(dr, packetIndex))
 	{
+		auto source = contentSources.find(tex->GetContentHash());
+		if (tex->IsContentRejected() && source != contentSources.end())
+		{
+			// Doesn't match its hash once complete : downloaded again from scratch
+			textures->RestartDownload(tex);
+			if (peerVersions.count(source->second)) peerActionQueue.emplace_back(source->second, MakeFileRequest(tex));
+		}
 		return false;
 	}
-	filePath.resize(strSize);
-	if (!dr.Read(reinterpret_cast<u8*>(filePath.data()), strSize)) return false;
-	Resources::Texture* tex = textures->GetOrCreateTexture(filePath);
-	if (tex->IsLoaded() || !tex->AcceptPacket(dr)) return false;
-	if (tex->IsComplete() && tex->IsLoaded())
+	if (!tex->IsComplete())
+	{
+		textures->StorePart(tex, packetIndex);
+	}
+	else
+	{
+		contentSources.erase(tex->GetContentHash());
+		// Shared without waiting for the decode
+		textures->StoreContent(tex);
+		textures->Decode(tex);
+		ShareFile(tex, nullptr);
+	}
+	return true;
+}
+
+bool Chat::ChatServerThread::ProcessServerFileRequest(Networking::Serialization::Deserializer& dr)
+{
+	u64 networkID;
+	u64 hash;
+	std::vector<bool> heldParts;
+	if (!dr.Read(networkID) || !ReadFileRequest(dr, hash, heldParts)) return false;
+	const Resources::Texture* tex = textures->FindContent(hash);
+	if (!tex && LoadHistoryImage(networkID, hash)) tex = textures->FindContent(hash);
+	if (tex)
 	{
-		files.AddFileToBroadCast(tex);
+		files.AddFileToUser(networkID, tex, std::move(heldParts));
+		return true;
 	}
+	// Served by ShareFile once complete
+	if (!textures->FindContent(hash, false)) return false;
+	waitingRequests[hash].emplace_back(networkID, std::move(heldParts));
+	return true;
+}
+
+bool Chat::ChatServerThread::ProcessServerHistoryRequest(Networking::Serialization::Deserializer& dr)
+{
+	u64 networkID;
+	s64 beforeTime;
+	u64 beforeID;
+	if (!dr.Read(networkID) || !dr.Read(beforeTime) || !dr.Read(beforeID)) return false;
+	SendHistoryPage(networkID, beforeTime, beforeID);
 	return true;
 }
 
+void Chat::ChatServerThread::SendHistoryPage(u64 clientNetworkID, s64 beforeTime, u64 beforeID)
+{
+	const Resources::HistoryLog& history = manager->GetHistory();
+	const ProtocolVersion version = GetPeerVersion(clientNetworkID);
+	const u64 pageSize = version >= ProtocolVersion::HISTORY_PAGES ? HistoryPageSize : std::numeric_limits<u64>::max();
+	bool older;
+	if (history.IsOpen())
+	{
+		const u64 end = history.LowerBound(beforeID);
+		const u64 begin = end > pageSize ? end - pageSize : 0;
+		ActionData record;
+		for (u64 i = begin; i < end; i++)
+		{
+			if (!history.Read(i, record)) continue;
+			// Only the clients requesting files by their hash ask for them
+			if (record.type == Action::MESSAGE_IMAGE && version >= ProtocolVersion::CONTENT_HASHES) AddHistoryImage(clientNetworkID, record, i);
+			peerActionQueue.emplace_back(clientNetworkID, std::move(record));
+		}
+		older = begin > 0;
+	}
+	else
+	{
+		const MessageStore& messages = manager->GetAllMessages();
+		const size_t end = messages.LowerBound(beforeTime, beforeID);
+		const size_t begin = end > pageSize ? end - pageSize : 0;
+		for (size_t i = begin; i < end; i++)
+		{
+			peerActionQueue.emplace_back(clientNetworkID, messages.At(i)->Serialize());
+		}
+		older = begin > 0;
+	}
+	if (version >= ProtocolVersion::HISTORY_PAGES)
+	{
+		const u8 olderIn = older ? 1 : 0;
+		peerActionQueue.emplace_back(clientNetworkID, ActionData(Action::HISTORY_PAGE, &olderIn, sizeof(olderIn)));
+	}
+}
+
+void Chat::ChatServerThread::RequestContent(Resources::Texture* tex, const User* sender)
+{
+	if (tex->GetContentHash() == 0 || textures->LoadContent(tex)) return;
+	// Older clients stream their files without being asked
+	if (GetPeerVersion(sender->networkID) >= ProtocolVersion::CONTENT_HASHES)
+	{
+		contentSources[tex->GetContentHash()] = sender->networkID;
+		peerActionQueue.emplace_back(sender->networkID, MakeFileRequest(tex));
+	}
+}
+
+void Chat::ChatServerThread::ShareFile(const Resources::Texture* file, const User* owner)
+{
+	// Shared again by ProcessServerFilePart once received
+	if (!file->IsComplete()) return;
+	auto waiting = waitingRequests.find(file->GetContentHash());
+	if (waiting != waitingRequests.end())
+	{
+		for (auto& request : waiting->second)
+		{
+			if (peerVersions.count(request.first)) files.AddFileToUser(request.first, file, std::move(request.second));
+		}
+		waitingRequests.erase(waiting);
+	}
+	for (auto& peer : peerVersions)
+	{
+		if (owner && peer.first == owner->networkID) continue;
+		if (peer.second < ProtocolVersion::CONTENT_HASHES || file->GetContentHash() == 0)
+		{
+			files.AddFileToUser(peer.first, file);
+		}
+	}
+}
+
 void Chat::ChatServerThread::Update()
 {
 	if (!signal.Load())
@@ -764,11 +1158,18 @@ void Chat::ChatServerThread::Update()
 			case Action::FILE_DATA:
 				ProcessServerFilePart(dr);
 				break;
+			case Action::FILE_REQUEST:
+				ProcessServerFileRequest(dr);
+				break;
+			case Action::HISTORY_REQUEST:
+				ProcessServerHistoryRequest(dr);
+				break;
 			default:
 				std::cout << "Warning, Invalid action type" << std::endl;
 				break;
 			}
 		}
+		std::swap(peerActions, peerActionQueue);
 		ChatNetworkThread::Update();
 	}
 }
@@ -779,52 +1180,47 @@ void Chat::ChatServerThread::ThreadFunc()
 	{
 		if (state == ChatNetworkState::CONNECTED && signal.Load())
 		{
-			Networking::Serialization::Serializer sr;
-			for (size_t i = 0; i < actions.size(); i++)
+			for (size_t i = 0; i < peerActions.size();)
 			{
-				sr.Write(static_cast<u8>(actions[i].type));
-				sr.Write(actions[i].data.size());
-				if (actions[i].data.size() != 0)
+				// The actions queued in a row to a client go together, in as few batches as their size allows, as the history pages
+				const u64 networkID = peerActions[i].first;
+				for (; i < peerActions.size() && peerActions[i].first == networkID; i++)
 				{
-					sr.Write(actions[i].data.data(), actions[i].data.size());
+					peerBatch.push_back(std::move(peerActions[i].second));
 				}
+				if (peerVersions.count(networkID))
+				{
+					SendBatches(client.GetClientAddress(networkID), peerBatch, GetPeerVersion(networkID), ActionOrigin::SERVER);
+				}
+				peerBatch.clear();
 			}
-			if (sr.GetBufferSize() > 0)
+			peerActions.clear();
+			if (!actions.empty())
 			{
-				client.broadCast(sr.GetBuffer(), sr.GetBufferSize(), 0);
+				BroadCastActions(actions);
 			}
-			else
+			if (files.HasPendingData())
 			{
-				for (auto& u : users->GetAllUsers())
+				files.GetNextParts([this](u64 networkID) { return peerVersions.count(networkID) ? GetQueueSpace(client.GetClientStats(networkID)) : 0; },
+					[this](u64 networkID) { return GetPeerVersion(networkID); }, ActionOrigin::SERVER, MaxFileBytesPerUpdate, fileParts);
+				for (auto& part : fileParts)
 				{
-					if (u.first == 0 || u.second.get() == self) continue;
-					Networking::Serialization::Serializer sr2;
-					if (files.HasUserPendingData(u.second->networkID))
-					{
-						ActionData action = files.GetNextUserDataPart(u.second->networkID);
-						sr2.Write(static_cast<u8>(action.type));
-						sr2.Write(action.data.size());
-						if (action.data.size() != 0)
-						{
-							sr2.Write(action.data.data(), action.data.size());
-						}
-					}
-					if (sr2.GetBufferSize() > 0)
-					{
-						client.sendTo(u.second->clientAddress, sr2.GetBuffer(), sr2.GetBufferSize(), 0);
-					}
+					// Peers getting the same part share its buffer
+					client.sendTo(client.GetClientAddress(part.first), part.second, 0);
 				}
+				fileParts.clear();
 			}
 			actions.clear();
 			client.receive();
 			client.processSend();
-			auto v = client.poll();
-			for (auto& m : v)
+			client.poll(polledMessages);
+			for (auto& m : polledMessages)
 			{
 				if (m->is<Networking::Messages::IncomingConnection>())
 				{
 					client.connect(m->emitter());
 					acceptedClients.push_front(m->emitterId());
+					peerVersions[m->emitterId()] = ProtocolVersion::LEGACY;
 					ProcessServerUserConnection(m->emitter(), m->emitterId());
 				}
 				else if (m->is<Networking::Messages::Connection>())
@@ -834,55 +1230,49 @@ void Chat::ChatServerThread::ThreadFunc()
 				else if (m->is<Networking::Messages::UserData>())
 				{
 					auto ud = m->as<Networking::Messages::UserData>();
-					Networking::Serialization::Deserializer dr(ud->data.data(), ud->data.size());
-					while (dr.CursorPos() < dr.BufferSize())
+					const size_t firstReceived = actions.size();
+					if (!ActionCodec::Decode(ud->data.data(), ud->data.size(), ActionOrigin::CLIENT, actions))
+					{
+						std::cout << "Warning, Corrupted message found!" << std::endl;
+					}
+					for (size_t i = firstReceived; i < actions.size(); i++)
 					{
-						ActionData action;
-						u64 tmpSize;
-						if (!dr.Read(reinterpret_cast<u8&>(action.type)) || !dr.Read(tmpSize))
+						ActionData& action = actions[i];
+						if ((action.type == Action::USER_UPDATE_NAME && !action.data.empty()) || action.type == Action::FILE_REQUEST || action.type == Action::HISTORY_REQUEST)
 						{
-							std::cout << "Warning, Corrupted message found!" << std::endl;
-							break;
+							// Prefixed with the network id of the sender
+							Networking::Serialization::Serializer sr(sizeof(u64) + action.data.size());
+							sr.Write(m->emitterId());
+							sr.Write(action.data.data(), action.data.size());
+							action.data = sr.TakeBuffer();
 						}
-						if (tmpSize != 0)
+						else if (action.type == Action::PROTOCOL_VERSION)
 						{
-							if (action.type == Action::USER_UPDATE_NAME)
-							{
-								action.data.resize(tmpSize + 8);
-								Networking::Serialization::Serializer tmpSR;
-								tmpSR.Write(m->emitterId());
-								std::copy(tmpSR.GetBuffer(), tmpSR.GetBuffer() + 8, action.data.data());
-								if (!dr.Read(action.data.data() + 8, tmpSize))
-								{
-									std::cout << "Warning, Corrupted message found!" << std::endl;
-									break;
-								}
-							}
-							else
+							// The server announced its own version in the welcome bundle
+							ProtocolVersion version;
+							if (ActionCodec::ReadVersionAction(action, version) && peerVersions.count(m->emitterId()))
 							{
-								action.data.resize(tmpSize);
-								if (!dr.Read(action.data.data(), tmpSize))
-								{
-									std::cout << "Warning, Corrupted message found!" << std::endl;
-									break;
-								}
+								peerVersions[m->emitterId()] = version;
 							}
 						}
-						actions.push_back(std::move(action));
 					}
+					const auto versionActions = std::remove_if(actions.begin() + firstReceived, actions.end(), [](const ActionData& action) { return action.type == Action::PROTOCOL_VERSION; });
+					actions.erase(versionActions, actions.end());
 				}
 				else if (m->is<Networking::Messages::Disconnection>())
 				{
 					client.disconnect(m->as<Networking::Messages::Disconnection>()->emitter());
+					peerVersions.erase(m->emitterId());
+					files.RemoveUser(m->emitterId());
 					ActionData action;
 					action.type = Action::USER_DISCONNECT;
 					Networking::Serialization::Serializer sr;
 					sr.Write(m->emitterId());
-					action.data.resize(sr.GetBufferSize());
-					std::copy(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize(), action.data.data());
+					action.data = sr.TakeBuffer();
 					actions.push_back(std::move(action));
 				}
 			}
+			polledMessages.clear();
 			signal.Store(false);
 		}
 		else if (state == ChatNetworkState::CONNECTED)
@@ -890,7 +1280,7 @@ void Chat::ChatServerThread::ThreadFunc()
 			client.receive();
 			client.processSend();
 		}
-		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		client.wait(NetworkWaitTimeout, state == ChatNetworkState::CONNECTED);
 	}
 	if (address.isValid())
 	{
@@ -0,0 +1,110 @@
+#include "Chat/MessageStore.hpp"
+
+#include <assert.h>
+#include <iterator>
+
+using namespace Chat;
+
+Chat::MessageStore::MessageStore(f32 spacingIn) : spacing(spacingIn)
+{
+}
+
+bool Chat::MessageStore::Insert(std::unique_ptr<ChatMessage>&& mess)
+{
+	const s64 time = mess->GetTimeStamp();
+	const u64 id = mess->GetID();
+	if (chunks.empty())
+	{
+		chunks.emplace_back();
+		UpdateChunkBounds(0);
+	}
+	const size_t c = FindChunk(time, id);
+	Chunk& chunk = chunks[c];
+	auto it = std::lower_bound(chunk.messages.begin(), chunk.messages.end(), mess, [](const std::unique_ptr<ChatMessage>& other, const std::unique_ptr<ChatMessage>& key) { return IsBefore(other.get(), key->GetTimeStamp(), key->GetID()); });
+	if (it != chunk.messages.end() && (*it)->GetTimeStamp() == time && (*it)->GetID() == id) return false;
+	const size_t index = it - chunk.messages.begin();
+	byID[id] = mess.get();
+	chunk.messages.insert(it, std::move(mess));
+	UpdateOffsets(chunk, index);
+	if (chunk.messages.size() >= MaxChunkSize)
+	{
+		// The second half goes to a new chunk right after it
+		Chunk next;
+		const size_t half = chunk.messages.size() / 2;
+		next.messages.reserve(MaxChunkSize);
+		std::move(chunk.messages.begin() + half, chunk.messages.end(), std::back_inserter(next.messages));
+		chunk.messages.resize(half);
+		UpdateOffsets(chunk, half);
+		UpdateOffsets(next, 0);
+		chunks.insert(chunks.begin() + c + 1, std::move(next));
+	}
+	UpdateChunkBounds(c);
+	return true;
+}
+
+ChatMessage* Chat::MessageStore::At(size_t index) const
+{
+	assert(index < Size());
+	const size_t c = std::upper_bound(chunkStarts.begin() + 1, chunkStarts.end(), index) - chunkStarts.begin() - 1;
+	return chunks[c].messages[index - chunkStarts[c]].get();
+}
+
+f32 Chat::MessageStore::OffsetOf(size_t index) const
+{
+	assert(index < Size());
+	const size_t c = std::upper_bound(chunkStarts.begin() + 1, chunkStarts.end(), index) - chunkStarts.begin() - 1;
+	return chunkOffsets[c] + chunks[c].offsets[index - chunkStarts[c]];
+}
+
+ChatMessage* Chat::MessageStore::Find(u64 messageID) const
+{
+	auto res = byID.find(messageID);
+	return res == byID.end() ? nullptr : res->second;
+}
+
+size_t Chat::MessageStore::IndexOf(u64 messageID) const
+{
+	const ChatMessage* mess = Find(messageID);
+	if (!mess) return Size();
+	return LowerBound(mess->GetTimeStamp(), messageID);
+}
+
+size_t Chat::MessageStore::LowerBound(s64 time, u64 id) const
+{
+	if (Empty()) return 0;
+	const size_t c = FindChunk(time, id);
+	const Chunk& chunk = chunks[c];
+	auto it = std::partition_point(chunk.messages.begin(), chunk.messages.end(), [time, id](const std::unique_ptr<ChatMessage>& other) { return IsBefore(other.get(), time, id); });
+	return chunkStarts[c] + (it - chunk.messages.begin());
+}
+
+bool Chat::MessageStore::IsBefore(const ChatMessage* mess, s64 time, u64 id)
+{
+	return mess->GetTimeStamp() < time || (mess->GetTimeStamp() == time && mess->GetID() < id);
+}
+
+size_t Chat::MessageStore::FindChunk(s64 time, u64 id) const
+{
+	auto it = std::partition_point(chunks.begin(), chunks.end() - 1, [time, id](const Chunk& chunk) { return IsBefore(chunk.messages.back().get(), time, id); });
+	return it - chunks.begin();
+}
+
+void Chat::MessageStore::UpdateOffsets(Chunk& chunk, size_t from)
+{
+	chunk.offsets.resize(chunk.messages.size() + 1);
+	for (size_t i = from; i < chunk.messages.size(); i++)
+	{
+		chunk.offsets[i + 1] = chunk.offsets[i] + chunk.messages[i]->GetHeight() + spacing;
+	}
+}
+
+void Chat::MessageStore::UpdateChunkBounds(size_t from)
+{
+	chunkOffsets.resize(chunks.size() + 1);
+	chunkStarts.resize(chunks.size() + 1);
+	for (size_t c = from; c < chunks.size(); c++)
+	{
+		chunkOffsets[c + 1] = chunkOffsets[c] + chunks[c].offsets.back();
+		chunkStarts[c + 1] = chunkStarts[c] + chunks[c].messages.size();
+	}
+}
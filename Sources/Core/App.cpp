@@ -133,6 +133,7 @@ void App::Run()
 		ImGui::NewFrame();
 		glfwPollEvents();
 		glClear(GL_COLOR_BUFFER_BIT);
+		textures->Update();
 		ImGui::DockSpaceOverViewport(nullptr, ImGuiDockNodeFlags_PassthruCentralNode);
 		ImGui::BeginMainMenuBar();
 		if (ImGui::BeginMenu("File"))
@@ -195,9 +196,10 @@ void App::Run()
 			//std::filesystem::copy_file(texPath, dest);
 			std::string path = texPath.string();
 			Resources::Texture* tex = textures->GetOrCreateTexture(path);
-			lastError = Resources::Texture::TryLoad(path.c_str(), tex, Maths::Vec2(1, 1), Maths::Vec2(512, 512), 0x40000);
+			lastError = textures->TryLoad(path.c_str(), tex, Maths::Vec2(1, 1), Maths::Vec2(512, 512), 0x40000);
 			if (lastError == TextureError::NONE)
 			{
+				textures->Decode(tex);
 				tmpTexture = tex;
 			}
 			else
@@ -0,0 +1,171 @@
+#include "Core/BufferPool.hpp"
+
+#include <algorithm>
+#include <array>
+#include <mutex>
+
+namespace
+{
+	constexpr size_t MinBufferClass = 6; // 64 bytes
+	constexpr size_t MaxBufferClass = 22; // 4 MB
+	constexpr size_t MaxPooledBytesPerClass = 4 * 1024 * 1024;
+	constexpr size_t MaxPooledPerClass = 256;
+	constexpr size_t BlockStep = 16;
+	constexpr size_t MaxBlockSize = 512; // Covers the std::deque chunks
+	constexpr size_t MaxPooledBlocksPerClass = 1024;
+
+	struct PoolState
+	{
+		std::mutex lock;
+		std::array<std::vector<std::vector<u8>>, MaxBufferClass + 1> buffers;
+		std::array<std::vector<void*>, MaxBlockSize / BlockStep> blocks;
+		std::vector<std::vector<u8>*> sharedHolders;
+		Core::BufferPool::Stats stats;
+	};
+
+	// Never destroyed : buffers may still be released by static objects at exit
+	PoolState& GetState()
+	{
+		static PoolState* state = new PoolState();
+		return *state;
+	}
+
+	size_t ClassOf(size_t size)
+	{
+		size_t bufferClass = MinBufferClass;
+		while ((size_t(1) << bufferClass) < size)
+			bufferClass++;
+		return bufferClass;
+	}
+
+	struct SharedReleaser
+	{
+		void operator()(const std::vector<u8>* shared) const
+		{
+			std::vector<u8>* holder = const_cast<std::vector<u8>*>(shared);
+			Core::BufferPool::Release(std::move(*holder));
+			PoolState& state = GetState();
+			{
+				std::lock_guard<std::mutex> lock(state.lock);
+				if (state.sharedHolders.size() < MaxPooledBlocksPerClass)
+				{
+					state.sharedHolders.push_back(holder);
+					return;
+				}
+			}
+			delete holder;
+		}
+	};
+}
+
+std::vector<u8> Core::BufferPool::Acquire(size_t size)
+{
+	std::vector<u8> buffer;
+	const size_t bufferClass = ClassOf(size);
+	PoolState& state = GetState();
+	if (bufferClass <= MaxBufferClass)
+	{
+		std::lock_guard<std::mutex> lock(state.lock);
+		auto& freeBuffers = state.buffers[bufferClass];
+		if (!freeBuffers.empty())
+		{
+			buffer = std::move(freeBuffers.back());
+			freeBuffers.pop_back();
+			state.stats.reused++;
+			return buffer;
+		}
+		state.stats.heapAllocations++;
+	}
+	buffer.reserve(bufferClass <= MaxBufferClass ? (size_t(1) << bufferClass) : size);
+	return buffer;
+}
+
+void Core::BufferPool::Release(std::vector<u8>&& buffer)
+{
+	const size_t capacity = buffer.capacity();
+	if (capacity < (size_t(1) << MinBufferClass))
+		return;
+	// A buffer only goes in a class it fully covers
+	size_t bufferClass = ClassOf(capacity);
+	if ((size_t(1) << bufferClass) > capacity)
+		bufferClass--;
+	if (bufferClass > MaxBufferClass)
+		return;
+	const size_t maxPooled = std::min(MaxPooledPerClass, std::max<size_t>(2, MaxPooledBytesPerClass >> bufferClass));
+	PoolState& state = GetState();
+	std::lock_guard<std::mutex> lock(state.lock);
+	auto& freeBuffers = state.buffers[bufferClass];
+	if (freeBuffers.size() < maxPooled)
+	{
+		buffer.clear();
+		freeBuffers.push_back(std::move(buffer));
+	}
+}
+
+std::shared_ptr<const std::vector<u8>> Core::BufferPool::Share(std::vector<u8>&& buffer)
+{
+	std::vector<u8>* holder = nullptr;
+	PoolState& state = GetState();
+	{
+		std::lock_guard<std::mutex> lock(state.lock);
+		if (!state.sharedHolders.empty())
+		{
+			holder = state.sharedHolders.back();
+			state.sharedHolders.pop_back();
+		}
+	}
+	if (!holder)
+		holder = new std::vector<u8>();
+	*holder = std::move(buffer);
+	return std::shared_ptr<const std::vector<u8>>(holder, SharedReleaser(), BlockAllocator<u8>());
+}
+
+void* Core::BufferPool::AllocateBlock(size_t size)
+{
+	PoolState& state = GetState();
+	if (size == 0 || size > MaxBlockSize)
+	{
+		std::lock_guard<std::mutex> lock(state.lock);
+		state.stats.heapAllocations++;
+		return ::operator new(size);
+	}
+	const size_t blockClass = (size - 1) / BlockStep;
+	{
+		std::lock_guard<std::mutex> lock(state.lock);
+		auto& freeBlocks = state.blocks[blockClass];
+		if (!freeBlocks.empty())
+		{
+			void* block = freeBlocks.back();
+			freeBlocks.pop_back();
+			state.stats.reused++;
+			return block;
+		}
+		state.stats.heapAllocations++;
+	}
+	return ::operator new((blockClass + 1) * BlockStep);
+}
+
+void Core::BufferPool::FreeBlock(void* block, size_t size)
+{
+	if (!block)
+		return;
+	if (size > 0 && size <= MaxBlockSize)
+	{
+		PoolState& state = GetState();
+		std::lock_guard<std::mutex> lock(state.lock);
+		auto& freeBlocks = state.blocks[(size - 1) / BlockStep];
+		if (freeBlocks.size() < MaxPooledBlocksPerClass)
+		{
+			freeBlocks.push_back(block);
+			return;
+		}
+	}
+	::operator delete(block);
+}
+
+Core::BufferPool::Stats Core::BufferPool::GetStats()
+{
+	PoolState& state = GetState();
+	std::lock_guard<std::mutex> lock(state.lock);
+	return state.stats;
+}
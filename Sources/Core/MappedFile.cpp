@@ -0,0 +1,152 @@
+#include "Core/MappedFile.hpp"
+
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+Core::MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+Core::MappedFile& Core::MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		Close();
+		std::swap(data, other.data);
+		std::swap(size, other.size);
+	}
+	return *this;
+}
+
+Core::MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef _WIN32
+namespace
+{
+	// The handles aren't needed once the view exists, it keeps the file open
+	u8* MapHandle(HANDLE file, u64 size, bool writable)
+	{
+		HANDLE mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size), nullptr);
+		CloseHandle(file);
+		if (!mapping) return nullptr;
+		void* view = MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size));
+		CloseHandle(mapping);
+		return static_cast<u8*>(view);
+	}
+}
+
+bool Core::MappedFile::Open(const std::string& path)
+{
+	Close();
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+	data = MapHandle(file, fileSize.QuadPart, false);
+	size = data ? fileSize.QuadPart : 0;
+	return data != nullptr;
+}
+
+bool Core::MappedFile::Create(const std::string& path, u64 sizeIn)
+{
+	Close();
+	if (sizeIn == 0) return false;
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	if (static_cast<u64>(fileSize.QuadPart) != sizeIn)
+	{
+		LARGE_INTEGER end;
+		end.QuadPart = sizeIn;
+		if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file))
+		{
+			CloseHandle(file);
+			return false;
+		}
+	}
+	data = MapHandle(file, sizeIn, true);
+	size = data ? sizeIn : 0;
+	return data != nullptr;
+}
+
+void Core::MappedFile::Close()
+{
+	if (data) UnmapViewOfFile(data);
+	data = nullptr;
+	size = 0;
+}
+#else
+namespace
+{
+	// The descriptor isn't needed once the mapping exists, it keeps the file open
+	u8* MapDescriptor(int file, u64 size, bool writable)
+	{
+		void* view = mmap(nullptr, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, file, 0);
+		close(file);
+		return view == MAP_FAILED ? nullptr : static_cast<u8*>(view);
+	}
+}
+
+bool Core::MappedFile::Open(const std::string& path)
+{
+	Close();
+	const int file = open(path.c_str(), O_RDONLY);
+	if (file < 0) return false;
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0)
+	{
+		close(file);
+		return false;
+	}
+	data = MapDescriptor(file, fileStat.st_size, false);
+	size = data ? fileStat.st_size : 0;
+	return data != nullptr;
+}
+
+bool Core::MappedFile::Create(const std::string& path, u64 sizeIn)
+{
+	Close();
+	if (sizeIn == 0) return false;
+	const int file = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (file < 0) return false;
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || (static_cast<u64>(fileStat.st_size) != sizeIn && ftruncate(file, sizeIn) != 0))
+	{
+		close(file);
+		return false;
+	}
+	data = MapDescriptor(file, sizeIn, true);
+	size = data ? sizeIn : 0;
+	return data != nullptr;
+}
+
+void Core::MappedFile::Close()
+{
+	if (data) munmap(data, size);
+	data = nullptr;
+	size = 0;
+}
+#endif
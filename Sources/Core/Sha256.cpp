@@ -0,0 +1,124 @@
+#include "Core/Sha256.hpp"
+
+#include <cstring>
+
+namespace
+{
+	constexpr u32 RoundConstants[64] =
+	{
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+
+	constexpr u32 Rotate(u32 value, u32 bits)
+	{
+		return (value >> bits) | (value << (32 - bits));
+	}
+}
+
+Core::Sha256::Sha256()
+{
+	Reset();
+}
+
+void Core::Sha256::Reset()
+{
+	const u32 initialState[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	memcpy(state, initialState, sizeof(state));
+	bufferSize = 0;
+	totalSize = 0;
+}
+
+void Core::Sha256::Update(const u8* data, u64 size)
+{
+	totalSize += size;
+	if (bufferSize > 0)
+	{
+		const u64 copied = size < sizeof(buffer) - bufferSize ? size : sizeof(buffer) - bufferSize;
+		memcpy(buffer + bufferSize, data, copied);
+		bufferSize += copied;
+		data += copied;
+		size -= copied;
+		if (bufferSize < sizeof(buffer)) return;
+		ProcessBlock(buffer);
+		bufferSize = 0;
+	}
+	for (; size >= sizeof(buffer); data += sizeof(buffer), size -= sizeof(buffer))
+	{
+		ProcessBlock(data);
+	}
+	memcpy(buffer, data, size);
+	bufferSize = size;
+}
+
+Core::Sha256::Digest Core::Sha256::Final()
+{
+	// A one bit, zeros up to 56 bytes in the last block, then the size in bits, big endian
+	const u64 bitSize = totalSize * 8;
+	const u8 one = 0x80;
+	const u8 zeros[64] = {};
+	Update(&one, 1);
+	Update(zeros, bufferSize <= 56 ? 56 - bufferSize : 120 - bufferSize);
+	u8 sizeBytes[8];
+	for (u32 i = 0; i < 8; i++)
+	{
+		sizeBytes[i] = static_cast<u8>(bitSize >> (56 - 8 * i));
+	}
+	Update(sizeBytes, sizeof(sizeBytes));
+	Digest digest;
+	for (u32 i = 0; i < 32; i++)
+	{
+		digest[i] = static_cast<u8>(state[i / 4] >> (24 - 8 * (i % 4)));
+	}
+	return digest;
+}
+
+Core::Sha256::Digest Core::Sha256::Hash(const u8* data, u64 size)
+{
+	Sha256 hash;
+	hash.Update(data, size);
+	return hash.Final();
+}
+
+void Core::Sha256::ProcessBlock(const u8* block)
+{
+	u32 w[64];
+	for (u32 i = 0; i < 16; i++)
+	{
+		w[i] = (static_cast<u32>(block[4 * i]) << 24) | (static_cast<u32>(block[4 * i + 1]) << 16) | (static_cast<u32>(block[4 * i + 2]) << 8) | block[4 * i + 3];
+	}
+	for (u32 i = 16; i < 64; i++)
+	{
+		const u32 s0 = Rotate(w[i - 15], 7) ^ Rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		const u32 s1 = Rotate(w[i - 2], 17) ^ Rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	u32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4], f = state[5], g = state[6], h = state[7];
+	for (u32 i = 0; i < 64; i++)
+	{
+		const u32 t1 = h + (Rotate(e, 6) ^ Rotate(e, 11) ^ Rotate(e, 25)) + ((e & f) ^ (~e & g)) + RoundConstants[i] + w[i];
+		const u32 t2 = (Rotate(a, 2) ^ Rotate(a, 13) ^ Rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
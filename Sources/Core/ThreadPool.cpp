@@ -0,0 +1,79 @@
+#include "Core/ThreadPool.hpp"
+
+#include <atomic>
+
+Core::ThreadPool::ThreadPool(u32 threadCount)
+{
+	for (u32 i = 0; i < threadCount; i++)
+	{
+		threads.emplace_back(&ThreadPool::WorkerFunc, this);
+	}
+}
+
+Core::ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(tasksLock);
+		shouldQuit = true;
+	}
+	tasksCondition.notify_all();
+	for (auto& t : threads)
+	{
+		t.join();
+	}
+}
+
+void Core::ThreadPool::Push(std::function<void()>&& task)
+{
+	{
+		std::lock_guard<std::mutex> lock(tasksLock);
+		tasks.push_back(std::move(task));
+	}
+	tasksCondition.notify_one();
+}
+
+void Core::ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+	std::atomic<size_t> nextIndex = 0;
+	auto Work = [&]()
+	{
+		for (size_t i = nextIndex++; i < count; i = nextIndex++)
+		{
+			task(i);
+		}
+	};
+	// Helpers share the indices with the calling thread, we wait for all of them to leave since they reference this stack
+	const size_t helpers = count > 1 ? std::min<size_t>(count - 1, threads.size()) : 0;
+	size_t helpersDone = 0;
+	std::mutex doneLock;
+	std::condition_variable doneCondition;
+	for (size_t i = 0; i < helpers; i++)
+	{
+		Push([&]()
+		{
+			Work();
+			std::lock_guard<std::mutex> lock(doneLock);
+			helpersDone++;
+			doneCondition.notify_one();
+		});
+	}
+	Work();
+	std::unique_lock<std::mutex> lock(doneLock);
+	doneCondition.wait(lock, [&]() { return helpersDone == helpers; });
+}
+
+void Core::ThreadPool::WorkerFunc()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(tasksLock);
+			tasksCondition.wait(lock, [this]() { return shouldQuit || !tasks.empty(); });
+			if (shouldQuit && tasks.empty()) return;
+			task = std::move(tasks.front());
+			tasks.pop_front();
+		}
+		task();
+	}
+}
@@ -169,6 +169,25 @@ namespace Networking
 		return memcmp(&reinterpret_cast<const sockaddr_in6&>(mStorage).sin6_addr, &reinterpret_cast<const sockaddr_in6&>(other.mStorage).sin6_addr, sizeof(IN6_ADDR)) == 0;
 	}
 
+	size_t Address::Hash::operator()(const Address& addr) const
+	{
+		// FNV-1a over the port and the raw ip bytes
+		auto Combine = [](size_t hash, const void* data, size_t size)
+		{
+			const u8* bytes = static_cast<const u8*>(data);
+			for (size_t i = 0; i < size; ++i)
+				hash = (hash ^ bytes[i]) * static_cast<size_t>(1099511628211ull);
+			return hash;
+		};
+		size_t hash = static_cast<size_t>(14695981039346656037ull);
+		hash = Combine(hash, &addr.mPort, sizeof(addr.mPort));
+		if (addr.mType == Type::IPv4)
+			hash = Combine(hash, &reinterpret_cast<const sockaddr_in&>(addr.mStorage).sin_addr, sizeof(in_addr));
+		else if (addr.mType == Type::IPv6)
+			hash = Combine(hash, &reinterpret_cast<const sockaddr_in6&>(addr.mStorage).sin6_addr, sizeof(in6_addr));
+		return hash;
+	}
+
 	bool Address::connect(SOCKET sckt) const
 	{
 		return ::connect(sckt, reinterpret_cast<const sockaddr*>(&mStorage), sizeof(mStorage)) == 0;
@@ -1,7 +1,20 @@
 #include "Networking/Serialization/Deserializer.hpp"
 
+#include <cstring>
+
 using namespace Networking::Serialization;
 
+template<class T>
+bool Deserializer::ReadValue(T& out)
+{
+	if (sizeof(T) > bufferSize - cPos) return false;
+	T tmp;
+	memcpy(&tmp, buffer + cPos, sizeof(T));
+	cPos += sizeof(T);
+	out = Conversion::NetworkOrder(tmp);
+	return true;
+}
+
 bool Deserializer::Read(u8& in)
 {
 	if (cPos >= bufferSize) return false;
@@ -16,14 +29,7 @@ bool Deserializer::Read(s8& in)
 
 bool Deserializer::Read(u16& in)
 {
-	u16 tmp = 0;
-	if (cPos + sizeof(tmp) > bufferSize) return false;
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		tmp |= (u64)buffer[cPos++] << (i*8);
-	}
-	Conversion::ToLocal(tmp, in);
-	return true;
+	return ReadValue(in);
 }
 
 bool Deserializer::Read(s16& in)
@@ -33,14 +39,7 @@ bool Deserializer::Read(s16& in)
 
 bool Deserializer::Read(u32& in)
 {
-	u32 tmp = 0;
-	if (cPos + sizeof(tmp) > bufferSize) return false;
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		tmp |= (u64)buffer[cPos++] << (i * 8);
-	}
-	Conversion::ToLocal(tmp, in);
-	return true;
+	return ReadValue(in);
 }
 
 bool Deserializer::Read(s32& in)
@@ -50,14 +49,7 @@ bool Deserializer::Read(s32& in)
 
 bool Deserializer::Read(u64& in)
 {
-	u64 tmp = 0;
-	if (cPos + sizeof(tmp) > bufferSize) return false;
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		tmp |= (u64)buffer[cPos++] << (i * 8);
-	}
-	Conversion::ToLocal(tmp, in);
-	return true;
+	return ReadValue(in);
 }
 
 bool Deserializer::Read(s64& in)
@@ -67,32 +59,81 @@ bool Deserializer::Read(s64& in)
 
 bool Deserializer::Read(f32& in)
 {
-	u32 tmp = 0;
-	if (cPos + sizeof(tmp) > bufferSize) return false;
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		tmp |= (u64)buffer[cPos++] << (i * 8);
-	}
-	Conversion::ToLocal(tmp, in);
+	u32 tmp;
+	if (!ReadValue(tmp)) return false;
+	memcpy(&in, &tmp, sizeof(in));
 	return true;
 }
 
 bool Deserializer::Read(f64& in)
 {
-	u64 tmp = 0;
-	if (cPos + sizeof(tmp) > bufferSize) return false;
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		tmp |= (u64)buffer[cPos++] << (i * 8);
-	}
-	Conversion::ToLocal(tmp, in);
+	u64 tmp;
+	if (!ReadValue(tmp)) return false;
+	memcpy(&in, &tmp, sizeof(in));
 	return true;
 }
 
 bool Deserializer::Read(u8* dataIn, u64 dataSize)
 {
-	if (cPos + dataSize > bufferSize) return false;
-	std::copy(buffer + cPos, buffer + (cPos + dataSize), dataIn);
+	const u8* view;
+	if (!ReadView(view, dataSize)) return false;
+	std::copy(view, view + dataSize, dataIn);
+	return true;
+}
+
+bool Deserializer::ReadView(const u8*& dataOut, u64 dataSize)
+{
+	// Sizes come from the network : compared so that they can't overflow
+	if (dataSize > bufferSize - cPos) return false;
+	dataOut = buffer + cPos;
 	cPos += dataSize;
 	return true;
+}
+
+bool Deserializer::ReadView(std::string_view& out, u64 size)
+{
+	const u8* view;
+	if (!ReadView(view, size)) return false;
+	out = std::string_view(reinterpret_cast<const char*>(view), size);
+	return true;
+}
+
+bool Deserializer::ReadVarInt(u64& in)
+{
+	u64 result = 0;
+	const u64 start = cPos;
+	for (u8 shift = 0; shift < 64; shift += 7)
+	{
+		if (cPos >= bufferSize) break;
+		const u8 byte = buffer[cPos++];
+		result |= static_cast<u64>(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+		{
+			in = result;
+			return true;
+		}
+	}
+	// Truncated, or longer than 10 bytes
+	cPos = start;
+	return false;
+}
+
+bool Deserializer::ReadVarInt(s64& in)
+{
+	u64 tmp;
+	if (!ReadVarInt(tmp)) return false;
+	in = static_cast<s64>(tmp >> 1) ^ -static_cast<s64>(tmp & 1);
+	return true;
+}
+
+bool Deserializer::ReadString(std::string_view& out)
+{
+	u64 size;
+	const u64 start = cPos;
+	if (!Read(size) || !ReadView(out, size))
+	{
+		cPos = start;
+		return false;
+	}
+	return true;
 }
\ No newline at end of file
@@ -1,25 +1,104 @@
 #include "Networking/Serialization/Serializer.hpp"
 
+#include <algorithm>
+#include <cstring>
+
+#include "Core/BufferPool.hpp"
+
 using namespace Networking::Serialization;
 
+Serializer::Serializer(u64 capacity)
+{
+	Reserve(capacity);
+}
+
+Serializer::~Serializer()
+{
+	Core::BufferPool::Release(std::move(buffer));
+}
+
+void Serializer::Reserve(u64 newCapacity)
+{
+	if (external || newCapacity <= capacity) return;
+	std::vector<u8> grown = Core::BufferPool::Acquire(newCapacity);
+	grown.resize(grown.capacity());
+	std::copy(data, data + size, grown.data());
+	Core::BufferPool::Release(std::move(buffer));
+	buffer = std::move(grown);
+	data = buffer.data();
+	capacity = buffer.size();
+}
+
+std::vector<u8> Serializer::TakeBuffer()
+{
+	std::vector<u8> result;
+	if (external)
+	{
+		result = Core::BufferPool::Acquire(size);
+		result.insert(result.cend(), data, data + size);
+	}
+	else
+	{
+		buffer.resize(size);
+		result = std::move(buffer);
+		data = nullptr;
+		capacity = 0;
+	}
+	Clear();
+	return result;
+}
+
+u8* Serializer::Claim(u64 count)
+{
+	if (size + count > capacity)
+	{
+		if (external)
+		{
+			overflow = true;
+			return nullptr;
+		}
+		Reserve(std::max(size + count, 2 * capacity));
+	}
+	u8* dst = data + size;
+	size += count;
+	return dst;
+}
+
+template<class T>
+void Serializer::WriteValue(T networkValue)
+{
+	if (u8* dst = Claim(sizeof(T)))
+		memcpy(dst, &networkValue, sizeof(T));
+}
+
+template<class T, class U>
+void Serializer::WriteValues(const U* values, u64 count)
+{
+	static_assert(sizeof(T) == sizeof(U));
+	u8* dst = Claim(count * sizeof(T));
+	if (!dst) return;
+	for (u64 i = 0; i < count; i++)
+	{
+		T tmp;
+		memcpy(&tmp, values + i, sizeof(T));
+		tmp = Conversion::NetworkOrder(tmp);
+		memcpy(dst + i * sizeof(T), &tmp, sizeof(T));
+	}
+}
+
 void Serializer::Write(u8 in)
 {
-	buffer.push_back(in);
+	WriteValue(in);
 }
 
 void Serializer::Write(s8 in)
 {
-	buffer.push_back(static_cast<u8>(in));
+	WriteValue(static_cast<u8>(in));
 }
 
 void Serializer::Write(u16 in)
 {
-	u16 tmp;
-	Conversion::ToNetwork(in, tmp);
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		buffer.push_back((tmp >> (i*8) & 0xff));
-	}
+	WriteValue(Conversion::NetworkOrder(in));
 }
 
 void Serializer::Write(s16 in)
@@ -29,12 +108,7 @@ void Serializer::Write(s16 in)
 
 void Serializer::Write(u32 in)
 {
-	u32 tmp;
-	Conversion::ToNetwork(in, tmp);
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		buffer.push_back((tmp >> (i * 8) & 0xff));
-	}
+	WriteValue(Conversion::NetworkOrder(in));
 }
 
 void Serializer::Write(s32 in)
@@ -44,12 +118,7 @@ void Serializer::Write(s32 in)
 
 void Serializer::Write(u64 in)
 {
-	u64 tmp;
-	Conversion::ToNetwork(in, tmp);
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		buffer.push_back((tmp >> (i * 8) & 0xff));
-	}
+	WriteValue(Conversion::NetworkOrder(in));
 }
 
 void Serializer::Write(s64 in)
@@ -59,26 +128,60 @@ void Serializer::Write(s64 in)
 
 void Serializer::Write(f32 in)
 {
-	u32 tmp;
-	Conversion::ToNetwork(in, tmp);
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		buffer.push_back((tmp >> (i * 8) & 0xff));
-	}
+	WriteValues<u32>(&in, 1);
 }
 
 void Serializer::Write(f64 in)
 {
-	u64 tmp;
-	Conversion::ToNetwork(in, tmp);
-	for (u8 i = 0; i < sizeof(tmp); i++)
-	{
-		buffer.push_back((tmp >> (i * 8) & 0xff));
-	}
+	WriteValues<u64>(&in, 1);
 }
 
 void Networking::Serialization::Serializer::Write(const u8* dataIn, u64 dataSize)
 {
-	buffer.resize(buffer.size() + dataSize);
-	std::copy(dataIn, dataIn + dataSize, buffer.data() + (buffer.size() - dataSize));
+	if (dataSize == 0) return;
+	if (u8* dst = Claim(dataSize))
+		memcpy(dst, dataIn, dataSize);
+}
+
+void Serializer::WriteArray(const u16* values, u64 count)
+{
+	WriteValues<u16>(values, count);
 }
+
+void Serializer::WriteArray(const u32* values, u64 count)
+{
+	WriteValues<u32>(values, count);
+}
+
+void Serializer::WriteArray(const u64* values, u64 count)
+{
+	WriteValues<u64>(values, count);
+}
+
+void Serializer::WriteArray(const f32* values, u64 count)
+{
+	WriteValues<u32>(values, count);
+}
+
+void Serializer::WriteArray(const f64* values, u64 count)
+{
+	WriteValues<u64>(values, count);
+}
+
+void Serializer::WriteVarInt(u64 in)
+{
+	u8 bytes[10];
+	u8 count = 0;
+	while (in >= 0x80)
+	{
+		bytes[count++] = static_cast<u8>(in) | 0x80;
+		in >>= 7;
+	}
+	bytes[count++] = static_cast<u8>(in);
+	Write(bytes, count);
+}
+
+void Serializer::WriteVarInt(s64 in)
+{
+	WriteVarInt((static_cast<u64>(in) << 1) ^ static_cast<u64>(in >> 63));
+}
\ No newline at end of file
@@ -0,0 +1,115 @@
+// Standalone benchmark of the Serializer writes against the former byte by byte loop
+// Excluded from the application build, built on its own with the serialization sources, on Windows as Conversion.cpp uses the WinSock htonll and htonf :
+//   cl /std:c++17 /O2 /EHsc /IHeaders Sources/Networking/Serialization/SerializerBenchmark.cpp Sources/Networking/Serialization/Serializer.cpp Sources/Networking/Serialization/Conversion.cpp Sources/Core/BufferPool.cpp Ws2_32.lib
+// Writes records of u64, u32, u16, u8, f32 and f64, then an array of u64, and checks both ways give the same bytes
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+#include "Networking/Serialization/Serializer.hpp"
+
+using namespace Networking::Serialization;
+
+namespace
+{
+	// The Serializer as it was : every fixed width field pushed back one byte at a time
+	class ByteLoopSerializer
+	{
+	public:
+		std::vector<u8> TakeBuffer() { return std::move(buffer); }
+
+		void Write(u8 in) { buffer.push_back(in); }
+		void Write(u16 in) { u16 tmp; Conversion::ToNetwork(in, tmp); PushBytes(tmp); }
+		void Write(u32 in) { u32 tmp; Conversion::ToNetwork(in, tmp); PushBytes(tmp); }
+		void Write(u64 in) { u64 tmp; Conversion::ToNetwork(in, tmp); PushBytes(tmp); }
+		void Write(f32 in) { u32 tmp; Conversion::ToNetwork(in, tmp); PushBytes(tmp); }
+		void Write(f64 in) { u64 tmp; Conversion::ToNetwork(in, tmp); PushBytes(tmp); }
+	private:
+		template<class T>
+		void PushBytes(T tmp)
+		{
+			for (u8 i = 0; i < sizeof(tmp); i++)
+				buffer.push_back((tmp >> (i * 8) & 0xff));
+		}
+
+		std::vector<u8> buffer;
+	};
+
+	struct Record
+	{
+		u64 id;
+		u32 count;
+		u16 port;
+		u8 type;
+		f32 x;
+		f64 y;
+	};
+
+	constexpr size_t RecordCount = 200000;
+	constexpr size_t RecordSize = sizeof(u64) + sizeof(u32) + sizeof(u16) + sizeof(u8) + sizeof(f32) + sizeof(f64);
+	constexpr int RunCount = 5;
+
+	template<class S>
+	void WriteRecords(S& sr, const std::vector<Record>& records)
+	{
+		for (const Record& r : records)
+		{
+			sr.Write(r.id);
+			sr.Write(r.count);
+			sr.Write(r.port);
+			sr.Write(r.type);
+			sr.Write(r.x);
+			sr.Write(r.y);
+		}
+	}
+
+	// Best of a few runs, in milliseconds : the bytes written are kept in output
+	template<class Run>
+	double MeasureMs(std::vector<u8>& output, Run run)
+	{
+		double best = 0.0;
+		for (int i = 0; i < RunCount; i++)
+		{
+			const auto start = std::chrono::steady_clock::now();
+			output = run();
+			const auto end = std::chrono::steady_clock::now();
+			const double ms = std::chrono::duration<double, std::milli>(end - start).count();
+			if (i == 0 || ms < best)
+				best = ms;
+		}
+		return best;
+	}
+}
+
+int main()
+{
+	std::vector<Record> records(RecordCount);
+	std::vector<u64> values(RecordCount);
+	for (size_t i = 0; i < RecordCount; i++)
+	{
+		records[i] = Record{ i * 0x9E3779B97F4A7C15ull, static_cast<u32>(i), static_cast<u16>(i), static_cast<u8>(i), i * 0.5f, i * 0.25 };
+		values[i] = records[i].id;
+	}
+
+	std::vector<u8> former;
+	std::vector<u8> current;
+	bool identical = true;
+	const double byteLoop = MeasureMs(former, [&] { ByteLoopSerializer sr; WriteRecords(sr, records); return sr.TakeBuffer(); });
+	const double claimed = MeasureMs(current, [&] { Serializer sr; WriteRecords(sr, records); return sr.TakeBuffer(); });
+	identical &= former == current;
+	const double presized = MeasureMs(current, [&] { Serializer sr(RecordCount * RecordSize); WriteRecords(sr, records); return sr.TakeBuffer(); });
+	identical &= former == current;
+
+	const double arrayLoop = MeasureMs(former, [&] { ByteLoopSerializer sr; for (u64 value : values) sr.Write(value); return sr.TakeBuffer(); });
+	const double writeArray = MeasureMs(current, [&] { Serializer sr(RecordCount * sizeof(u64)); sr.WriteArray(values.data(), values.size()); return sr.TakeBuffer(); });
+	identical &= former == current;
+
+	std::cout << RecordCount << " records of " << RecordSize << " bytes" << std::endl;
+	std::cout << "byte loop " << byteLoop << " ms, serializer " << claimed << " ms, presized " << presized << " ms" << std::endl;
+	std::cout << RecordCount << " u64 : byte loop " << arrayLoop << " ms, WriteArray " << writeArray << " ms" << std::endl;
+	if (!identical)
+		std::cout << "The serializers wrote different bytes" << std::endl;
+	return identical ? 0 : 1;
+}
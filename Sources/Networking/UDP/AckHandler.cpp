@@ -34,7 +34,7 @@ namespace Networking::UDP
 				}
 			}
 			//!< Dcaller le masque vers la gauche : supprimer les paquets les plus anciens du masque
-			mPreviousAcks <<= bitsToShift;
+			mPreviousAcks = (bitsToShift < 64) ? (mPreviousAcks << bitsToShift) : 0; // Un dcalage de 64 bits est indfini
 			if (gap >= 64)
 			{
 				//!< Il sagit dun saut qui supprime entirement le masque
@@ -117,10 +117,9 @@ namespace Networking::UDP
 		return mPreviousAcks;
 	}
 
-	std::vector<uint16_t> AckHandler::getNewAcks() const
+	void AckHandler::getNewAcks(std::vector<uint16_t>& newAcks) const
 	{
-		std::vector<uint16_t> newAcks;
-		newAcks.reserve(65);
+		newAcks.clear();
 		for (uint8_t i = 64; i != 0; --i)
 		{
 			const uint8_t bitToCheck = i - 1;
@@ -132,7 +131,6 @@ namespace Networking::UDP
 		}
 		if (mLastAckIsNew)
 			newAcks.push_back(mLastAck);
-		return newAcks;
 	}
 	std::vector<uint16_t>& UDP::AckHandler::loss()
 	{
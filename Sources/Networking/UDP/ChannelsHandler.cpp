@@ -31,23 +31,31 @@ namespace Networking::UDP
 		}
 	}
 
-	std::vector<std::tuple<u8, std::vector<u8>>> ChannelsHandler::process(bool isConnected)
+	void ChannelsHandler::process(bool isConnected, std::vector<std::tuple<u8, std::vector<u8>>>& messages)
 	{
-		std::vector<std::tuple<u8, std::vector<u8>>> messages;
 		for (auto& channel : mChannels)
 		{
-			std::vector<std::vector<u8>> protocolMessages = channel->process();
+			mProtocolMessages.clear();
+			channel->process(mProtocolMessages);
 			// If we're not connected, ignore and discard unreliable messages
-			if (!protocolMessages.empty() && (channel->isReliable() || isConnected))
+			if (!mProtocolMessages.empty() && (channel->isReliable() || isConnected))
 			{
-				messages.reserve(messages.size() + protocolMessages.size());
-				for (auto&& msg : protocolMessages)
+				for (auto&& msg : mProtocolMessages)
 				{
 					messages.push_back(std::make_tuple(channel->channelId(), std::move(msg)));
 				}
 			}
 		}
-		return messages;
+	}
+
+	size_t ChannelsHandler::unsentBytes() const
+	{
+		size_t total = 0;
+		for (auto& channel : mChannels)
+		{
+			total += channel->unsentBytes();
+		}
+		return total;
 	}
 
 	void ChannelsHandler::queue(std::vector<uint8_t>&& msgData, uint32_t canalIndex)
@@ -56,6 +64,12 @@ namespace Networking::UDP
 		mChannels[canalIndex]->queue(std::move(msgData));
 	}
 
+	void ChannelsHandler::queue(const SharedData& msgData, uint32_t canalIndex)
+	{
+		assert(canalIndex < mChannels.size());
+		mChannels[canalIndex]->queue(msgData);
+	}
+
 	u16 ChannelsHandler::serialize(u8* buffer, u16 buffersize, Datagram::ID datagramId
 #if NETWORK_INTERRUPTION
 		, bool connectionInterrupted
@@ -4,6 +4,13 @@
 #include "Networking/Messages.hpp"
 #include "Networking/UDP/DistantClient.hpp"
 #include "Networking/Errors.hpp"
+#include "Networking/Utils.hpp"
+#include "Core/ThreadPool.hpp"
+
+#include <thread>
+#include <array>
+#include <algorithm>
+#include <iterator>
 
 namespace Networking::UDP
 {
@@ -19,11 +26,40 @@ namespace Networking::UDP
 
 	Client::Client()
 	{
+		mShards.resize(1);
+		initWakeUp();
 	}
 
 	Client::~Client()
 	{
 		release();
+		releaseWakeUp();
+	}
+
+	void Client::initWakeUp()
+	{
+		// Bound to an ephemeral loopback port : wakeUp sends an empty datagram to it to end a pending poll
+		mWakeUpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (mWakeUpSocket == INVALID_SOCKET)
+			return;
+
+		const Address addr = Address::Loopback(Address::Type::IPv4, 0);
+		sockaddr_storage storage{ 0 };
+		socklen_t storageLength = sizeof(storage);
+		if (!addr.bind(mWakeUpSocket) || !SetNonBlocking(mWakeUpSocket)
+			|| getsockname(mWakeUpSocket, reinterpret_cast<sockaddr*>(&storage), &storageLength) != 0)
+		{
+			releaseWakeUp();
+			return;
+		}
+		mWakeUpAddress = Address(storage);
+	}
+
+	void Client::releaseWakeUp()
+	{
+		if (mWakeUpSocket != INVALID_SOCKET)
+			CloseSocket(mWakeUpSocket);
+		mWakeUpSocket = INVALID_SOCKET;
 	}
 
 	bool Client::init(const u16 port)
@@ -45,6 +81,15 @@ namespace Networking::UDP
 		mClientIdsGenerator = 0;
 		return true;
 	}
+
+	void Client::setWorkerCount(u32 workerCount)
+	{
+		// The calling thread takes a shard too
+		if (workerCount > 1)
+			mWorkers = std::make_unique<Core::ThreadPool>(workerCount - 1);
+		else
+			mWorkers.reset();
+	}
 	void Client::release()
 	{
 		if (mSocket != INVALID_SOCKET)
@@ -63,6 +108,12 @@ namespace Networking::UDP
 			mMessages.clear();
 		}
 		mClients.clear();
+		mClientsByAddress.clear();
+		mClientsById.clear();
+		for (Shard& shard : mShards)
+			shard = Shard();
+		mNextDeadline = std::chrono::milliseconds::max();
+		mOutgoingPending = false;
 #if NETWORK_INTERRUPTION
 		mInterruptedClients.clear();
 #endif
@@ -111,45 +162,122 @@ namespace Networking::UDP
 			mPendingOperations.push_back(Operation::BroadCast(std::move(data), channelIndex));
 	}
 
+	void Client::sendTo(const Address& target, const u8* data, size_t dataSize, u32 channelIndex)
+	{
+		std::vector<u8> buffer = Core::BufferPool::Acquire(dataSize);
+		buffer.insert(buffer.cend(), data, data + dataSize);
+		sendTo(target, std::move(buffer), channelIndex);
+	}
+
+	void Client::sendTo(const Address& target, const SharedData& data, u32 channelIndex)
+	{
+		assert(target.isValid());
+#if NETWORK_THREAD_SAFE
+		OperationsLock lock(mOperationsLock);
+#endif
+		mPendingOperations.push_back(Operation::SendTo(target, data, channelIndex));
+	}
+
+	void Client::broadCast(const u8* data, size_t dataSize, u32 channelIndex)
+	{
+		std::vector<u8> buffer = Core::BufferPool::Acquire(dataSize);
+		buffer.insert(buffer.cend(), data, data + dataSize);
+		broadCast(std::move(buffer), channelIndex);
+	}
+
 	void Client::processSend()
 	{
 		// Process pending operations
-		std::vector<Operation> operations;
+		std::vector<Operation>& operations = mProcessingOperations;
+		operations.clear();
 		{
 #if NETWORK_THREAD_SAFE
 			OperationsLock lock(mOperationsLock);
 #endif
 			operations.swap(mPendingOperations);
 		}
+		// Clients are created beforehand, the shards only look them up
+		for (const Operation& op : operations)
+		{
+			if (op.mType == Operation::Type::Connect || op.mType == Operation::Type::SendTo)
+				getClient(op.mTarget, true);
+		}
+
+		// Do send data to clients
+		prepareShards();
+		runShards([&](Shard& shard) { processShardSend(shard, operations); });
+		mNextDeadline = std::chrono::milliseconds::max();
+		mOutgoingPending = false;
+		for (size_t i = 0; i < mActiveShards; ++i)
+		{
+			Shard& shard = mShards[i];
+			mNextDeadline = std::min(mNextDeadline, shard.nextDeadline);
+			mOutgoingPending |= !shard.outgoing.empty();
+			mIOStats.sendCalls += shard.stats.sendCalls;
+			mIOStats.sentDatagrams += shard.stats.sentDatagrams;
+			shard.stats = IOStats();
+		}
+		flushMessages();
+
+		// Remove disconnected clients
+		// Unregister them first : the range left by remove_if holds moved-from pointers
+		for (auto& client : mClients)
+		{
+			if (!client->isDisconnected())
+				continue;
+#if NETWORK_INTERRUPTION
+			// Make sure no interrupted clients have been removed : interrupted clients should resume before disconnecting
+			const size_t erased = mInterruptedClients.erase(client.get());
+			assert(erased == 0);
+#endif
+			mClientsByAddress.erase(client->address());
+			mClientsById[client->id()] = nullptr;
+		}
+		const auto clientsToRemove = std::remove_if(mClients.begin(), mClients.end(), [](const std::unique_ptr<DistantClient>& client) { return client->isDisconnected(); });
+		mClients.erase(clientsToRemove, mClients.end());
+		// Drop the payloads now rather than at the next call
+		operations.clear();
+	}
+
+	void Client::processShardSend(Shard& shard, std::vector<Operation>& operations)
+	{
+		auto IsInShard = [&](DistantClient* client) { return client && &shardOf(*client) == &shard; };
 		for (Operation& op : operations)
 		{
 			switch (op.mType)
 			{
 			case Operation::Type::Connect:
 			{
-				if (auto client = getClient(op.mTarget, true))
+				auto client = getClient(op.mTarget);
+				if (IsInShard(client))
 					client->connect();
 			} break;
 			case Operation::Type::SendTo:
 			{
-				if (auto client = getClient(op.mTarget, true))
+				auto client = getClient(op.mTarget);
+				if (!IsInShard(client))
+					break;
+				if (op.mSharedData)
+					client->send(op.mSharedData, op.mChannel);
+				else
 					client->send(std::move(op.mData), op.mChannel);
 			} break;
 			case Operation::Type::BroadCast:
 			{
-				for (auto& client : mClients)
+				for (DistantClient* client : shard.clients)
 				{
-					client->send(std::move(op.mData), op.mChannel);
+					client->send(op.mSharedData, op.mChannel);
 				}
 			} break;
 			case Operation::Type::Disconnect:
 			{
-				if (auto client = getClient(op.mTarget))
+				auto client = getClient(op.mTarget);
+				if (IsInShard(client))
 					client->disconnect();
 			} break;
 			case Operation::Type::DisconnectAll:
 			{
-				for (auto& client : mClients)
+				for (DistantClient* client : shard.clients)
 				{
 					client->disconnect();
 				}
@@ -157,21 +285,58 @@ namespace Networking::UDP
 			}
 		}
 
-		// Do send data to clients
-		for (auto& client : mClients)
+		shard.nextDeadline = std::chrono::milliseconds::max();
+		for (DistantClient* client : shard.clients)
+		{
 			client->processSend();
+			shard.nextDeadline = std::min(shard.nextDeadline, client->nextDeadline());
+		}
+		flushDatagrams(shard);
+	}
 
-		// Remove disconnected clients
-		const auto clientsToRemove = std::remove_if(mClients.begin(), mClients.end(), [](const std::unique_ptr<DistantClient>& client) { return client->isDisconnected(); });
-#if NETWORK_INTERRUPTION
-		// Make sure no interrupted clients have been removed : interrupted clients should resume before disconnecting
-		for (auto clientToRemove = clientsToRemove; clientToRemove != mClients.end(); ++clientToRemove)
+	void Client::prepareShards()
+	{
+		size_t shardCount = 1;
+#if !NETWORK_INTERRUPTION
+		// The interrupted clients set is shared by all clients, keep them on a single thread
+		if (mWorkers)
+			shardCount = std::clamp<size_t>(mClients.size() / UDP_MIN_CLIENTS_PER_SHARD, 1, mWorkers->GetThreadCount() + 1);
+#endif
+		mActiveShards = shardCount;
+		if (mShards.size() < shardCount)
+			mShards.resize(shardCount);
+		// Datagrams still waiting in a shard no longer used are sent by the first one
+		for (size_t i = shardCount; i < mShards.size(); ++i)
 		{
-			const size_t erased = mInterruptedClients.erase(clientToRemove->get());
-			assert(erased == 0);
+			auto& outgoing = mShards[i].outgoing;
+			std::move(outgoing.begin(), outgoing.end(), std::back_inserter(mShards[0].outgoing));
+			outgoing.clear();
 		}
+		for (Shard& shard : mShards)
+			shard.clients.clear();
+		for (auto& client : mClients)
+			shardOf(*client).clients.push_back(client.get());
+	}
+
+	void Client::runShards(const std::function<void(Shard&)>& task)
+	{
+		if (mActiveShards == 1)
+			task(mShards[0]);
+		else
+			mWorkers->ParallelFor(mActiveShards, [&](size_t index) { task(mShards[index]); });
+	}
+
+	void Client::flushMessages()
+	{
+#if NETWORK_THREAD_SAFE
+		MessagesLock lock(mMessagesLock);
 #endif
-		mClients.erase(clientsToRemove, mClients.end());
+		for (size_t i = 0; i < mActiveShards; ++i)
+		{
+			auto& messages = mShards[i].messages;
+			std::move(messages.begin(), messages.end(), std::back_inserter(mMessages));
+			messages.clear();
+		}
 	}
 
 #if NETWORK_INTERRUPTION
@@ -193,36 +358,57 @@ namespace Networking::UDP
 #endif
 	void Client::receive()
 	{
+		prepareShards();
+#if UDP_BATCHED_IO
+		mReceiveBuffers.resize(UDP_IO_BATCH_SIZE);
+		std::array<mmsghdr, UDP_IO_BATCH_SIZE> messages;
+		std::array<iovec, UDP_IO_BATCH_SIZE> buffers;
+		std::array<sockaddr_storage, UDP_IO_BATCH_SIZE> senders;
 		for (;;)
 		{
-			Datagram datagram;
-			Address from;
-			int ret = from.recvFrom(mSocket, reinterpret_cast<u8*>(&datagram), Datagram::BufferMaxSize);
-			if (ret > 0)
+			for (size_t i = 0; i < UDP_IO_BATCH_SIZE; ++i)
+			{
+				buffers[i] = { &mReceiveBuffers[i], Datagram::BufferMaxSize };
+				senders[i] = {}; // Addresses are compared on their whole storage
+				messages[i] = {};
+				messages[i].msg_hdr.msg_name = &senders[i];
+				messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+				messages[i].msg_hdr.msg_iov = &buffers[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+			}
+			const int ret = recvmmsg(mSocket, messages.data(), UDP_IO_BATCH_SIZE, MSG_DONTWAIT, nullptr);
+			++mIOStats.receiveCalls;
+			if (ret <= 0)
 			{
-				const u16 receivedSize = static_cast<u16>(ret);
-				if (receivedSize >= Datagram::HeaderSize)
+				if (ret < 0)
 				{
-					datagram.datasize = receivedSize - Datagram::HeaderSize;
-#if NETWORK_SIMULATOR
-					if (mSimulator.isEnabled())
-					{
-						// Push the datagram into the simulator
-						mSimulator.push(datagram, from);
-					}
-					else
-#endif
+					//!< Error handling
+					const auto err = Sockets::GetErrorCasted();
+					if (err != Sockets::Errors::WOULDBLOCK)
 					{
-						// Handle the datagram directly
-						if (auto client = getClient(from, true))
-							client->onDatagramReceived(std::move(datagram));
+						//!< Log that error
 					}
 				}
-				else
-				{
-					//!< Something is wrong, unexpected datagram
-					assert(0);
-				}
+				break;
+			}
+			mIOStats.receivedDatagrams += ret;
+			for (int i = 0; i < ret; ++i)
+				onDatagramReceived(mReceiveBuffers[i], static_cast<u16>(messages[i].msg_len), Address(senders[i]));
+			// A partial batch means the socket is drained, no need for another call
+			if (ret < UDP_IO_BATCH_SIZE)
+				break;
+		}
+#else
+		for (;;)
+		{
+			Datagram datagram;
+			Address from;
+			int ret = from.recvFrom(mSocket, reinterpret_cast<u8*>(&datagram), Datagram::BufferMaxSize);
+			++mIOStats.receiveCalls;
+			if (ret > 0)
+			{
+				++mIOStats.receivedDatagrams;
+				onDatagramReceived(datagram, static_cast<u16>(ret), from);
 			}
 			else
 			{
@@ -238,6 +424,7 @@ namespace Networking::UDP
 				break;
 			}
 		}
+#endif
 		// Poll pending datagrams from the simulator
 #if NETWORK_SIMULATOR
 		if (mSimulator.isEnabled())
@@ -250,6 +437,148 @@ namespace Networking::UDP
 			}
 		}
 #endif
+		if (mActiveShards > 1)
+		{
+			runShards([](Shard& shard)
+			{
+				for (auto& [client, datagram] : shard.received)
+					client->onDatagramReceived(std::move(datagram));
+				shard.received.clear();
+			});
+		}
+		flushMessages();
+	}
+
+	void Client::onDatagramReceived(Datagram& datagram, const u16 receivedSize, const Address& from)
+	{
+		if (receivedSize >= Datagram::HeaderSize)
+		{
+			datagram.datasize = receivedSize - Datagram::HeaderSize;
+#if NETWORK_SIMULATOR
+			if (mSimulator.isEnabled())
+			{
+				// Push the datagram into the simulator
+				mSimulator.push(datagram, from);
+			}
+			else
+#endif
+			{
+				// Handle the datagram directly, or let its shard handle it once the socket is drained
+				if (auto client = getClient(from, true))
+				{
+					if (mActiveShards > 1)
+						shardOf(*client).received.emplace_back(client, datagram);
+					else
+						client->onDatagramReceived(std::move(datagram));
+				}
+			}
+		}
+		else
+		{
+			//!< Something is wrong, unexpected datagram
+			assert(0);
+		}
+	}
+
+	void Client::queueDatagram(const DistantClient& client, const Datagram& dgram)
+	{
+		shardOf(client).outgoing.emplace_back(client.address(), dgram);
+	}
+
+	void Client::flushDatagrams(Shard& shard)
+	{
+#if UDP_BATCHED_IO
+		std::array<mmsghdr, UDP_IO_BATCH_SIZE> messages;
+		std::array<iovec, UDP_IO_BATCH_SIZE> buffers;
+		size_t first = 0;
+		while (first < shard.outgoing.size())
+		{
+			const size_t count = std::min<size_t>(shard.outgoing.size() - first, UDP_IO_BATCH_SIZE);
+			for (size_t i = 0; i < count; ++i)
+			{
+				auto& [target, dgram] = shard.outgoing[first + i];
+				buffers[i] = { &dgram, dgram.size() };
+				messages[i] = {};
+				messages[i].msg_hdr.msg_name = const_cast<sockaddr_storage*>(&target.storage());
+				messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+				messages[i].msg_hdr.msg_iov = &buffers[i];
+				messages[i].msg_hdr.msg_iovlen = 1;
+			}
+			const int ret = sendmmsg(mSocket, messages.data(), static_cast<unsigned int>(count), MSG_DONTWAIT);
+			++shard.stats.sendCalls;
+			if (ret <= 0)
+			{
+				const auto err = Sockets::GetErrorCasted();
+				if (ret == 0 || err == Sockets::Errors::WOULDBLOCK || err == Sockets::Errors::NOBUFS)
+					break; // The socket is full, the rest waits for the next pass
+				// Error : only the first datagram failed, like a failed sendto
+				++first;
+				continue;
+			}
+			shard.stats.sentDatagrams += ret;
+			first += ret;
+		}
+#else
+		size_t first = 0;
+		for (; first < shard.outgoing.size(); ++first)
+		{
+			const auto& [target, dgram] = shard.outgoing[first];
+			const int ret = target.sendTo(mSocket, reinterpret_cast<const char*>(&dgram), dgram.size());
+			++shard.stats.sendCalls;
+			if (ret < 0)
+			{
+				const auto err = Sockets::GetErrorCasted();
+				if (err == Sockets::Errors::WOULDBLOCK || err == Sockets::Errors::NOBUFS)
+					break; // The socket is full, the rest waits for the next pass
+				// Error
+				continue;
+			}
+			++shard.stats.sentDatagrams;
+		}
+#endif
+		shard.outgoing.erase(shard.outgoing.begin(), shard.outgoing.begin() + first);
+	}
+
+	void Client::wait(std::chrono::milliseconds maxTimeout, bool watchSocket)
+	{
+		std::chrono::milliseconds timeout = maxTimeout;
+		if (watchSocket && mNextDeadline != std::chrono::milliseconds::max())
+		{
+			const auto now = Utils::Now();
+			timeout = std::min(timeout, mNextDeadline > now ? mNextDeadline - now : std::chrono::milliseconds(0));
+		}
+#if NETWORK_SIMULATOR
+		// Delayed datagrams are only released by receive, don't sleep past them
+		if (watchSocket && mSimulator.isEnabled())
+			timeout = std::min(timeout, std::chrono::milliseconds(1));
+#endif
+
+		pollfd fds[2];
+		nfds_t count = 0;
+		if (mWakeUpSocket != INVALID_SOCKET)
+			fds[count++] = { mWakeUpSocket, POLLIN, 0 };
+		if (watchSocket && mSocket != INVALID_SOCKET)
+			fds[count++] = { mSocket, static_cast<short>(mOutgoingPending ? POLLIN | POLLOUT : POLLIN), 0 };
+		if (count == 0)
+		{
+			std::this_thread::sleep_for(timeout);
+			return;
+		}
+		if (::poll(fds, count, static_cast<int>(timeout.count())) > 0 && mWakeUpSocket != INVALID_SOCKET && fds[0].revents != 0)
+		{
+			// Drain the wake up datagrams, they don't carry anything
+			u8 buffer[8];
+			Address from;
+			while (from.recvFrom(mWakeUpSocket, buffer, sizeof(buffer)) >= 0) {}
+		}
+	}
+
+	void Client::wakeUp()
+	{
+		if (mWakeUpSocket == INVALID_SOCKET)
+			return;
+		const char data = 0;
+		mWakeUpAddress.sendTo(mWakeUpSocket, &data, 1);
 	}
 
 	std::vector<std::unique_ptr<Messages::Base>> Client::poll()
@@ -260,14 +589,35 @@ namespace Networking::UDP
 		return std::move(mMessages);
 	}
 
+	void Client::poll(std::vector<std::unique_ptr<Messages::Base>>& messages)
+	{
+#if NETWORK_THREAD_SAFE
+		MessagesLock lock(mMessagesLock);
+#endif
+		std::move(mMessages.begin(), mMessages.end(), std::back_inserter(messages));
+		mMessages.clear();
+	}
+
 	const Address& Client::GetClientAddress(u64 clientID)
 	{
-		for (auto& c : mClients)
-		{
-			if (c->id() != clientID) continue;
-			return c->address();
-		}
-		return mClients[0]->address();
+		static const Address InvalidAddress;
+		if (clientID < mClientsById.size() && mClientsById[clientID])
+			return mClientsById[clientID]->address();
+		return InvalidAddress;
+	}
+
+	DistantClient::Stats Client::GetClientStats(u64 clientID) const
+	{
+		if (clientID < mClientsById.size() && mClientsById[clientID])
+			return mClientsById[clientID]->stats();
+		return DistantClient::Stats();
+	}
+
+	DistantClient::Stats Client::GetClientStats(const Address& clientAddr)
+	{
+		if (DistantClient* cl = getClient(clientAddr))
+			return cl->stats();
+		return DistantClient::Stats();
 	}
 
 	bool Client::IsClientDisconnected(const Address& clientAddr)
@@ -278,14 +628,18 @@ namespace Networking::UDP
 
 	DistantClient* Client::getClient(const Address& clientAddr, bool create)
 	{
-		auto itClient = std::find_if(mClients.begin(), mClients.end(), [&](const std::unique_ptr<DistantClient>& client) { return client->address() == clientAddr; });
-		if (itClient != mClients.end())
-			return itClient->get();
+		auto itClient = mClientsByAddress.find(clientAddr);
+		if (itClient != mClientsByAddress.end())
+			return itClient->second;
 		else if (create)
 		{
 			mClients.emplace_back(std::make_unique<DistantClient>(*this, clientAddr, mClientIdsGenerator++));
-			setupChannels(*(mClients.back()));
-			return mClients.back().get();
+			DistantClient* client = mClients.back().get();
+			setupChannels(*client);
+			mClientsByAddress.emplace(clientAddr, client);
+			assert(client->id() == mClientsById.size());
+			mClientsById.push_back(client);
+			return client;
 		}
 		else
 			return nullptr;
@@ -299,10 +653,7 @@ namespace Networking::UDP
 
 	void Client::onMessageReady(std::unique_ptr<Messages::Base>&& msg)
 	{
-#if NETWORK_THREAD_SAFE
-		MessagesLock lock(mMessagesLock);
-#endif
-		mMessages.push_back(std::move(msg));
+		mShards[msg->emitterId() % mActiveShards].messages.push_back(std::move(msg));
 	}
 
 }
\ No newline at end of file
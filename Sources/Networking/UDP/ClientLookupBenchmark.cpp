@@ -0,0 +1,91 @@
+// Standalone benchmark of the distant client lookups done by Client for every received datagram
+// Excluded from the application build, built on its own with the address sources, on Windows as they use WinSock :
+//   cl /std:c++17 /O2 /EHsc /IHeaders Sources/Networking/UDP/ClientLookupBenchmark.cpp Sources/Networking/Address.cpp Sources/Networking/Sockets.cpp Sources/Networking/Errors.cpp Sources/Networking/Serialization/Conversion.cpp
+// Compares the former linear scan over the clients with the address and id indices Client keeps
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Networking/Address.hpp"
+
+using namespace Networking;
+
+namespace
+{
+	struct BenchClient
+	{
+		Address address;
+		u64 id = 0;
+	};
+
+	constexpr size_t LookupCount = 200000;
+
+	template <typename Lookup>
+	double MeasureNs(const std::vector<size_t>& targets, Lookup lookup)
+	{
+		u64 found = 0;
+		const auto start = std::chrono::steady_clock::now();
+		for (size_t target : targets)
+			found += lookup(target);
+		const auto end = std::chrono::steady_clock::now();
+		if (found != targets.size())
+			std::cout << "Lookup failed" << std::endl;
+		return std::chrono::duration<double, std::nano>(end - start).count() / targets.size();
+	}
+
+	void Run(size_t clientCount, std::mt19937& rng)
+	{
+		std::vector<std::unique_ptr<BenchClient>> clients;
+		std::unordered_map<Address, BenchClient*, Address::Hash> clientsByAddress;
+		std::vector<BenchClient*> clientsById;
+		std::uniform_int_distribution<u32> byte(0, 255);
+		std::uniform_int_distribution<u32> port(1024, 65535);
+		while (clients.size() < clientCount)
+		{
+			const std::string ip = "10." + std::to_string(byte(rng)) + "." + std::to_string(byte(rng)) + "." + std::to_string(byte(rng));
+			Address address(ip, static_cast<uint16_t>(port(rng)));
+			if (clientsByAddress.count(address))
+				continue;
+			clients.emplace_back(std::make_unique<BenchClient>(BenchClient{ address, clients.size() }));
+			clientsByAddress.emplace(address, clients.back().get());
+			clientsById.push_back(clients.back().get());
+		}
+
+		// Received datagrams come from random clients
+		std::vector<size_t> targets(LookupCount);
+		std::uniform_int_distribution<size_t> pick(0, clientCount - 1);
+		for (size_t& target : targets)
+			target = pick(rng);
+		// Copies, as the received datagrams carry their own address
+		std::vector<Address> addresses;
+		for (const auto& client : clients)
+			addresses.push_back(client->address);
+
+		const double linear = MeasureNs(targets, [&](size_t target) {
+			const Address& addr = addresses[target];
+			auto it = std::find_if(clients.begin(), clients.end(), [&](const std::unique_ptr<BenchClient>& client) { return client->address == addr; });
+			return it != clients.end();
+		});
+		const double hashed = MeasureNs(targets, [&](size_t target) {
+			return clientsByAddress.find(addresses[target]) != clientsByAddress.end();
+		});
+		const double byId = MeasureNs(targets, [&](size_t target) {
+			return target < clientsById.size() && clientsById[target] != nullptr;
+		});
+		std::cout << clientCount << " clients : linear " << linear << " ns, hashed " << hashed << " ns, by id " << byId << " ns" << std::endl;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(42);
+	for (size_t clientCount : { 10, 1000, 10000 })
+		Run(clientCount, rng);
+	return 0;
+}
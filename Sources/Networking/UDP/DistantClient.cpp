@@ -1,5 +1,7 @@
 #include "Networking/UDP/DistantClient.hpp"
 
+#include <algorithm>
+
 #include "Networking/Messages.hpp"
 #include "Networking/Utils.hpp"
 #include "Networking/UDP/Client.hpp"
@@ -9,7 +11,7 @@ namespace Networking::UDP
 	std::chrono::milliseconds DistantClient::sTimeout = UDP_TIMEOUT;
 
 	DistantClient::DistantClient(Client& client, const Address& address, u64 clientID) : 
-		mClient(client), mAddress(address), mClientId(clientID), mConnectionStartTime(Utils::Now()), mLastKeepAlive(Utils::Now())
+		mClient(client), mAddress(address), mClientId(clientID), mConnectionStartTime(Utils::Now()), mLastKeepAlive(Utils::Now()), mLastDatagramSent(Utils::Now()), mLastPacingRefill(Utils::Now())
 	{
 	}
 
@@ -18,6 +20,7 @@ namespace Networking::UDP
 		if (mState == State::None)
 		{
 			mState = State::ConnectionSent;
+			mShouldAck = true; // Send the request right away
 			maintainConnection();
 		}
 		else if (mState == State::ConnectionReceived)
@@ -33,6 +36,12 @@ namespace Networking::UDP
 		mChannelsHandler.queue(std::move(data), canalIndex);
 	}
 
+	void DistantClient::send(const SharedData& data, u32 canalIndex)
+	{
+		onConnectionSent();
+		mChannelsHandler.queue(data, canalIndex);
+	}
+
 	void DistantClient::fillDatagramHeader(Datagram& dgram, Datagram::Type type)
 	{
 		dgram.header.ack = htons(mReceivedAcks.lastAck());
@@ -44,11 +53,169 @@ namespace Networking::UDP
 
 	void DistantClient::send(const Datagram& dgram)
 	{
-		int ret = mAddress.sendTo(mClient.mSocket, reinterpret_cast<const char*>(&dgram), dgram.size());
-		if (ret < 0)
+		mClient.queueDatagram(*this, dgram);
+		// Every datagram carries our acks
+		mLastDatagramSent = Utils::Now();
+		mShouldAck = false;
+		// Only data is worth retransmitting, and it is acked right away unlike keep alives
+		if (dgram.header.type == Datagram::Type::ConnectedData)
+		{
+			onDatagramSent(ntohs(dgram.header.id), mLastDatagramSent);
+			mPacingTokens -= dgram.size();
+		}
+	}
+
+	void DistantClient::onDatagramSent(Datagram::ID datagramId, std::chrono::milliseconds now)
+	{
+		SentDatagram& sent = mSentDatagrams[datagramId % SentDatagramsRingSize];
+		// The slot is reused : a datagram still pending that long ago won't be acked anymore
+		if (sent.pending && sent.id != datagramId)
 		{
-			// Error
+			sent.pending = false;
+			onDataDatagramLost(sent.id);
 		}
+		sent.id = datagramId;
+		sent.sentTime = now;
+		sent.pending = true;
+		++mInFlight;
+		++mSentDataDatagrams;
+	}
+
+	void DistantClient::onDataDatagramAcked(Datagram::ID datagramId)
+	{
+		--mInFlight;
+		mConsecutiveTimeouts = 0;
+		// The first datagram sent after the window reduction is acked : the recovery is over
+		if (mInRecovery && !Utils::IsSequenceNewer(mRecoveryStart, datagramId))
+			mInRecovery = false;
+		// Only grow while the window is actually used, an idle connection must not be allowed a huge burst
+		if (2 * (mInFlight + 1) < mCongestionWindow || mCongestionWindow >= SentDatagramsRingSize)
+			return;
+		if (mCongestionWindow < mSlowStartThreshold)
+		{
+			++mCongestionWindow;
+		}
+		else if (++mCongestionAvoidanceAcks >= mCongestionWindow)
+		{
+			++mCongestionWindow;
+			mCongestionAvoidanceAcks = 0;
+		}
+	}
+
+	void DistantClient::onDataDatagramLost(Datagram::ID datagramId)
+	{
+		--mInFlight;
+		++mLostDataDatagrams;
+		// Reduce the window once per congestion event : losses of datagrams sent before the reduction don't count again
+		// Like CUBIC, it is cut by 30% rather than halved so that random losses of wireless links don't starve the connection
+		if (!mInRecovery || !Utils::IsSequenceNewer(mRecoveryStart, datagramId))
+		{
+			mSlowStartThreshold = std::max<u32>(mCongestionWindow * 7 / 10, UDP_MIN_CWND);
+			mCongestionWindow = mSlowStartThreshold;
+			mCongestionAvoidanceAcks = 0;
+			mInRecovery = true;
+			mRecoveryStart = mNextDatagramIdToSend;
+		}
+		onDatagramSentLost(datagramId);
+	}
+
+	void DistantClient::onRetransmitTimeout()
+	{
+		// A single timeout is often a lost ack and already reduced the window as a loss
+		// Timeouts following each other without any ack mean persistent congestion : restart from a minimal window
+		if (++mConsecutiveTimeouts >= 2)
+		{
+			mCongestionWindow = UDP_MIN_CWND;
+			mCongestionAvoidanceAcks = 0;
+			mInRecovery = true;
+			mRecoveryStart = mNextDatagramIdToSend;
+		}
+		// Back off until an ack brings a new sample, the link may be congested or gone
+		mRetransmitTimeout = std::min<std::chrono::milliseconds>(2 * mRetransmitTimeout, UDP_MAX_RTO);
+	}
+
+	u64 DistantClient::pacingRate() const
+	{
+		// Sends the window over a round trip, faster while in slow start so that the window can keep growing
+		const s64 rtt = std::max<s64>(mSmoothedRtt.count(), 1000);
+		const u64 window = static_cast<u64>(mCongestionWindow) * Datagram::BufferMaxSize;
+		const u64 gainInQuarters = (mCongestionWindow < mSlowStartThreshold) ? 8 : 5; // x2 in slow start, x1.25 otherwise
+		return window * gainInQuarters * 1000000 / (4 * rtt);
+	}
+
+	bool DistantClient::canSendData(std::chrono::milliseconds now)
+	{
+		mPacingLimited = false;
+		if (mInFlight >= mCongestionWindow)
+			return false;
+		const auto elapsed = std::min<std::chrono::milliseconds>(now - mLastPacingRefill, std::chrono::seconds(1));
+		if (elapsed.count() > 0)
+		{
+			const u64 rate = pacingRate();
+			const s64 capacity = std::max<s64>(UDP_PACING_BURST * Datagram::BufferMaxSize, rate / 1000);
+			mPacingTokens = std::min<s64>(capacity, mPacingTokens + static_cast<s64>(rate * elapsed.count() / 1000));
+			mLastPacingRefill = now;
+		}
+		mPacingLimited = (mPacingTokens <= 0);
+		return !mPacingLimited;
+	}
+
+	DistantClient::Stats DistantClient::stats() const
+	{
+		Stats stats;
+		stats.congestionWindow = mCongestionWindow;
+		stats.slowStartThreshold = mSlowStartThreshold;
+		stats.inFlight = mInFlight;
+		stats.pacingRate = pacingRate();
+		stats.rtt = rtt();
+		stats.retransmitTimeout = mRetransmitTimeout;
+		stats.sentDatagrams = mSentDataDatagrams;
+		stats.lostDatagrams = mLostDataDatagrams;
+		stats.unsentBytes = mChannelsHandler.unsentBytes();
+		return stats;
+	}
+
+	void DistantClient::onRttSample(std::chrono::milliseconds rtt)
+	{
+		// RFC 6298
+		const std::chrono::microseconds sample = rtt;
+		if (mSmoothedRtt.count() == 0 && mRttVariation.count() == 0)
+		{
+			mSmoothedRtt = sample;
+			mRttVariation = sample / 2;
+		}
+		else
+		{
+			const auto deviation = mSmoothedRtt > sample ? mSmoothedRtt - sample : sample - mSmoothedRtt;
+			mRttVariation = (3 * mRttVariation + deviation) / 4;
+			mSmoothedRtt = (7 * mSmoothedRtt + sample) / 8;
+		}
+		const auto rto = std::chrono::duration_cast<std::chrono::milliseconds>(mSmoothedRtt + std::max<std::chrono::microseconds>(std::chrono::milliseconds(1), 4 * mRttVariation));
+		mRetransmitTimeout = std::clamp<std::chrono::milliseconds>(rto, UDP_MIN_RTO, UDP_MAX_RTO);
+	}
+
+	void DistantClient::detectLostDatagrams(std::chrono::milliseconds now)
+	{
+		const Datagram::ID lastAck = mSentAcks.lastAck();
+		// A datagram followed by an acked one is also lost once it waited a bit longer than a round trip, small windows may never get enough acks after it
+		const auto reorderingDelay = std::chrono::duration_cast<std::chrono::milliseconds>(mSmoothedRtt * 9 / 8) + std::chrono::milliseconds(1);
+		bool timedOut = false;
+		for (; mOldestSentDatagram != mNextDatagramIdToSend; ++mOldestSentDatagram)
+		{
+			SentDatagram& sent = mSentDatagrams[mOldestSentDatagram % SentDatagramsRingSize];
+			if (sent.id != mOldestSentDatagram || !sent.pending)
+				continue; // Acked, already reported or not worth tracking
+			const bool fastRetransmit = Utils::IsSequenceNewer(lastAck, sent.id)
+				&& (Utils::SequenceDiff(lastAck, sent.id) >= UDP_FAST_RETRANSMIT_THRESHOLD || now >= sent.sentTime + reorderingDelay);
+			const bool expired = now >= sent.sentTime + mRetransmitTimeout;
+			if (!fastRetransmit && !expired)
+				break;
+			timedOut |= !fastRetransmit;
+			sent.pending = false;
+			onDataDatagramLost(sent.id);
+		}
+		if (timedOut)
+			onRetransmitTimeout();
 	}
 
 	void DistantClient::processSend(const u8 maxDatagrams)
@@ -57,8 +224,10 @@ namespace Networking::UDP
 		// We do send data during connection process in order to keep it available before we accept it
 		if (isConnecting() || isConnected())
 		{
+			// Lost data is queued again before serializing, so it goes out first
+			detectLostDatagrams(now);
 #if NETWORK_INTERRUPTION
-			if (mClient.isNetworkInterrupted())
+			if (mClient.isNetworkInterrupted() && isKeepAliveDue(now))
 			{
 				// Since the network is interrupted, send a keep alive to let the client know that
 				Datagram datagram;
@@ -69,11 +238,16 @@ namespace Networking::UDP
 			for (size_t loop = 0; maxDatagrams == 0 || loop < maxDatagrams; ++loop)
 			{
 				Datagram datagram;
-				datagram.datasize = mChannelsHandler.serialize(datagram.data.data(), Datagram::DataMaxSize, mNextDatagramIdToSend
+				// Don't overwrite the tracking of datagrams still in flight, they would be considered lost and resent over and over
+				// Then let the congestion window and the pacing decide whether data can go now, acks and keep alives are always sent
+				if (Utils::SequenceDiff(mNextDatagramIdToSend, mOldestSentDatagram) < SentDatagramsRingSize && canSendData(now))
+				{
+					datagram.datasize = mChannelsHandler.serialize(datagram.data.data(), Datagram::DataMaxSize, mNextDatagramIdToSend
 #if NETWORK_INTERRUPTION
-					, mClient.isNetworkInterrupted()
+						, mClient.isNetworkInterrupted()
 #endif
-				);
+					);
+				}
 				if (datagram.datasize > 0)
 				{
 					fillDatagramHeader(datagram, Datagram::Type::ConnectedData);
@@ -81,7 +255,7 @@ namespace Networking::UDP
 				}
 				else
 				{
-					const bool sendKeepAlive = (loop == 0)
+					const bool sendKeepAlive = (loop == 0) && isKeepAliveDue(now)
 #if NETWORK_INTERRUPTION
 						&& !mClient.isNetworkInterrupted()
 #endif
@@ -128,7 +302,7 @@ namespace Networking::UDP
 				}
 				mState = State::Disconnected;
 			}
-			else if (mDisconnectionReason != DisconnectionReason::None && mDisconnectionReason != DisconnectionReason::Lost)
+			else if (mDisconnectionReason != DisconnectionReason::None && mDisconnectionReason != DisconnectionReason::Lost && isKeepAliveDue(now))
 			{
 				// Send disconnection datagrams while disconnecting to inform the other end that's a normal termination
 				Datagram datagram;
@@ -147,6 +321,42 @@ namespace Networking::UDP
 		}
 	}
 
+	std::chrono::milliseconds DistantClient::nextDeadline() const
+	{
+		if (isDisconnecting())
+		{
+			const auto disconnectionTime = mLastKeepAlive + 2 * GetTimeout();
+			if (mDisconnectionReason != DisconnectionReason::None && mDisconnectionReason != DisconnectionReason::Lost)
+				return std::min(disconnectionTime, mShouldAck ? Utils::Now() : mLastDatagramSent + UDP_KEEPALIVE_INTERVAL);
+			return disconnectionTime;
+		}
+		if (!isConnecting() && !isConnected())
+			return std::chrono::milliseconds::max();
+		if (mShouldAck)
+			return Utils::Now();
+		std::chrono::milliseconds deadline = mLastDatagramSent + UDP_KEEPALIVE_INTERVAL;
+		// Retransmission timer of the oldest datagram still waiting for its ack
+		const SentDatagram& oldest = mSentDatagrams[mOldestSentDatagram % SentDatagramsRingSize];
+		if (mOldestSentDatagram != mNextDatagramIdToSend && oldest.id == mOldestSentDatagram && oldest.pending)
+			deadline = std::min(deadline, oldest.sentTime + mRetransmitTimeout);
+		// Data is waiting for the pacing
+		if (mPacingLimited)
+		{
+			const u64 rate = std::max<u64>(pacingRate(), 1);
+			deadline = std::min(deadline, mLastPacingRefill + std::chrono::milliseconds(1 + static_cast<u64>(-mPacingTokens) * 1000 / rate));
+		}
+		if (isConnecting())
+			deadline = std::min(deadline, mConnectionStartTime + GetTimeout());
+		else if (isConnected()
+#if NETWORK_INTERRUPTION
+			// Already interrupted, it stays so until something is received
+			&& !mInterrupted
+#endif
+			)
+			deadline = std::min(deadline, mLastKeepAlive + GetTimeout());
+		return deadline;
+	}
+
 	void DistantClient::fillKeepAlive(Datagram& dgram)
 	{
 		fillDatagramHeader(dgram, Datagram::Type::KeepAlive);
@@ -166,9 +376,9 @@ namespace Networking::UDP
 
 	void DistantClient::handleKeepAlive(const u8* data, const u16 datasize)
 	{
-		std::vector<u8> content = std::vector<u8>(datasize);
-		memcpy(content.data(), data, datasize);
-		u8 isConnectedKeepAlive = content[0];
+		if (datasize == 0)
+			return;
+		const u8 isConnectedKeepAlive = data[0];
 		if (isConnectedKeepAlive & 0x01)
 		{
 			if (mState == State::None || isConnecting())
@@ -180,7 +390,7 @@ namespace Networking::UDP
 #if NETWORK_INTERRUPTION
 		bool isNetworkInterruptedOnTheOtherEnd = false;
 		// Retrieve whether the other side has its connection interrupted and we should locally interrupt it too
-		isNetworkInterruptedOnTheOtherEnd = content.size() > 0 && isConnectedKeepAlive & 0x02;
+		isNetworkInterruptedOnTheOtherEnd = isConnectedKeepAlive & 0x02;
 		// Always consider the connection OK when a keep alive is received, but do keep in mind the network may be interrupted because it's interrupted on the other end.
 		maintainConnection(isNetworkInterruptedOnTheOtherEnd);
 #else
@@ -193,8 +403,8 @@ namespace Networking::UDP
 		const auto datagramid = ntohs(datagram.header.id);
 		//!< Update the received acks tracking
 		mReceivedAcks.update(datagramid, 0, true);
-		//!< Update the send acks tracking
-		mSentAcks.update(ntohs(datagram.header.ack), datagram.header.previousAcks, true);
+		//!< Update the send acks tracking, losses are detected by detectLostDatagrams
+		mSentAcks.update(ntohs(datagram.header.ack), datagram.header.previousAcks);
 		//!< Ignore duplicate
 		if (!mReceivedAcks.isNewlyAcked(datagramid))
 		{
@@ -202,27 +412,35 @@ namespace Networking::UDP
 		}
 
 		//!< Handle loss on reception
-		const auto lostDatagrams = mReceivedAcks.loss();
-		for (const auto receivedLostDatagram : lostDatagrams)
+		for (const auto receivedLostDatagram : mReceivedAcks.loss())
 		{
 			onDatagramReceivedLost(receivedLostDatagram);
 		}
-		//!< Handle loss on send
-		const auto datagramsSentLost = mSentAcks.loss();
-		for (const auto sendLoss : datagramsSentLost)
-		{
-			onDatagramSentLost(sendLoss);
-		}
+		mReceivedAcks.loss().clear();
 		//!< Mark new send acked
-		const auto datagramsSentAcked = mSentAcks.getNewAcks();
-		for (const auto sendAcked : datagramsSentAcked)
+		const auto now = Utils::Now();
+		mSentAcks.getNewAcks(mNewAcks);
+		for (const auto sendAcked : mNewAcks)
 		{
+			SentDatagram& sent = mSentDatagrams[sendAcked % SentDatagramsRingSize];
+			if (sent.id == sendAcked && sent.pending)
+			{
+				sent.pending = false;
+				onDataDatagramAcked(sendAcked);
+				// Older datagrams of the mask are acked late, only the last one gives an accurate round trip time
+				if (sendAcked == mSentAcks.lastAck())
+					onRttSample(now - sent.sentTime);
+			}
+			// Even when reported lost already, acking the datagram spares resending what it carried
 			onDatagramSentAcked(sendAcked);
 		}
+		//!< Handle loss on send
+		detectLostDatagrams(now);
 		switch (datagram.header.type)
 		{
 		case Datagram::Type::ConnectedData:
 		{
+			mShouldAck = true;
 			//!< Dispatch data
 			onDataReceived(datagram.data.data(), datagram.datasize);
 		} break;
@@ -256,8 +474,9 @@ namespace Networking::UDP
 		// If we receive data, the other end is requesting a connection
 		onConnectionReceived();
 		mChannelsHandler.onDataReceived(data, datasize);
-		auto receivedMessages = mChannelsHandler.process(isConnected());
-		for (auto&& [channelId, msg] : receivedMessages)
+		mReceivedMessages.clear();
+		mChannelsHandler.process(isConnected(), mReceivedMessages);
+		for (auto&& [channelId, msg] : mReceivedMessages)
 		{
 			onMessageReady(std::make_unique<Messages::UserData>(mAddress, mClientId, std::move(msg), channelId));
 		}
@@ -317,6 +536,7 @@ namespace Networking::UDP
 	void DistantClient::onConnected()
 	{
 		mState = State::Connected;
+		mShouldAck = true; // Let the other end know without waiting for the next keep alive
 		maintainConnection();
 		onMessageReady(std::make_unique<Messages::Connection>(mAddress, mClientId, Messages::Connection::Result::Success));
 		// Transfert des messages en attente!
@@ -331,6 +551,7 @@ namespace Networking::UDP
 		if (mState == State::None)
 		{
 			mState = State::ConnectionReceived;
+			mShouldAck = true;
 			maintainConnection();
 			// Push incoming connection request to client
 			mClient.onMessageReady(std::make_unique<Messages::IncomingConnection>(mAddress, mClientId));
@@ -0,0 +1,100 @@
+// Standalone benchmark of the heap allocations made per message on the reliable stream, from the sending call to the polled UserData
+// Excluded from the application build, built on its own with the networking sources, on Windows as they use WinSock :
+//   cl /std:c++17 /O2 /EHsc /IHeaders Sources/Networking/UDP/MessageAllocationBenchmark.cpp Sources/Networking/*.cpp Sources/Networking/UDP/AckHandler.cpp Sources/Networking/UDP/ChannelsHandler.cpp Sources/Networking/UDP/Client.cpp Sources/Networking/UDP/DistantClient.cpp Sources/Networking/UDP/Simulator.cpp Sources/Networking/UDP/Protocols/*.cpp Sources/Networking/Serialization/*.cpp Sources/Core/BufferPool.cpp Sources/Core/Signal.cpp Sources/Core/ThreadPool.cpp
+// Counts the calls to operator new while a client and a server on the loopback exchange messages one at a time
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "Networking/Messages.hpp"
+#include "Networking/Sockets.hpp"
+#include "Networking/UDP/Client.hpp"
+#include "Networking/UDP/Protocols/ReliableStream.hpp"
+
+using namespace Networking;
+
+namespace
+{
+	std::atomic<u64> allocationCount{ 0 };
+
+	constexpr int MessageCount = 2000;
+
+	// Allocations per message, once the first half of the messages warmed the pools up
+	double Measure(u16 port, size_t messageSize)
+	{
+		UDP::Client server;
+		UDP::Client client;
+		server.registerChannel<UDP::Protocols::ReliableStream>();
+		client.registerChannel<UDP::Protocols::ReliableStream>();
+		if (!server.init(port) || !client.init(0))
+			return -1.0;
+		const Address serverAddress = Address::Loopback(Address::Type::IPv4, port);
+		client.connect(serverAddress);
+
+		std::vector<u8> payload(messageSize, 7);
+		std::vector<std::unique_ptr<Messages::Base>> serverMessages;
+		std::vector<std::unique_ptr<Messages::Base>> clientMessages;
+		bool connected = false;
+		int received = 0;
+		int sent = 0;
+		u64 firstCount = 0;
+		for (int i = 0; received < MessageCount && i < 10000000; i++)
+		{
+			if (received == MessageCount / 2 && firstCount == 0)
+				firstCount = allocationCount.load();
+			client.receive();
+			server.receive();
+			serverMessages.clear();
+			server.poll(serverMessages);
+			for (auto& message : serverMessages)
+			{
+				if (message->is<Messages::IncomingConnection>())
+					server.connect(message->emitter());
+				else if (message->is<Messages::UserData>())
+					received++;
+			}
+			clientMessages.clear();
+			client.poll(clientMessages);
+			for (auto& message : clientMessages)
+				connected |= message->is<Messages::Connection>();
+			if (connected && sent == received)
+			{
+				client.sendTo(serverAddress, payload.data(), payload.size(), 0);
+				sent++;
+			}
+			client.processSend();
+			server.processSend();
+		}
+		server.release();
+		client.release();
+		if (received < MessageCount)
+			return -1.0;
+		return double(allocationCount.load() - firstCount) / (MessageCount - MessageCount / 2);
+	}
+}
+
+void* operator new(size_t size)
+{
+	allocationCount++;
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+int main()
+{
+	if (!Networking::Start())
+		return 1;
+	u16 port = 40124;
+	for (size_t messageSize : { 100, 5000, 100000 })
+		std::cout << messageSize << " B : " << Measure(port++, messageSize) << " allocations per message" << std::endl;
+	Networking::Release();
+	return 0;
+}
@@ -1,39 +1,70 @@
 #include "Networking/UDP/Protocols/ReliableOrdered.hpp"
 
 #include <assert.h>
+#include <iostream>
 
 #include "Networking/Utils.hpp"
+#include "Core/BufferPool.hpp"
 
 namespace Networking::UDP::Protocols
 {
-	void ReliableOrdered::RMultiplexer::queue(std::vector<u8>& msgData)
+	u16 ReliableOrdered::sWindowSize = UDP_RELIABLE_WINDOW;
+
+	void ReliableOrdered::SetWindowSize(u16 packets)
+	{
+		assert(packets >= Packet::MaxPacketsPerMessage && (packets & (packets - 1)) == 0);
+		sWindowSize = packets;
+	}
+
+	ReliableOrdered::RMultiplexer::ReliablePacket::ReliablePacket(Packet::ID id, Packet::Type type, const SharedData& data, size_t offset, u16 size)
+		: mData(data)
+		, mOffset(offset)
 	{
-		assert(msgData.size() <= Packet::MaxMessageSize);
-		if (msgData.size() > Packet::DataMaxSize)
+		mHeader.id = id;
+		mHeader.type = type;
+		mHeader.size = size;
+	}
+
+	void ReliableOrdered::RMultiplexer::ReliablePacket::write(u8* buffer) const
+	{
+		memcpy(buffer, &mHeader, Packet::HeaderSize);
+		memcpy(buffer + Packet::HeaderSize, mData->data() + mOffset, mHeader.size);
+	}
+
+	void ReliableOrdered::RMultiplexer::queue(const SharedData& msgData)
+	{
+		// Packets only reference the message : they are created once the window reaches them, and its data copied when serialized
+		if (msgData->size() > mMaxMessageSize)
 		{
-			u16 queuedSize = 0;
-			while (queuedSize < msgData.size())
-			{
-				const auto fragmentSize = std::min(Packet::DataMaxSize, static_cast<uint16_t>(msgData.size() - queuedSize));
-				mQueue.resize(mQueue.size() + 1);
-				Packet& packet = mQueue.back().packet();
-				packet.mHeader.id = mNextId++;
-				packet.mHeader.type = ((queuedSize == 0) ? Packet::Type::FirstFragment : Packet::Type::Fragment);
-				packet.mHeader.size = fragmentSize;
-				memcpy(packet.data(), msgData.data() + queuedSize, fragmentSize);
-				queuedSize += fragmentSize;
-			}
-			mQueue.back().packet().mHeader.type = Packet::Type::LastFragment;
-			assert(queuedSize == msgData.size());
+			// The receiver would drop it, larger contents are to be split by the application
+			std::cout << "Message of " << msgData->size() << " bytes over the channel limit, dropped" << std::endl;
+			return;
 		}
-		else
+		mPendingMessages.push_back(msgData);
+		mUnsentBytes += msgData->size();
+	}
+
+	void ReliableOrdered::RMultiplexer::fillQueue()
+	{
+		while (!mPendingMessages.empty() && Utils::SequenceDiff(mNextId, mFirstAllowedPacket) < sWindowSize)
 		{
-			mQueue.resize(mQueue.size() + 1);
-			Packet& packet = mQueue.back().packet();
-			packet.mHeader.id = mNextId++;
-			packet.mHeader.type = Packet::Type::FullMessage;
-			packet.mHeader.size = static_cast<uint16_t>(msgData.size());
-			memcpy(packet.data(), msgData.data(), msgData.size());
+			const SharedData& msgData = mPendingMessages.front();
+			if (msgData->size() <= Packet::DataMaxSize)
+			{
+				mQueue.emplace_back(mNextId++, Packet::Type::FullMessage, msgData, 0, static_cast<u16>(msgData->size()));
+				mPendingMessages.pop_front();
+				continue;
+			}
+			const u16 fragmentSize = static_cast<u16>(std::min<size_t>(Packet::DataMaxSize, msgData->size() - mPendingOffset));
+			const bool isLast = (mPendingOffset + fragmentSize == msgData->size());
+			const Packet::Type type = (mPendingOffset == 0) ? Packet::Type::FirstFragment : (isLast ? Packet::Type::LastFragment : Packet::Type::Fragment);
+			mQueue.emplace_back(mNextId++, type, msgData, mPendingOffset, fragmentSize);
+			mPendingOffset += fragmentSize;
+			if (isLast)
+			{
+				mPendingMessages.pop_front();
+				mPendingOffset = 0;
+			}
 		}
 	}
 
@@ -49,48 +80,104 @@ namespace Networking::UDP::Protocols
 			return 0;
 #endif
 		u16 serializedSize = 0;
-		for (auto& packetHolder : mQueue)
+		SentDatagram& sent = mSentDatagrams[datagramId % SentDatagramsRingSize];
+		if (sent.id != datagramId)
+		{
+			// The slot is reused : a datagram still pending that long ago won't be acked anymore
+			if (sent.pending)
+				onPacketsLost(sent);
+			sent.id = datagramId;
+			sent.pending = false;
+			sent.packets.clear();
+		}
+		auto Write = [&](ReliablePacket& packet)
 		{
-			//!< Sassurer avant tout que le paquet est dans les bornes denvoi, sinon on peut arrter ditrer sur notre file
-			if (!(Utils::SequenceDiff(packetHolder.packet().id(), mFirstAllowedPacket) < RDemultiplexer::QueueSize))
+			const u16 packetSize = packet.size();
+			if (serializedSize + packetSize > buffersize)
+				return false;
+			packet.write(buffer);
+			serializedSize += packetSize;
+			buffer += packetSize;
+			packet.onSent();
+			sent.packets.push_back(packet.id());
+			sent.pending = true;
+			return true;
+		};
+		// Lost packets first, they block the ordered processing on the other end
+		while (!mResendQueue.empty())
+		{
+			ReliablePacket* packet = find(mResendQueue.front());
+			if (packet && packet->shouldSend() && !Write(*packet))
 				break;
-			if (!packetHolder.shouldSend())
-				continue;
-			const auto& packet = packetHolder.packet();
-			if (serializedSize + packet.size() > buffersize)
-				continue; //!< Si le paquet est trop gros, essayons dinclure les suivants
+			mResendQueue.pop_front();
+		}
+		// Then the packets never sent yet, as long as they're within the sending bounds
+		fillQueue();
+		for (; mNextNewPacket < mQueue.size(); ++mNextNewPacket)
+		{
+			ReliablePacket& packet = mQueue[mNextNewPacket];
+			if (!(Utils::SequenceDiff(packet.id(), mFirstAllowedPacket) < sWindowSize))
+				break;
+			if (!Write(packet))
+				break;
+			mUnsentBytes -= packet.dataSize();
+		}
+		return serializedSize;
+	}
 
-			memcpy(buffer, packet.buffer(), packet.size());
-			serializedSize += packet.size();
-			buffer += packet.size();
+	ReliableOrdered::RMultiplexer::ReliablePacket* ReliableOrdered::RMultiplexer::find(Packet::ID packetId)
+	{
+		if (mQueue.empty() || Utils::IsSequenceNewer(mQueue.front().id(), packetId))
+			return nullptr;
+		const size_t index = Utils::SequenceDiff(packetId, mQueue.front().id());
+		return index < mQueue.size() ? &mQueue[index] : nullptr;
+	}
 
-			packetHolder.onSent(datagramId);
+	void ReliableOrdered::RMultiplexer::onPacketsLost(SentDatagram& datagram)
+	{
+		for (const Packet::ID packetId : datagram.packets)
+		{
+			ReliablePacket* packet = find(packetId);
+			if (packet && !packet->isAcked() && !packet->shouldSend())
+			{
+				packet->resend();
+				mResendQueue.push_back(packetId);
+			}
 		}
-		return serializedSize;
+		datagram.pending = false;
 	}
 
 	void ReliableOrdered::RMultiplexer::onDatagramAcked(Datagram::ID datagramId)
 	{
-		if (mQueue.empty())
+		SentDatagram& sent = mSentDatagrams[datagramId % SentDatagramsRingSize];
+		// A datagram reported lost may still be acked later on : its packets don't need to be resent anymore
+		if (sent.id != datagramId || sent.packets.empty())
 			return;
 
-		mQueue.erase(std::remove_if(mQueue.begin(), mQueue.end()
-			, [&](const ReliablePacket& packetHolder) { return packetHolder.isIncludedIn(datagramId); })
-			, mQueue.cend());
+		for (const Packet::ID packetId : sent.packets)
+		{
+			if (ReliablePacket* packet = find(packetId))
+				packet->onAcked();
+		}
+		sent.pending = false;
+		// Acked packets are only dropped from the front so that the queue stays indexed by id
+		while (!mQueue.empty() && mQueue.front().isAcked())
+		{
+			mQueue.pop_front();
+			if (mNextNewPacket > 0)
+				--mNextNewPacket;
+		}
 		if (mQueue.empty())
 			mFirstAllowedPacket = mNextId; //!< Si la file est maintenant vide, la borne commence au prochain paquet mis en file
-		else if (Utils::IsSequenceNewer(mQueue.front().packet().id(), mFirstAllowedPacket))
-			mFirstAllowedPacket = mQueue.front().packet().id(); // Sinon, on dplace les bornes denvoi au plus ancien paquet en file
+		else if (Utils::IsSequenceNewer(mQueue.front().id(), mFirstAllowedPacket))
+			mFirstAllowedPacket = mQueue.front().id(); // Sinon, on dplace les bornes denvoi au plus ancien paquet en file
 	}
 
-
 	void ReliableOrdered::RMultiplexer::onDatagramLost(Datagram::ID datagramId)
 	{
-		for (auto& packetHolder : mQueue)
-		{
-			if (packetHolder.isIncludedIn(datagramId))
-				packetHolder.resend();
-		}
+		SentDatagram& sent = mSentDatagrams[datagramId % SentDatagramsRingSize];
+		if (sent.id == datagramId && sent.pending)
+			onPacketsLost(sent);
 	}
 
 	void ReliableOrdered::RDemultiplexer::onDataReceived(const u8* data, u16 datasize)
@@ -115,118 +202,111 @@ namespace Networking::UDP::Protocols
 	{
 		if (!Utils::IsSequenceNewer(pckt->id(), mLastProcessed))
 			return; //!< Paquet obsolte
+		if (mWindow.empty())
+			mWindow.resize(sWindowSize);
+		if (Utils::SequenceDiff(pckt->id(), mLastProcessed) > mWindow.size())
+			return; // Out of the window, the sender is not supposed to send it yet
 
-		//!< Calcul de lindex dans le tableau
-		const size_t index = pckt->id() % mPendingQueue.size();
-		Packet& pendingPacket = mPendingQueue[index];
-		if (pendingPacket.datasize() == 0)
+		std::unique_ptr<Packet>& pendingPacket = slot(pckt->id());
+		if (!pendingPacket)
 		{
-			// Emplacement disponible, copier simplement les donnes du rseau dans notre tableau
-			pendingPacket = *pckt;
+			// Emplacement disponible, copier les donnes du rseau dans un paquet recycl si possible
+			if (mFreePackets.empty())
+				pendingPacket = std::make_unique<Packet>();
+			else
+			{
+				pendingPacket = std::move(mFreePackets.back());
+				mFreePackets.pop_back();
+			}
+			memcpy(pendingPacket.get(), pckt, pckt->size());
 		}
 		else
 		{
 			// Emplacement NON disponible, sassurer quil contient dj notre paquet, sinon il y a un problme
-			assert(pendingPacket.id() == pckt->id() && pendingPacket.datasize() == pckt->datasize());
+			assert(pendingPacket->id() == pckt->id() && pendingPacket->datasize() == pckt->datasize());
 		}
 	}
 
-	std::vector<std::vector<u8>> ReliableOrdered::RDemultiplexer::process()
+	void ReliableOrdered::RDemultiplexer::releasePacket(std::unique_ptr<Packet>& packet)
 	{
-		//!< Fonction de rinitialisation dun paquet
-		auto ResetPacket = [](Packet& pckt) { pckt.mHeader.size = 0; };
-		auto IsPacketValid = [](const Packet& pckt) { return pckt.mHeader.size != 0; };
-		std::vector<std::vector<u8>> messagesReady;
+		// Keep enough packets to rebuild a full message without allocating
+		if (mFreePackets.size() < Packet::MaxPacketsPerMessage)
+			mFreePackets.push_back(std::move(packet));
+		else
+			packet.reset();
+	}
 
-		Packet::ID expectedPacketId = mLastProcessed + 1;
-		//!< Il faut itrer sur notre tableau en commenant par le paquet attendu, qui peut ne pas tre en index 0
-		const size_t startIndexOffset = expectedPacketId % mPendingQueue.size();
-		for (size_t i = 0; i < mPendingQueue.size(); i++, expectedPacketId++)
+	void ReliableOrdered::RDemultiplexer::appendToMessage(const Packet& packet)
+	{
+		// Messages are built in pooled buffers : they usually go back to the pool once the application is done with them
+		const size_t size = mPartialMessage.size() + packet.datasize();
+		if (size > mPartialMessage.capacity())
 		{
-			//!< On calcule lindex dans notre tableau du prochain paquet  traiter
-			const size_t packetIndex = (i + startIndexOffset) % mPendingQueue.size();
-			Packet& packet = mPendingQueue[packetIndex];
-			if (!IsPacketValid(packet))
-				break;
-			if (packet.type() == Packet::Type::FullMessage)
-			{
-				//!< Message complet
-				std::vector<u8> msg(packet.data(), packet.data() + packet.datasize());
-				mLastProcessed = packet.id();
-				ResetPacket(packet);
-				messagesReady.push_back(std::move(msg));
-			}
-			else if (packet.type() == Packet::Type::FirstFragment)
-			{
-				//!< Vrifier que le message est prt
-				if (!isMessageFull(i, expectedPacketId, startIndexOffset))
-					break; // Protocole ordonn fiable : si le message suivant  extraire est incomplet, nous pouvons arrter le processus dextraction
+			std::vector<u8> grown = Core::BufferPool::Acquire(std::max(size, 2 * mPartialMessage.capacity()));
+			grown.insert(grown.cend(), mPartialMessage.cbegin(), mPartialMessage.cend());
+			Core::BufferPool::Release(std::move(mPartialMessage));
+			mPartialMessage = std::move(grown);
+		}
+		mPartialMessage.insert(mPartialMessage.cend(), packet.data(), packet.data() + packet.datasize());
+	}
 
-				// Nous avons un message fragment complet, nous pouvons maintenant extraire les donnes et rinitialiser chaque paquet utilis
-				std::vector<u8> msg(packet.data(), packet.data() + packet.datasize());
-				i++;
-				expectedPacketId++;
-				// Itration sur les paquets restants pour complter le message
-				for (size_t j = i; j < mPendingQueue.size(); i++, j++, expectedPacketId++)
-				{
-					const size_t idx = (j + startIndexOffset) % mPendingQueue.size();
-					Packet& pckt = mPendingQueue[idx];
+	void ReliableOrdered::RDemultiplexer::dropPartialMessage()
+	{
+		Core::BufferPool::Release(std::move(mPartialMessage));
+		mPartialMessage = std::vector<u8>();
+		mHasPartialMessage = false;
+	}
 
-					if (pckt.type() == Packet::Type::LastFragment)
-					{
-						//!< Dernier fragment du message maintenant complet
-						msg.insert(msg.cend(), pckt.data(), pckt.data() + pckt.datasize());
-						mLastProcessed = pckt.id();
-						ResetPacket(pckt);
-						messagesReady.push_back(std::move(msg));
-						break;
-					}
-					else if (pckt.type() != Packet::Type::Fragment)
-					{
-						//!< Paquet mal form ou malicieux
-						break;
-					}
+	void ReliableOrdered::RDemultiplexer::process(std::vector<std::vector<u8>>& messagesReady)
+	{
+		if (mWindow.empty())
+			return;
 
-					msg.insert(msg.cend(), pckt.data(), pckt.data() + pckt.datasize());
-					ResetPacket(pckt);
-				}
+		//!< Every packet received in order is consumed right away : only the message being rebuilt is kept, not its packets
+		for (std::unique_ptr<Packet>* next = &slot(mLastProcessed + 1); *next; next = &slot(mLastProcessed + 1))
+		{
+			const Packet& packet = **next;
+			const bool isFirst = (packet.type() == Packet::Type::FullMessage || packet.type() == Packet::Type::FirstFragment);
+			//!< Paquet mal form ou malicieux : its message is dropped and the processing goes on with the next one, rather than stalling the channel
+			if (isFirst && mHasPartialMessage)
+			{
+				// The message being rebuilt never got its last fragment
+				dropPartialMessage();
 			}
-			else
+			if (!isFirst && !mHasPartialMessage)
 			{
-				// Protocole ordonn fiable : si le message suivant  extraire est incomplet, nous pouvons arrter le processus dextraction
-				break;
+				// Rest of a dropped message
+				releasePacket(*next);
+				++mLastProcessed;
+				continue;
 			}
-		}
-		return messagesReady;
-	}
-
-	bool ReliableOrdered::RDemultiplexer::isMessageFull(size_t index, Networking::UDP::Datagram::ID packetID, const size_t& startIndexOffset) const
-	{
-		// On saute le premier fragment dj trait par la boucle sur i
-		++index;
-		++packetID;
-		// On itre sur les paquets restants pour vrifier que notre message soit complet
-		for (size_t j = index; j < mPendingQueue.size(); ++j, ++packetID)
-		{
-			const size_t idx = (j + startIndexOffset) % mPendingQueue.size();
-			const Packet& pckt = mPendingQueue[idx];
-			if (pckt.id() != packetID || pckt.datasize() == 0)
-				break; // Un paquet est manquant
-			if (pckt.type() == Packet::Type::LastFragment)
+			if (mPartialMessage.size() + packet.datasize() > mMaxMessageSize)
 			{
-				//!< Nous avons atteint et reu le dernier fragment, le message est complet
-				return true;
+				// Its next fragments are dropped along with it
+				dropPartialMessage();
+				releasePacket(*next);
+				++mLastProcessed;
+				continue;
 			}
-			else if (pckt.type() != Packet::Type::Fragment)
+			appendToMessage(packet);
+			mHasPartialMessage = (packet.type() == Packet::Type::FirstFragment || packet.type() == Packet::Type::Fragment);
+			if (!mHasPartialMessage)
 			{
-				//!< Si nous arrivons ici nous avons probablement reu un paquet mal form ou malicieux
-				break;
+				//!< Message complet
+				messagesReady.push_back(std::move(mPartialMessage));
+				mPartialMessage = std::vector<u8>();
 			}
+			releasePacket(*next);
+			++mLastProcessed;
 		}
-		return false;
 	}
 
 	void ReliableOrdered::queue(std::vector<u8>&& msgData)
+	{
+		multiplexer.queue(Core::BufferPool::Share(std::move(msgData)));
+	}
+
+	void ReliableOrdered::queue(const SharedData& msgData)
 	{
 		multiplexer.queue(msgData);
 	}
@@ -257,8 +337,8 @@ namespace Networking::UDP::Protocols
 		demultiplexer.onDataReceived(data, datasize);
 	}
 
-	std::vector<std::vector<u8>> ReliableOrdered::process()
+	void ReliableOrdered::process(std::vector<std::vector<u8>>& messages)
 	{
-		return demultiplexer.process();
+		demultiplexer.process(messages);
 	}
 }
\ No newline at end of file
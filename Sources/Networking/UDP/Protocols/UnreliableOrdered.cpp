@@ -128,14 +128,14 @@ namespace Networking::UDP::Protocols
 		return msg;
 	}
 
-	std::vector<std::vector<uint8_t>> UnreliableOrdered::UDemultiplexer::process()
+	void UnreliableOrdered::UDemultiplexer::process(std::vector<std::vector<uint8_t>>& messagesReady)
 	{
 		if (mPendingQueue.size() > 128) // queue too big, something went wrong
 		{
 			mPendingQueue.clear();
 		}
 
-		std::vector<std::vector<uint8_t>> messagesReady;
+		const size_t alreadyReady = messagesReady.size();
 		auto itPacket = mPendingQueue.cbegin();
 		auto itEnd = mPendingQueue.cend();
 		std::vector<Packet>::const_iterator newestProcessedPacket;
@@ -170,13 +170,11 @@ namespace Networking::UDP::Protocols
 		}
 
 		//!< Remove every processed and partial packets until the last one processed included
-		if (!messagesReady.empty())
+		if (messagesReady.size() > alreadyReady)
 		{
 			mLastProcessed = newestProcessedPacket->id();
 			mPendingQueue.erase(mPendingQueue.cbegin(), std::next(newestProcessedPacket));
 		}
-
-		return messagesReady;
 	}
 
 	void UnreliableOrdered::queue(std::vector<uint8_t>&& messageData)
@@ -198,8 +196,8 @@ namespace Networking::UDP::Protocols
 		demultiplexer.onDataReceived(data, datasize);
 	}
 
-	std::vector<std::vector<uint8_t>> UnreliableOrdered::process()
+	void UnreliableOrdered::process(std::vector<std::vector<uint8_t>>& messages)
 	{
-		return demultiplexer.process();
+		demultiplexer.process(messages);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,153 @@
+#include "Resources/ContentCache.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "Maths/Maths.hpp"
+#include "Resources/LargeFile.hpp"
+
+using namespace Resources;
+
+bool ContentCache::Contains(u64 hash, u64 size) const
+{
+	std::error_code err;
+	if (std::filesystem::exists(GetPartialPath(hash), err)) return false;
+	return std::filesystem::file_size(GetFilePath(hash), err) == size && !err;
+}
+
+bool ContentCache::IsComplete(u64 hash) const
+{
+	std::error_code err;
+	if (std::filesystem::exists(GetPartialPath(hash), err)) return false;
+	return std::filesystem::exists(GetFilePath(hash), err) && !err;
+}
+
+void ContentCache::Write(u64 hash, const u8* data, u64 size) const
+{
+	std::error_code err;
+	std::filesystem::create_directories(directory, err);
+	const std::string filePath = GetFilePath(hash);
+	// Written aside then renamed, a crash never leaves a truncated file under a valid name
+	const std::string tmpPath = filePath + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (file.fail())
+		{
+			std::cout << "Could not write cache file " << tmpPath << std::endl;
+			return;
+		}
+		file.write(reinterpret_cast<const char*>(data), size);
+		if (file.fail()) return;
+	}
+	std::filesystem::rename(tmpPath, filePath, err);
+	if (err)
+	{
+		// The entry is mapped : Windows doesn't replace a file while a view of it is open, it is kept as is
+		std::cout << "Could not write cache file " << filePath << std::endl;
+		std::filesystem::remove(tmpPath, err);
+	}
+}
+
+bool ContentCache::Import(const std::string& sourcePath, u64& hash) const
+{
+	std::error_code err;
+	std::filesystem::create_directories(directory, err);
+	// Hashed from the copy : the source can change meanwhile, the copy always matches its name
+	const std::string tmpPath = directory + "/import.tmp";
+	if (!std::filesystem::copy_file(sourcePath, tmpPath, std::filesystem::copy_options::overwrite_existing, err))
+	{
+		std::cout << "Could not copy " << sourcePath << " to the cache" << std::endl;
+		return false;
+	}
+	u64 size;
+	{
+		Core::MappedFile copy;
+		if (!copy.Open(tmpPath))
+		{
+			std::filesystem::remove(tmpPath, err);
+			return false;
+		}
+		size = copy.GetSize();
+		hash = LargeFile::HashContent(copy.GetData(), size);
+	}
+	// Unmapped first, a mapped file can't be renamed on Windows
+	if (Contains(hash, size))
+	{
+		std::filesystem::remove(tmpPath, err);
+		return true;
+	}
+	std::filesystem::rename(tmpPath, GetFilePath(hash), err);
+	if (err)
+	{
+		std::cout << "Could not import " << sourcePath << " to the cache" << std::endl;
+		std::filesystem::remove(tmpPath, err);
+		return false;
+	}
+	return true;
+}
+
+bool ContentCache::ReadPartial(u64 hash, std::vector<bool>& parts)
+{
+	const u64 bitmapSize = (parts.size() + 7) / 8;
+	Core::MappedFile& bitmap = partials[hash];
+	if (!bitmap.IsOpen())
+	{
+		// Checked first, mapping it resizes it
+		std::error_code err;
+		const std::string filePath = GetPartialPath(hash);
+		if (std::filesystem::file_size(filePath, err) != bitmapSize || err || !bitmap.Create(filePath, bitmapSize))
+		{
+			partials.erase(hash);
+			return false;
+		}
+	}
+	if (bitmap.GetSize() != bitmapSize) return false;
+	const u8* bits = bitmap.GetData();
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		parts[i] = (bits[i >> 3] >> (i & 7)) & 1;
+	}
+	return true;
+}
+
+bool ContentCache::StartPartial(u64 hash, u32 partsCount)
+{
+	std::error_code err;
+	std::filesystem::create_directories(directory, err);
+	// Before the content : the file isn't taken for a complete one until the bitmap is removed
+	Core::MappedFile& bitmap = partials[hash];
+	if (!bitmap.Create(GetPartialPath(hash), (partsCount + 7ull) / 8))
+	{
+		partials.erase(hash);
+		return false;
+	}
+	memset(bitmap.GetData(), 0, bitmap.GetSize());
+	return true;
+}
+
+void ContentCache::WritePartial(u64 hash, u32 partIndex)
+{
+	auto bitmap = partials.find(hash);
+	if (bitmap == partials.end() || (partIndex >> 3) >= bitmap->second.GetSize()) return;
+	bitmap->second.GetData()[partIndex >> 3] |= 1 << (partIndex & 7);
+}
+
+void ContentCache::RemovePartial(u64 hash)
+{
+	// Unmapped first, a mapped file can't be removed on Windows
+	partials.erase(hash);
+	std::error_code err;
+	std::filesystem::remove(GetPartialPath(hash), err);
+}
+
+std::string ContentCache::GetFilePath(u64 hash) const
+{
+	return directory + "/" + Maths::Util::GetHex(hash);
+}
+
+std::string ContentCache::GetPartialPath(u64 hash) const
+{
+	return GetFilePath(hash) + ".part";
+}
@@ -1,72 +1,144 @@
 #include "Resources/FileDataManager.hpp"
 
+#include <algorithm>
 #include <assert.h>
 
-using namespace Resources;
+#include "Core/BufferPool.hpp"
 
-bool FileDataManager::HasPendingFiles() const
-{
-	return !broadcastedFiles.empty();
-}
+using namespace Resources;
 
-void FileDataManager::AddFileToBroadCast(const LargeFile* fileIn)
+bool FileDataManager::HasPendingData() const
 {
-	broadcastedFiles.push_back(FileHolder(fileIn));
+	return !activeUsers.empty();
 }
 
-void Resources::FileDataManager::AddFileToUser(u64 userNetworkID, const LargeFile* fileIn)
+void Resources::FileDataManager::AddFileToUser(u64 userNetworkID, const LargeFile* fileIn, std::vector<bool>&& heldParts)
 {
-	files[userNetworkID].push_back(UserTransferDataHolder(fileIn));
+	FileTransfer transfer(fileIn, std::move(heldParts));
+	transfer.currentPacket = NextMissingPart(transfer.heldParts, 0);
+	if (transfer.currentPacket >= fileIn->GetPacketsCount()) return;
+	auto res = users.try_emplace(userNetworkID);
+	UserTransfers& user = res.first->second;
+	std::list<FileTransfer>& list = fileIn->GetContentSize() <= SmallFileSize ? user.smallFiles : user.largeFiles;
+	// Already on its way
+	if (std::any_of(list.begin(), list.end(), [fileIn](const FileTransfer& other) { return other.file == fileIn; })) return;
+	if (user.IsEmpty()) activeUsers.push_back(userNetworkID);
+	list.push_back(std::move(transfer));
 }
 
-void Resources::FileDataManager::AddMessageToUser(u64 userNetworkID, const Chat::ChatMessage* messIn)
+void Resources::FileDataManager::RemoveUser(u64 userNetworkID)
 {
-	files[userNetworkID].push_back(UserTransferDataHolder(messIn));
+	if (users.erase(userNetworkID))
+	{
+		activeUsers.erase(std::remove(activeUsers.begin(), activeUsers.end(), userNetworkID), activeUsers.end());
+	}
 }
 
-Chat::ActionData FileDataManager::GetNextFilePart()
+void Resources::FileDataManager::GetNextParts(const std::function<s64(u64)>& queueSpace, const std::function<Chat::ProtocolVersion(u64)>& userVersion,
+	Chat::ActionOrigin origin, s64 budget, std::vector<std::pair<u64, SharedPart>>& out)
 {
-	auto& t = broadcastedFiles.front();
-	Networking::Serialization::Serializer sr;
-	sr.Write(t.file->GetPath().size());
-	sr.Write(reinterpret_cast<const u8*>(t.file->GetPath().c_str()), t.file->GetPath().size());
-	t.file->SerializePacket(t.currentPacket, sr);
-	t.currentPacket++;
-	if (t.currentPacket >= t.file->GetPacketsCount()) broadcastedFiles.pop_front();
-	Chat::ActionData action;
-	action.type = Chat::Action::FILE_DATA;
-	action.data.resize(sr.GetBufferSize());
-	std::copy(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize(), action.data.data());
-	return action;
+	for (u64 id : activeUsers)
+	{
+		users[id].space = queueSpace(id);
+	}
+	size_t idleTurns = 0; // Turns in a row without anything sent
+	while (budget > 0 && idleTurns < activeUsers.size())
+	{
+		const u64 id = activeUsers.front();
+		activeUsers.pop_front();
+		auto it = users.find(id);
+		assert(it != users.end());
+		UserTransfers& user = it->second;
+		// Overdrawn by the last part of the previous turn at most, so the quantum always allows a part
+		user.deficit += Quantum;
+		bool sent = false;
+		const Chat::ProtocolVersion version = userVersion(id);
+		while (user.deficit > 0 && user.space > 0 && budget > 0 && !user.IsEmpty())
+		{
+			SharedPart part = TakeNextPart(user, version, origin);
+			if (!part) continue;
+			const s64 size = static_cast<s64>(part->size());
+			user.deficit -= size;
+			user.space -= size;
+			budget -= size;
+			out.emplace_back(id, std::move(part));
+			sent = true;
+		}
+		if (user.IsEmpty())
+		{
+			users.erase(it);
+			idleTurns = 0;
+			continue;
+		}
+		if (!sent)
+		{
+			// Out of space : the allowance doesn't pile up while the connection is full
+			user.deficit = std::min(user.deficit, Quantum);
+		}
+		idleTurns = sent ? 0 : idleTurns + 1;
+		activeUsers.push_back(id);
+	}
+	if (sharedParts.size() >= sharedPartsSweepSize)
+	{
+		for (auto it = sharedParts.begin(); it != sharedParts.end();)
+		{
+			it = it->second.expired() ? sharedParts.erase(it) : std::next(it);
+		}
+		sharedPartsSweepSize = std::max(2 * sharedParts.size(), MinSharedPartsSweepSize);
+	}
 }
 
-bool Resources::FileDataManager::HasUserPendingData(u64 userNetworkID)
+Resources::FileDataManager::SharedPart Resources::FileDataManager::TakeNextPart(UserTransfers& user, Chat::ProtocolVersion version, Chat::ActionOrigin origin)
 {
-	return !files[userNetworkID].empty();
+	return TakeFilePart(user.smallFiles.empty() ? user.largeFiles : user.smallFiles, version, origin);
 }
 
-Chat::ActionData Resources::FileDataManager::GetNextUserDataPart(u64 userNetworkID)
+Resources::FileDataManager::SharedPart Resources::FileDataManager::TakeFilePart(std::list<FileTransfer>& list, Chat::ProtocolVersion version, Chat::ActionOrigin origin)
 {
-	auto& t = files[userNetworkID].front();
-	Chat::ActionData action;
-	if (t.object.index() == 0)
+	FileTransfer& t = list.front();
+	// Every compact version encodes file parts the same way
+	const PartKey key{ t.file, t.file->GetContentHash(), t.currentPacket, version == Chat::ProtocolVersion::LEGACY };
+	SharedPart part;
+	// Without a hash, a file doesn't tell when its content changes
+	if (key.contentHash != 0)
 	{
-		Networking::Serialization::Serializer sr;
-		const LargeFile* ptr = std::get<const LargeFile*>(t.object);
-		sr.Write(ptr->GetPath().size());
-		sr.Write(reinterpret_cast<const u8*>(ptr->GetPath().c_str()), ptr->GetPath().size());
-		ptr->SerializePacket(t.currentPacket, sr);
-		t.currentPacket++;
-		if (t.currentPacket >= ptr->GetPacketsCount()) files[userNetworkID].pop_front();
+		part = sharedParts[key].lock();
+	}
+	if (!part)
+	{
+		const std::string& path = t.file->GetPath();
+		Networking::Serialization::Serializer sr(sizeof(u64) + path.size() + LargeFile::MaxSerializedPacketSize);
+		sr.Write(path.size());
+		sr.Write(reinterpret_cast<const u8*>(path.c_str()), path.size());
+		if (!t.file->SerializePacket(t.currentPacket, sr))
+		{
+			// Its content is gone, nothing more of it can be sent
+			list.pop_front();
+			return nullptr;
+		}
+		Chat::ActionData action;
 		action.type = Chat::Action::FILE_DATA;
-		action.data.resize(sr.GetBufferSize());
-		std::copy(sr.GetBuffer(), sr.GetBuffer() + sr.GetBufferSize(), action.data.data());
+		action.data = sr.TakeBuffer();
+		Networking::Serialization::Serializer encoded;
+		Chat::ActionCodec::Encode(&action, 1, version, origin, encoded);
+		part = Core::BufferPool::Share(encoded.TakeBuffer());
+		if (key.contentHash != 0) sharedParts[key] = part;
+	}
+	t.currentPacket = NextMissingPart(t.heldParts, t.currentPacket + 1);
+	if (t.currentPacket >= t.file->GetPacketsCount())
+	{
+		list.pop_front();
 	}
 	else
 	{
-		const Chat::ChatMessage* ptr = std::get<const Chat::ChatMessage*>(t.object);
-		action = ptr->Serialize();
-		files[userNetworkID].pop_front();
+		// The other files of the same priority get their part before this one sends the next
+		list.splice(list.end(), list, list.begin());
 	}
-	return action;
+	return part;
+}
+
+u32 Resources::FileDataManager::NextMissingPart(const std::vector<bool>& heldParts, u32 packet)
+{
+	while (packet < heldParts.size() && heldParts[packet]) packet++;
+	return packet;
 }
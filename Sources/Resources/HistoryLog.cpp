@@ -0,0 +1,240 @@
+#include "Resources/HistoryLog.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+#include "Maths/Maths.hpp"
+#include "Networking/Serialization/Serializer.hpp"
+#include "Networking/Serialization/Deserializer.hpp"
+
+using namespace Resources;
+using namespace Networking::Serialization;
+
+bool Resources::HistoryLog::Open(const std::string& directoryIn)
+{
+	Close();
+	directory = directoryIn;
+	std::error_code err;
+	std::filesystem::create_directories(directory, err);
+	const std::string indexPath = GetIndexPath();
+	u64 fileSize = std::filesystem::file_size(indexPath, err);
+	if (err || fileSize == 0) fileSize = IndexHeaderSize + MinIndexCapacity * EntrySize;
+	if (fileSize < IndexHeaderSize + EntrySize || !index.Create(indexPath, fileSize))
+	{
+		std::cout << "Could not open history index " << indexPath << std::endl;
+		return false;
+	}
+	Deserializer dr(index.GetData(), IndexHeaderSize);
+	u32 magic;
+	u32 version;
+	u64 storedCount;
+	dr.Read(magic);
+	dr.Read(version);
+	dr.Read(storedCount);
+	if (magic == 0)
+	{
+		// Created just now
+		Serializer sr(index.GetData(), IndexHeaderSize);
+		sr.Write(Magic);
+		sr.Write(Version);
+		storedCount = 0;
+	}
+	else if (magic != Magic || version != Version)
+	{
+		// Left as is rather than overwritten
+		std::cout << "Unknown history index format " << indexPath << std::endl;
+		index.Close();
+		return false;
+	}
+	count = std::min(storedCount, GetIndexCapacity());
+	// Drops the records a crash left damaged, the next ones are written over them
+	// An entry never written reads as zeros, pointing at the first record : its id isn't above the one before it
+	Entry last;
+	Entry previous;
+	while (count > 0)
+	{
+		if (ReadEntry(count - 1, last) && (count == 1 || (ReadEntry(count - 2, previous) && last.messageID > previous.messageID)))
+		{
+			lastSegmentSize = GetRecordEnd(last);
+			if (lastSegmentSize != 0) break;
+		}
+		count--;
+	}
+	if (count == 0)
+	{
+		last = Entry();
+		lastSegmentSize = 0;
+	}
+	WriteCount();
+	if (!OpenLastSegment(last.segment))
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void Resources::HistoryLog::Close()
+{
+	index.Close();
+	segments.clear();
+	count = 0;
+	lastSegment = 0;
+	lastSegmentSize = 0;
+}
+
+bool Resources::HistoryLog::Append(const Chat::ActionData& record)
+{
+	if (!IsOpen()) return false;
+	Deserializer dr(record.data);
+	Entry entry;
+	u64 userID;
+	if (!dr.Read(entry.time) || !dr.Read(userID) || !dr.Read(entry.messageID)) return false;
+	const u64 recordSize = RecordHeaderSize + record.data.size();
+	if (recordSize > SegmentSize) return false;
+	if (lastSegmentSize + recordSize > SegmentSize)
+	{
+		if (!OpenLastSegment(lastSegment + 1)) return false;
+		lastSegmentSize = 0;
+	}
+	if (count == GetIndexCapacity())
+	{
+		// Remapped with twice the entries, what it holds is kept. Unmapped first, a mapped file can't be resized on Windows
+		const u64 capacity = GetIndexCapacity();
+		index.Close();
+		if (!index.Create(GetIndexPath(), IndexHeaderSize + 2 * capacity * EntrySize))
+		{
+			std::cout << "Could not grow history index " << GetIndexPath() << std::endl;
+			// Not left with a count and no index, it is opened again from the disk
+			Close();
+			return false;
+		}
+	}
+	Serializer sr(segments[lastSegment].GetData() + lastSegmentSize, recordSize);
+	sr.Write(static_cast<u8>(record.type));
+	sr.Write(static_cast<u32>(record.data.size()));
+	sr.Write(record.data.data(), record.data.size());
+	entry.segment = lastSegment;
+	entry.offset = static_cast<u32>(lastSegmentSize);
+	WriteEntry(count, entry);
+	// Last : until then the record isn't part of the log
+	count++;
+	WriteCount();
+	lastSegmentSize += recordSize;
+	return true;
+}
+
+bool Resources::HistoryLog::Read(u64 recordIndex, Chat::ActionData& record) const
+{
+	Entry entry;
+	if (!ReadEntry(recordIndex, entry) || GetRecordEnd(entry) == 0) return false;
+	const Core::MappedFile* segment = GetSegment(entry.segment);
+	Deserializer dr(segment->GetData() + entry.offset, segment->GetSize() - entry.offset);
+	u8 type;
+	u32 size;
+	const u8* payload;
+	if (!dr.Read(type) || !dr.Read(size) || !dr.ReadView(payload, size)) return false;
+	record.type = static_cast<Chat::Action>(type);
+	record.data.assign(payload, payload + size);
+	return true;
+}
+
+s64 Resources::HistoryLog::GetTimeStamp(u64 recordIndex) const
+{
+	Entry entry;
+	ReadEntry(recordIndex, entry);
+	return entry.time;
+}
+
+u64 Resources::HistoryLog::GetMessageID(u64 recordIndex) const
+{
+	Entry entry;
+	ReadEntry(recordIndex, entry);
+	return entry.messageID;
+}
+
+u64 Resources::HistoryLog::LowerBound(u64 messageID) const
+{
+	u64 first = 0;
+	u64 last = count;
+	while (first < last)
+	{
+		const u64 middle = first + (last - first) / 2;
+		if (GetMessageID(middle) < messageID)
+		{
+			first = middle + 1;
+		}
+		else
+		{
+			last = middle;
+		}
+	}
+	return first;
+}
+
+std::string Resources::HistoryLog::GetIndexPath() const
+{
+	return directory + "/index";
+}
+
+std::string Resources::HistoryLog::GetSegmentPath(u32 segment) const
+{
+	return directory + "/" + Maths::Util::GetHex(segment) + ".log";
+}
+
+bool Resources::HistoryLog::ReadEntry(u64 recordIndex, Entry& entry) const
+{
+	if (recordIndex >= count) return false;
+	Deserializer dr(index.GetData() + IndexHeaderSize + recordIndex * EntrySize, EntrySize);
+	return dr.Read(entry.segment) && dr.Read(entry.offset) && dr.Read(entry.time) && dr.Read(entry.messageID);
+}
+
+void Resources::HistoryLog::WriteEntry(u64 recordIndex, const Entry& entry)
+{
+	Serializer sr(index.GetData() + IndexHeaderSize + recordIndex * EntrySize, EntrySize);
+	sr.Write(entry.segment);
+	sr.Write(entry.offset);
+	sr.Write(entry.time);
+	sr.Write(entry.messageID);
+}
+
+void Resources::HistoryLog::WriteCount()
+{
+	Serializer sr(index.GetData() + 2 * sizeof(u32), sizeof(u64));
+	sr.Write(count);
+}
+
+const Core::MappedFile* Resources::HistoryLog::GetSegment(u32 segment) const
+{
+	if (segment < segments.size() && segments[segment].IsOpen()) return &segments[segment];
+	// Mapped before the list grows : a damaged entry can give any segment
+	Core::MappedFile file;
+	if (!file.Open(GetSegmentPath(segment))) return nullptr;
+	if (segments.size() <= segment) segments.resize(segment + 1);
+	segments[segment] = std::move(file);
+	return &segments[segment];
+}
+
+bool Resources::HistoryLog::OpenLastSegment(u32 segment)
+{
+	if (segments.size() <= segment) segments.resize(segment + 1);
+	if (!segments[segment].Create(GetSegmentPath(segment), SegmentSize))
+	{
+		std::cout << "Could not open history segment " << GetSegmentPath(segment) << std::endl;
+		return false;
+	}
+	lastSegment = segment;
+	return true;
+}
+
+u64 Resources::HistoryLog::GetRecordEnd(const Entry& entry) const
+{
+	const Core::MappedFile* segment = GetSegment(entry.segment);
+	if (!segment || entry.offset + RecordHeaderSize > segment->GetSize()) return 0;
+	Deserializer dr(segment->GetData() + entry.offset + sizeof(u8), sizeof(u32));
+	u32 size;
+	dr.Read(size);
+	const u64 end = entry.offset + RecordHeaderSize + size;
+	return end <= segment->GetSize() ? end : 0;
+}
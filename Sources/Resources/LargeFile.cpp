@@ -1,5 +1,10 @@
 #include "Resources/LargeFile.hpp"
 
+#include <cstring>
+#include <utility>
+
+#include "Core/Sha256.hpp"
+
 using namespace Resources;
 
 LargeFile::LargeFile()
@@ -8,64 +13,183 @@ LargeFile::LargeFile()
 
 LargeFile::~LargeFile()
 {
-	if (FileData)
+	ReleaseContent();
+}
+
+u64 Resources::LargeFile::HashContent(const u8* data, u64 size)
+{
+	const Core::Sha256::Digest digest = Core::Sha256::Hash(data, size);
+	u64 hash = 0;
+	for (u32 i = 0; i < sizeof(hash); i++)
 	{
-		delete[] FileData;
+		hash = (hash << 8) | digest[i];
 	}
+	// 0 stands for an unknown hash
+	return hash != 0 ? hash : 1;
 }
 
-bool LargeFile::PreLoad(Networking::Serialization::Deserializer& dr, const std::string& pathIn)
+void Resources::LargeFile::SerializeParts(const std::vector<bool>& parts, Networking::Serialization::Serializer& sr)
 {
-	if (FileData)
+	sr.Write(static_cast<u32>(parts.size()));
+	u8 byte = 0;
+	for (size_t i = 0; i < parts.size(); i++)
 	{
-		delete[] FileData;
-		FileData = nullptr;
+		if (parts[i]) byte |= 1 << (i & 7);
+		if ((i & 7) == 7 || i + 1 == parts.size())
+		{
+			sr.Write(byte);
+			byte = 0;
+		}
 	}
-	if (complete)
+}
+
+bool Resources::LargeFile::DeserializeParts(Networking::Serialization::Deserializer& dr, std::vector<bool>& parts)
+{
+	u32 count;
+	const u8* bytes;
+	if (!dr.Read(count) || !dr.ReadView(bytes, (count + 7ull) / 8)) return false;
+	parts.resize(count);
+	for (u32 i = 0; i < count; i++)
 	{
-		complete = false;
-		receivedParts.clear();
+		parts[i] = (bytes[i >> 3] >> (i & 7)) & 1;
 	}
+	return true;
+}
+
+bool LargeFile::PreLoad(Networking::Serialization::Deserializer& dr, std::string_view pathIn)
+{
+	if (!CanPreLoad()) return false;
+	ReleaseContent();
 	path = pathIn;
-	u64 tmpSize;
-	if (!dr.Read(tmpSize)) return false;
-	fileType.resize(tmpSize);
-	if (!dr.Read(reinterpret_cast<u8*>(fileType.data()), tmpSize)) return false;
-	if (!dr.Read(dataSize)) return false;
-	u32 pkCount = GetPacketsCount();
-	receivedParts.resize(pkCount, false);
-	FileData = new u8[dataSize];
-	complete = false;
+	contentHash = 0;
+	contentRejected = false;
+	// Left empty if the description is refused, no part is accepted then
+	dataSize = 0;
+	receivedParts.clear();
+	std::string_view type;
+	u64 size;
+	if (!dr.ReadString(type) || !dr.Read(size) || size > MaxContentSize) return false;
+	fileType = type;
+	dataSize = size;
+	// Allocated when the first part is received, unless mapped to a file by then
+	receivedParts.resize(GetPacketsCount(), false);
 	return true;
 }
 
-bool LargeFile::AcceptPacket(Networking::Serialization::Deserializer& dr)
+bool LargeFile::AcceptPacket(Networking::Serialization::Deserializer& dr, u32& packetIndex)
 {
-	u32 packetIndex;
 	u16 packetSize;
-	if (!dr.Read(packetIndex) || !dr.Read(packetSize)) return false;
-	if (packetIndex >= GetPacketsCount()) return false;
-	bool isLast = (packetIndex + 1) == GetPacketsCount();
-	if (packetSize != (isLast ? GetLastPacketSize() : 0x8000)) return false;
-	u64 delta = (u64)packetIndex << 15;
-	if (!dr.Read(FileData + delta, packetSize)) return false;
+	const u8* data;
+	if (!dr.Read(packetIndex) || !dr.Read(packetSize) || !dr.ReadView(data, packetSize)) return false;
+	return AcceptPart(packetIndex, data, packetSize);
+}
+
+bool Resources::LargeFile::AcceptPart(u32 packetIndex, const u8* data, u32 size)
+{
+	if (complete || packetIndex >= GetPacketsCount() || size != GetPacketSize(packetIndex)) return false;
+	if (!FileData) SetContent(new u8[dataSize]);
+	memcpy(FileData + GetPacketOffset(packetIndex), data, size);
 	receivedParts[packetIndex] = true;
+	contentRejected = false;
+	return CheckContent();
+}
+
+bool Resources::LargeFile::CheckContent()
+{
 	for (u32 i = 0; i < GetPacketsCount(); i++)
 	{
 		if (!receivedParts[i]) return true;
 	}
+	const u64 hash = HashContent(FileData, dataSize);
+	if (contentHash != 0 && hash != contentHash)
+	{
+		// Corrupted, or resumed from a stale partial download
+		receivedParts.assign(receivedParts.size(), false);
+		contentRejected = true;
+		return false;
+	}
 	complete = true;
+	contentHash = hash;
 	return true;
 }
 
+bool Resources::LargeFile::AcceptContent(const u8* data, u64 size)
+{
+	if (complete || size != dataSize || HashContent(data, size) != contentHash) return false;
+	if (!FileData) SetContent(new u8[dataSize]);
+	memcpy(FileData, data, size);
+	receivedParts.assign(receivedParts.size(), true);
+	complete = true;
+	return true;
+}
+
+bool Resources::LargeFile::MapContent(const std::string& filePath)
+{
+	if (complete || dataSize == 0) return false;
+	Core::MappedFile content;
+	if (!content.Open(filePath) || content.GetSize() != dataSize || HashContent(content.GetData(), dataSize) != contentHash) return false;
+	ReleaseContent();
+	mapping = std::move(content);
+	SetContent(mapping.GetData());
+	receivedParts.assign(receivedParts.size(), true);
+	complete = true;
+	return true;
+}
+
+bool Resources::LargeFile::MapReceiveBuffer(const std::string& filePath)
+{
+	// Only before the download starts, the parts received so far would be lost
+	if (complete || FileData || !mapping.Create(filePath, dataSize)) return false;
+	SetContent(mapping.GetData());
+	return true;
+}
+
+bool Resources::LargeFile::RestoreParts(const std::vector<bool>& parts)
+{
+	if (complete || !IsMapped() || parts.size() != receivedParts.size()) return false;
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (parts[i]) receivedParts[i] = true;
+	}
+	return CheckContent();
+}
+
+bool Resources::LargeFile::MapSource(const std::string& filePath)
+{
+	ReleaseContent();
+	if (!mapping.Open(filePath)) return false;
+	dataSize = mapping.GetSize();
+	SetContent(mapping.GetData());
+	return true;
+}
+
+void Resources::LargeFile::SetContent(u8* data)
+{
+	FileData = data;
+	totalContentSize += dataSize;
+}
+
+void Resources::LargeFile::ReleaseContent()
+{
+	if (FileData) totalContentSize -= dataSize;
+	if (mapping.IsOpen())
+	{
+		mapping.Close();
+	}
+	else if (FileData)
+	{
+		delete[] FileData;
+	}
+	FileData = nullptr;
+}
+
 bool Resources::LargeFile::SerializePacket(u32 packetIndex, Networking::Serialization::Serializer& sr) const
 {
-	if (packetIndex >= GetPacketsCount()) return false;
+	if (packetIndex >= GetPacketsCount() || !FileData) return false;
 	sr.Write(packetIndex);
-	u16 packetSize = (packetIndex + 1) == GetPacketsCount() ? GetLastPacketSize() : (u32)0x8000;
+	u16 packetSize = GetPacketSize(packetIndex);
 	sr.Write(packetSize);
-	u64 delta = (u64)packetIndex << 15;
-	sr.Write(FileData + delta, packetSize);
+	sr.Write(FileData + GetPacketOffset(packetIndex), packetSize);
 	return true;
 }
 
@@ -90,6 +214,11 @@ u32 Resources::LargeFile::GetLastPacketSize() const
 	return result == 0 ? 0x8000 : result;
 }
 
+u32 Resources::LargeFile::GetPacketSize(u32 packetIndex) const
+{
+	return (packetIndex + 1) == GetPacketsCount() ? GetLastPacketSize() : 0x8000;
+}
+
 float Resources::LargeFile::GetLoadingCompletion() const
 {
 	if (receivedParts.size() == 0) return 1.0f;
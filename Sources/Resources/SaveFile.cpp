@@ -0,0 +1,69 @@
+#include "Resources/SaveFile.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "Networking/Serialization/Serializer.hpp"
+#include "Networking/Serialization/Deserializer.hpp"
+
+using namespace Resources;
+
+bool Resources::SaveFile::LoadData(Chat::UserManager& userList)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (file.fail()) return false;
+	const std::vector<u8> content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	Networking::Serialization::Deserializer dr(content);
+	u64 count;
+	if (!dr.Read(count)) return false;
+	for (u64 i = 0; i < count; i++)
+	{
+		u64 userID;
+		std::string_view name;
+		Maths::Vec3 color;
+		if (!dr.Read(userID) || !dr.ReadString(name) || !dr.Read(color.x) || !dr.Read(color.y) || !dr.Read(color.z)) return false;
+		if (userList.GetAllUsers().count(userID)) continue;
+		Chat::User* user = userList.GetOrCreateUser(userID);
+		user->userName = name;
+		user->userColor = color;
+		user->isConnected = false;
+	}
+	return true;
+}
+
+bool Resources::SaveFile::SaveData(Chat::UserManager& userList)
+{
+	Networking::Serialization::Serializer sr;
+	// The default user isn't saved
+	const auto& allUsers = userList.GetAllUsers();
+	sr.Write(static_cast<u64>(std::count_if(allUsers.begin(), allUsers.end(), [](const auto& u) { return u.first != 0; })));
+	for (auto& u : allUsers)
+	{
+		if (u.first == 0) continue;
+		const Chat::User* user = u.second.get();
+		sr.Write(user->userID);
+		sr.Write(static_cast<u64>(user->userName.size()));
+		sr.Write(reinterpret_cast<const u8*>(user->userName.data()), user->userName.size());
+		sr.Write(user->userColor.x);
+		sr.Write(user->userColor.y);
+		sr.Write(user->userColor.z);
+	}
+	// Written aside then renamed, a crash never leaves a truncated save
+	const std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+		if (file.fail())
+		{
+			std::cout << "Could not write save file " << tmpPath << std::endl;
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(sr.GetBuffer()), sr.GetBufferSize());
+		if (file.fail()) return false;
+	}
+	std::error_code err;
+	std::filesystem::rename(tmpPath, path, err);
+	return !err;
+}
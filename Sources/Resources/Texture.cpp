@@ -7,12 +7,16 @@
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
+#include <algorithm>
+#include <assert.h>
+#include <cstring>
 #include <iostream>
 #include <filesystem>
 #include <fstream>
 
 #include "Networking/Serialization/Serializer.hpp"
 #include "Networking/Serialization/Deserializer.hpp"
+#include "Resources/ContentCache.hpp"
 
 static const int WrapTable[] = { GL_REPEAT, GL_MIRRORED_REPEAT, GL_MIRROR_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_BORDER };
 static const int FilterTable[] = { GL_NEAREST, GL_LINEAR };
@@ -33,11 +37,14 @@ Texture::Texture()
 	filter = TextureFilterType::Linear;
 	wrap = TextureWrapType::Repeat;
 	loaded.Store(false);
+	decoding.Store(false);
 }
 
 Texture::~Texture()
 {
 	UnLoad();
+	SetEvicted(false);
+	RemoveFromUsed();
 }
 
 const char* Resources::Texture::GetError(TextureError error)
@@ -52,8 +59,13 @@ const char* Resources::Texture::GetSTBIError()
 	return stbi_failure_reason();
 }
 
-TextureError Resources::Texture::TryLoad(const char* pathIn, Texture* tex, Maths::Vec2 minSize, Maths::Vec2 maxSize, u64 maxFileSize)
+TextureError Resources::Texture::TryLoad(const char* pathIn, Texture* tex, const ContentCache& cache, Maths::Vec2 minSize, Maths::Vec2 maxSize, u64 maxFileSize)
 {
+	tex->WaitForDecode();
+	tex->contentGeneration++;
+	tex->thumbnail = nullptr;
+	tex->SetEvicted(false);
+	tex->lastError = TextureError::NONE;
 	if (tex->IsLoaded())
 	{
 		tex->UnLoad();
@@ -73,21 +85,18 @@ TextureError Resources::Texture::TryLoad(const char* pathIn, Texture* tex, Maths
 	}
 	tex->fileType = p.extension().string();
 	tex->path = pathIn;
-	std::ifstream file(p, std::ios::ate | std::ios::binary);
-	if (file.fail())
+	// Sent straight from the mapping, the file isn't kept on the heap for as long as the texture lives
+	// The copy is only ever replaced by a rename, not written : the mapping stays valid whatever happens to the source
+	u64 hash;
+	if (!cache.Import(p.string(), hash) || !tex->MapSource(cache.GetFilePath(hash)))
 	{
-		file.close();
 		return TextureError::OTHER;
 	}
-	tex->dataSize = file.tellg();
-	file.seekg(0, std::ios_base::beg);
-	tex->FileData = new u8[tex->dataSize];
-	file.read((char*)tex->FileData, tex->dataSize);
-	file.close();
+	tex->contentHash = hash;
+	tex->complete = true;
 	int nrChannels;
-	stbi_set_flip_vertically_on_load_thread(false);
-	tex->ImageData = stbi_load_from_memory(tex->FileData, tex->dataSize, &tex->sizeX, &tex->sizeY, &nrChannels, 4);
-	if (!tex->ImageData)
+	// Only the header, decoding the pixels here would stall the frame
+	if (!stbi_info_from_memory(tex->FileData, static_cast<int>(tex->dataSize), &tex->sizeX, &tex->sizeY, &nrChannels))
 	{
 		return TextureError::IMG_INVALID;
 	}
@@ -97,70 +106,196 @@ TextureError Resources::Texture::TryLoad(const char* pathIn, Texture* tex, Maths
 		Maths::Vec2 res = Maths::Vec2((float)tex->GetTextureWidth(), (float)tex->GetTextureHeight());
 		if (res.x < minSize.x || res.y < minSize.y)
 		{
-			stbi_image_free(tex->ImageData);
-			tex->ImageData = nullptr;
 			return TextureError::IMG_TOO_SMALL;
 		}
 		else if (res.x > maxSize.x || res.y > maxSize.y)
 		{
-			stbi_image_free(tex->ImageData);
-			tex->ImageData = nullptr;
 			return TextureError::IMG_TOO_BIG;
 		}
 	}
-	tex->EndLoad();
 	return TextureError::NONE;
 }
 
-bool Resources::Texture::PreLoad(Networking::Serialization::Deserializer& dr, const std::string& pathIn)
+u8* Resources::Texture::DecodeImage(const u8* data, u64 size, s32& width, s32& height)
 {
-	if (loaded.Load()) UnLoad();
-	if (!LargeFile::PreLoad(dr, pathIn)) return false;
-	return (dr.Read(sizeX) && dr.Read(sizeY));
+	int nrChannels;
+	stbi_set_flip_vertically_on_load_thread(false);
+	return stbi_load_from_memory(data, static_cast<int>(size), &width, &height, &nrChannels, 4);
+}
+
+void Resources::Texture::FreeImage(u8* pixels)
+{
+	stbi_image_free(pixels);
+}
+
+u8* Resources::Texture::Downscale(const u8* pixels, s32 width, s32 height, s32 maxSide, s32& outWidth, s32& outHeight)
+{
+	if (!pixels || width <= 0 || height <= 0 || maxSide <= 0) return nullptr;
+	const s32 longSide = std::max(width, height);
+	outWidth = std::max<s32>(1, static_cast<s32>(static_cast<s64>(width) * maxSide / longSide));
+	outHeight = std::max<s32>(1, static_cast<s32>(static_cast<s64>(height) * maxSide / longSide));
+	// Allocated like the decoded images, for FreeImage to release it
+	u8* result = static_cast<u8*>(STBI_MALLOC(static_cast<size_t>(outWidth) * outHeight * 4));
+	if (!result) return nullptr;
+	for (s32 y = 0; y < outHeight; y++)
+	{
+		const s64 y0 = static_cast<s64>(y) * height / outHeight;
+		const s64 y1 = std::max<s64>(y0 + 1, static_cast<s64>(y + 1) * height / outHeight);
+		for (s32 x = 0; x < outWidth; x++)
+		{
+			const s64 x0 = static_cast<s64>(x) * width / outWidth;
+			const s64 x1 = std::max<s64>(x0 + 1, static_cast<s64>(x + 1) * width / outWidth);
+			u64 sums[4] = {};
+			for (s64 sy = y0; sy < y1; sy++)
+			{
+				const u8* src = pixels + (sy * width + x0) * 4;
+				for (s64 sx = x0; sx < x1; sx++, src += 4)
+				{
+					sums[0] += src[0];
+					sums[1] += src[1];
+					sums[2] += src[2];
+					sums[3] += src[3];
+				}
+			}
+			const u64 count = static_cast<u64>((y1 - y0) * (x1 - x0));
+			u8* dst = result + (static_cast<size_t>(y) * outWidth + x) * 4;
+			for (u32 c = 0; c < 4; c++)
+			{
+				dst[c] = static_cast<u8>((sums[c] + count / 2) / count);
+			}
+		}
+	}
+	return result;
 }
 
-bool Resources::Texture::AcceptPacket(Networking::Serialization::Deserializer& dr)
+bool Resources::Texture::EncodeImage(const u8* pixels, s32 width, s32 height, std::vector<u8>& file, std::string& type)
 {
-	if (!LargeFile::AcceptPacket(dr)) return false;
-	if (complete)
+	if (!pixels || width <= 0 || height <= 0) return false;
+	bool opaque = true;
+	for (size_t i = 3; i < static_cast<size_t>(width) * height * 4; i += 4)
 	{
-		LoadFromMemory();
+		if (pixels[i] != 255)
+		{
+			opaque = false;
+			break;
+		}
 	}
+	file.clear();
+	auto write = [](void* context, void* data, int size)
+	{
+		std::vector<u8>* out = static_cast<std::vector<u8>*>(context);
+		out->insert(out->end(), static_cast<u8*>(data), static_cast<u8*>(data) + size);
+	};
+	// The writers only read the pixels, rows are written top to bottom as decoded
+	if (opaque)
+	{
+		type = ".jpg";
+		return stbi_write_jpg_to_func(write, &file, width, height, 4, pixels, 80) && !file.empty();
+	}
+	type = ".png";
+	return stbi_write_png_to_func(write, &file, width, height, 4, pixels, width * 4) && !file.empty();
+}
+
+bool Resources::Texture::PreLoad(Networking::Serialization::Deserializer& dr, std::string_view pathIn)
+{
+	if (!CanPreLoad()) return false;
+	WaitForDecode();
+	contentGeneration++;
+	if (loaded.Load()) UnLoad();
+	if (!LargeFile::PreLoad(dr, pathIn)) return false;
+	thumbnail = nullptr;
+	SetEvicted(false);
+	if (!dr.Read(sizeX) || !dr.Read(sizeY)) return false;
+	// Missing from the descriptions sent by older peers
+	if (!dr.Read(contentHash)) contentHash = 0;
 	return true;
 }
 
+u64 Resources::Texture::ReadContentHash(Networking::Serialization::Deserializer& dr)
+{
+	// Laid out as PreLoad reads it
+	std::string_view type;
+	u64 size;
+	s32 width;
+	s32 height;
+	u64 hash;
+	if (!dr.ReadString(type) || !dr.Read(size) || !dr.Read(width) || !dr.Read(height) || !dr.Read(hash)) return 0;
+	return hash;
+}
+
 bool Resources::Texture::SerializeFile(Networking::Serialization::Serializer& sr) const
 {
 	if (!LargeFile::SerializeFile(sr)) return false;
 	sr.Write(sizeX);
 	sr.Write(sizeY);
+	// Last, older peers stop reading before it
+	sr.Write(contentHash);
 	return true;
 }
 
-TextureError Resources::Texture::LoadFromMemory()
+TextureError Resources::Texture::EndDecode(u8* pixels, s32 width, s32 height)
 {
-	if (loaded.Load())
+	if (!pixels)
 	{
-		UnLoad();
+		lastError = TextureError::IMG_INVALID;
+		return lastError;
 	}
-	int nrChannels;
-	Maths::IVec2 res = Maths::IVec2(sizeX, sizeY);
-	stbi_set_flip_vertically_on_load_thread(false);
-	ImageData = stbi_load_from_memory(FileData, dataSize, &sizeX, &sizeY, &nrChannels, 4);
-	if (!ImageData)
+	if (width != sizeX || height != sizeY) // whatever happened here, something went wrong
 	{
-		return TextureError::IMG_INVALID;
+		stbi_image_free(pixels);
+		lastError = TextureError::OTHER;
+		return lastError;
 	}
-	if (res.x != sizeX || res.y != sizeY) // whatever happened here, something went wrong
+	if (loaded.Load())
 	{
-		stbi_image_free(ImageData);
-		ImageData = nullptr;
-		return TextureError::OTHER;
+		// Only the GL texture, the content is still in use
+		glDeleteTextures(1, &textureID);
+		textureID = 0;
+		SetLoaded(false);
 	}
+	if (ImageData) stbi_image_free(ImageData);
+	ImageData = pixels;
 	EndLoad();
 	return TextureError::NONE;
 }
 
+void Resources::Texture::SetDecoding(bool v)
+{
+	// Notified under the lock : the waiter may destroy the texture as soon as it gets it
+	std::lock_guard<std::mutex> lock(decodingLock);
+	decoding.Store(v);
+	if (!v) decodingDone.notify_all();
+}
+
+TextureError Resources::Texture::LoadGenerated(std::string_view pathIn, std::string_view type, const u8* data, u64 size, u8* pixels, s32 width, s32 height)
+{
+	WaitForDecode();
+	contentGeneration++;
+	if (loaded.Load()) UnLoad();
+	ReleaseContent();
+	path = pathIn;
+	fileType = type;
+	dataSize = size;
+	SetContent(new u8[dataSize]);
+	memcpy(FileData, data, dataSize);
+	contentHash = HashContent(FileData, dataSize);
+	receivedParts.assign(GetPacketsCount(), true);
+	complete = true;
+	thumbnail = nullptr;
+	SetEvicted(false);
+	sizeX = width;
+	sizeY = height;
+	lastError = TextureError::NONE;
+	return EndDecode(pixels, width, height);
+}
+
+void Resources::Texture::WaitForDecode() const
+{
+	// Only when the texture is described again while being decoded, which doesn't last
+	std::unique_lock<std::mutex> lock(decodingLock);
+	decodingDone.wait(lock, [this]() { return !decoding.Load(); });
+}
+
 Maths::Color4 Resources::Texture::ReadPixel(Maths::IVec2 pos) const
 {
 	if (!loaded.Load() || !ImageData || pos.x >= sizeX || pos.y >= sizeY)
@@ -219,21 +354,108 @@ void Resources::Texture::EndLoad()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 4.f);
 
-	loaded.Store(true);
+	SetLoaded(true);
 }
 
-void Resources::Texture::DeleteData()
+void Resources::Texture::MarkUsed() const
+{
+	if (lastUse == currentFrame) return;
+	lastUse = currentFrame;
+	// Drawing doesn't change the texture, only its place in the list
+	Texture* self = const_cast<Texture*>(this);
+	self->RemoveFromUsed();
+	usedPrev = usedLast;
+	if (usedLast) usedLast->usedNext = self;
+	else usedFirst = self;
+	usedLast = self;
+}
+
+void Resources::Texture::RemoveFromUsed()
+{
+	if (usedFirst != this && !usedPrev) return;
+	if (usedPrev) usedPrev->usedNext = usedNext;
+	else usedFirst = usedNext;
+	if (usedNext) usedNext->usedPrev = usedPrev;
+	else usedLast = usedPrev;
+	usedPrev = nullptr;
+	usedNext = nullptr;
+}
+
+void Resources::Texture::AddToLeastUsed()
+{
+	if (lastUse == 0 || usedFirst == this || usedPrev) return;
+	usedNext = usedFirst;
+	if (usedFirst) usedFirst->usedPrev = this;
+	else usedLast = this;
+	usedFirst = this;
+}
+
+u64 Resources::Texture::GetUploadedSize() const
 {
+	if (!loaded.Load()) return 0;
+	// Mipmaps add a third
+	return static_cast<u64>(sizeX) * sizeY * 4 * 4 / 3;
+}
+
+void Resources::Texture::SetLoaded(bool v)
+{
+	if (loaded.Load() == v) return;
+	// The size doesn't change while uploaded
+	const u64 size = static_cast<u64>(sizeX) * sizeY * 4 * 4 / 3;
+	if (v)
+	{
+		totalUploadedSize += size;
+		uploadedCount++;
+	}
+	else
+	{
+		totalUploadedSize -= size;
+		uploadedCount--;
+	}
+	loaded.Store(v);
+}
+
+void Resources::Texture::SetEvicted(bool v)
+{
+	if (evicted == v) return;
+	if (v) evictedCount++;
+	else evictedCount--;
+	evicted = v;
+}
+
+void Resources::Texture::EvictUpload()
+{
+	if (!loaded.Load()) return;
+	glDeleteTextures(1, &textureID);
+	textureID = 0;
+	SetLoaded(false);
 	if (ImageData)
 	{
 		stbi_image_free(ImageData);
 		ImageData = nullptr;
 	}
-	if (FileData)
+	SetEvicted(true);
+}
+
+void Resources::Texture::EvictContent()
+{
+	// The decoders and the network thread don't read it anymore
+	assert(!IsDecoding() && !HasReaders());
+	EvictUpload();
+	ReleaseContent();
+	receivedParts.assign(receivedParts.size(), false);
+	complete = false;
+	SetEvicted(true);
+}
+
+void Resources::Texture::DeleteData()
+{
+	if (ImageData)
 	{
-		delete FileData;
-		FileData = nullptr;
+		stbi_image_free(ImageData);
+		ImageData = nullptr;
 	}
+	ReleaseContent();
 }
 
 u64 Resources::Texture::GetTextureID() const
@@ -270,26 +492,37 @@ unsigned int Resources::Texture::IncrementShadowGLUnit()
 
 void Texture::UnLoad()
 {
+	WaitForDecode();
 	if (textureID)
 	{
 		glDeleteTextures(1, &textureID);
 	}
-	loaded.Store(false);
+	SetLoaded(false);
 	DeleteData();
 }
 
 void Texture::Overwrite(const unsigned char* data, unsigned int sizeX, unsigned int sizeY)
 {
+	// Counted again with its new size
+	const bool wasLoaded = loaded.Load();
+	SetLoaded(false);
 	glBindTexture(GL_TEXTURE_2D, textureID);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, sizeX, sizeY, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 	glGenerateMipmap(GL_TEXTURE_2D);
 	this->sizeX = sizeX;
 	this->sizeY = sizeY;
+	SetLoaded(wasLoaded);
 }
 
 void Texture::SaveImage(const char* path, unsigned char* data, unsigned int sizeX, unsigned int sizeY)
 {
-	stbi_flip_vertically_on_write(true);
+	// Flipped in a copy : stbi_flip_vertically_on_write is global to the writer, which the workers use for thumbnails
+	const size_t rowSize = static_cast<size_t>(sizeX) * 4;
+	std::vector<u8> flipped(rowSize * sizeY);
+	for (unsigned int y = 0; y < sizeY; y++)
+	{
+		memcpy(flipped.data() + y * rowSize, data + (sizeY - 1 - y) * rowSize, rowSize);
+	}
 	std::string name = path;
 	name.append("@");
 	time_t timeLocal;
@@ -300,7 +533,7 @@ void Texture::SaveImage(const char* path, unsigned char* data, unsigned int size
 	strftime(text, 64, "%Y_%m_%d-%H_%M_%S", &dateTime);
 	name.append(text);
 	name.append(".png");
-	if (!stbi_write_png(name.c_str(), sizeX, sizeY, 4, data, sizeX * 4))
+	if (!stbi_write_png(name.c_str(), sizeX, sizeY, 4, flipped.data(), static_cast<int>(rowSize)))
 	{
 		std::cout << "ERROR   : Could not save file : " << path << std::endl;
 		std::cout << stbi_failure_reason() << std::endl;
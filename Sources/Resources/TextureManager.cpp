@@ -1,5 +1,10 @@
 #include "Resources/TextureManager.hpp"
 
+#include <algorithm>
+#include <thread>
+
+#include "Core/ThreadPool.hpp"
+
 using namespace Resources;
 
 static const std::string defaultUserTexStr = std::string("Resources/DefaultUser.png");
@@ -27,12 +32,25 @@ TextureManager::TextureManager()
 	tex3->EndLoad();
 	defaultDownloadTex = tex3.get();
 	textures.emplace(defaultDownloadTexStr, std::move(tex3));
+	// One core is left to the UI and one to the network thread
+	const u32 cores = std::thread::hardware_concurrency();
+	decoders = std::make_unique<Core::ThreadPool>(std::clamp<u32>(cores > 2 ? cores - 2 : 1, 1, MaxDecodeThreads));
 }
 
-Texture* TextureManager::GetTexture(std::string key)
+TextureManager::~TextureManager()
+{
+	decoders.reset();
+	for (auto& image : decoded)
+	{
+		Texture::FreeImage(image.pixels);
+		Texture::FreeImage(image.thumbnailPixels);
+	}
+}
+
+Texture* TextureManager::GetTexture(std::string_view key)
 {
 	Texture* ptr;
-	auto res = textures.find(key);
+	auto res = textures.find(std::string(key));
 	if (res == textures.end())
 	{
 		ptr = GetDefaultImage();
@@ -44,15 +62,17 @@ Texture* TextureManager::GetTexture(std::string key)
 	return ptr;
 }
 
-Texture* TextureManager::GetOrCreateTexture(std::string key)
+Texture* TextureManager::GetOrCreateTexture(std::string_view key)
 {
 	Texture* ptr;
-	auto res = textures.find(key);
+	// The map only looks up std::string keys
+	std::string path = std::string(key);
+	auto res = textures.find(path);
 	if (res == textures.end())
 	{
 		std::unique_ptr<Texture> tempTex = std::make_unique<Texture>();
 		ptr = tempTex.get();
-		textures.emplace(key, std::move(tempTex));
+		textures.emplace(std::move(path), std::move(tempTex));
 	}
 	else
 	{
@@ -80,3 +100,242 @@ void Resources::TextureManager::EmplaceTexture(std::string& key, std::unique_ptr
 {
 	textures.emplace(key, std::move(tex));
 }
+
+TextureError Resources::TextureManager::TryLoad(const char* path, Texture* tex, Maths::Vec2 minSize, Maths::Vec2 maxSize, u64 maxFileSize)
+{
+	return Texture::TryLoad(path, tex, cache, minSize, maxSize, maxFileSize);
+}
+
+const Texture* Resources::TextureManager::FindContent(u64 hash, bool onlyComplete)
+{
+	if (hash == 0) return nullptr;
+	auto range = contents.equal_range(hash);
+	for (auto it = range.first; it != range.second;)
+	{
+		Texture* tex = it->second;
+		if (tex->GetContentHash() != hash)
+		{
+			it = contents.erase(it);
+			continue;
+		}
+		++it;
+		if (tex->IsEvicted() && !tex->IsComplete()) RestoreContent(tex);
+		// The content of files still being received isn't there until their first part is
+		if (tex->IsComplete() ? tex->GetContentData() != nullptr : !onlyComplete) return tex;
+	}
+	return nullptr;
+}
+
+bool Resources::TextureManager::LoadContent(Texture* tex, bool prepareDownload)
+{
+	if (tex->GetContentHash() == 0 || tex->IsComplete()) return tex->IsComplete();
+	const u64 hash = tex->GetContentHash();
+	IndexContent(tex);
+	if (cache.Contains(hash, tex->GetContentSize()) && tex->MapContent(cache.GetFilePath(hash)))
+	{
+		Decode(tex);
+		return true;
+	}
+	if (const Texture* other = FindContent(hash))
+	{
+		if (!tex->AcceptContent(other->GetContentData(), other->GetContentSize())) return false;
+		Decode(tex);
+		return true;
+	}
+	// The complete file under that hash has another size or is damaged : received on the heap and stored aside rather than truncated
+	if (!prepareDownload || cache.IsComplete(hash)) return false;
+	// Downloaded in place into the cache file, resuming from the parts it already holds
+	std::vector<bool> parts(tex->GetPacketsCount());
+	const bool resumed = cache.ReadPartial(hash, parts);
+	if (!resumed && !cache.StartPartial(hash, tex->GetPacketsCount())) return false;
+	if (!tex->MapReceiveBuffer(cache.GetFilePath(hash)))
+	{
+		// Received on the heap and stored once complete
+		cache.RemovePartial(hash);
+		return false;
+	}
+	if (!resumed) return false;
+	if (!tex->RestoreParts(parts))
+	{
+		// Doesn't match the hash once complete, downloaded again from scratch
+		cache.StartPartial(hash, tex->GetPacketsCount());
+		return false;
+	}
+	// Interrupted right before being stored
+	if (!tex->IsComplete()) return false;
+	StoreContent(tex);
+	Decode(tex);
+	return true;
+}
+
+void Resources::TextureManager::StoreContent(const Texture* tex)
+{
+	if (!tex->IsComplete() || tex->GetContentHash() == 0 || !tex->GetContentData()) return;
+	// Otherwise it was received in the cache file
+	if (!tex->IsMapped())
+	{
+		cache.Write(tex->GetContentHash(), tex->GetContentData(), tex->GetContentSize());
+	}
+	cache.RemovePartial(tex->GetContentHash());
+}
+
+void Resources::TextureManager::StorePart(const Texture* tex, u32 packetIndex)
+{
+	// Only files received in the cache file have their parts kept
+	if (tex->IsComplete() || tex->GetContentHash() == 0 || !tex->IsMapped()) return;
+	cache.WritePartial(tex->GetContentHash(), packetIndex);
+}
+
+void Resources::TextureManager::RestartDownload(const Texture* tex)
+{
+	if (tex->IsComplete() || tex->GetContentHash() == 0 || !tex->IsMapped()) return;
+	cache.StartPartial(tex->GetContentHash(), tex->GetPacketsCount());
+}
+
+void Resources::TextureManager::Decode(Texture* tex, bool makeThumbnail)
+{
+	if (!tex->IsComplete() || !tex->GetContentData() || tex->IsDecoding()) return;
+	IndexContent(tex);
+	tex->SetDecoding(true);
+	const u32 generation = tex->GetContentGeneration();
+	decoders->Push([this, tex, generation, makeThumbnail]()
+	{
+		DecodedImage image;
+		image.tex = tex;
+		image.generation = generation;
+		image.pixels = Texture::DecodeImage(tex->GetContentData(), tex->GetContentSize(), image.width, image.height);
+		if (makeThumbnail && image.pixels && std::max(image.width, image.height) > Texture::ThumbnailSize)
+		{
+			image.thumbnailPixels = Texture::Downscale(image.pixels, image.width, image.height, Texture::ThumbnailSize, image.thumbnailWidth, image.thumbnailHeight);
+			if (image.thumbnailPixels && !Texture::EncodeImage(image.thumbnailPixels, image.thumbnailWidth, image.thumbnailHeight, image.thumbnailFile, image.thumbnailType))
+			{
+				Texture::FreeImage(image.thumbnailPixels);
+				image.thumbnailPixels = nullptr;
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(decodedLock);
+			decoded.push_back(image);
+		}
+		// The content isn't read anymore
+		tex->SetDecoding(false);
+	});
+}
+
+void Resources::TextureManager::Update()
+{
+	{
+		std::lock_guard<std::mutex> lock(decodedLock);
+		std::swap(decoded, uploads);
+	}
+	for (auto& image : uploads)
+	{
+		// Described again while being decoded
+		if (image.tex->GetContentGeneration() != image.generation)
+		{
+			Texture::FreeImage(image.pixels);
+			Texture::FreeImage(image.thumbnailPixels);
+			continue;
+		}
+		if (image.tex->EndDecode(image.pixels, image.width, image.height) != TextureError::NONE)
+		{
+			Texture::FreeImage(image.thumbnailPixels);
+			continue;
+		}
+		if (image.thumbnailPixels)
+		{
+			const std::string path = image.tex->GetPath() + "@thumb";
+			Texture* thumbnail = GetOrCreateTexture(path);
+			if (thumbnail->LoadGenerated(path, image.thumbnailType, image.thumbnailFile.data(), image.thumbnailFile.size(), image.thumbnailPixels, image.thumbnailWidth, image.thumbnailHeight) == TextureError::NONE)
+			{
+				image.tex->SetThumbnail(thumbnail);
+				IndexContent(thumbnail);
+			}
+		}
+	}
+	uploads.clear();
+	UpdateResidency();
+	Texture::NextFrame();
+}
+
+void Resources::TextureManager::SetBudget(u64 uploadBytes, u64 contentBytes)
+{
+	uploadBudget = uploadBytes;
+	contentBudget = contentBytes;
+}
+
+void Resources::TextureManager::TakeLostContents(std::vector<Texture*>& out)
+{
+	out.insert(out.end(), lostContents.begin(), lostContents.end());
+	lostContents.clear();
+}
+
+void Resources::TextureManager::UpdateResidency()
+{
+	const u32 frame = Texture::GetCurrentFrame();
+	// Drawn since the last update : they are at the back of the list
+	for (Texture* tex = Texture::GetMostRecentlyUsed(); tex && tex->GetLastUse() == frame; tex = tex->GetPreviousUsed())
+	{
+		if (!tex->IsEvicted()) continue;
+		if (tex->IsComplete() || RestoreContent(tex))
+		{
+			Decode(tex);
+		}
+		else
+		{
+			// Gone from the cache : downloaded again
+			lostContents.push_back(tex);
+		}
+		tex->ClearEvicted();
+	}
+	const auto OverBudget = [this]() { return Texture::GetTotalUploadedSize() > uploadBudget || Texture::GetTotalContentSize() > contentBudget; };
+	Texture* next = nullptr;
+	for (Texture* tex = Texture::GetLeastRecentlyUsed(); tex && tex->GetLastUse() < frame && OverBudget(); tex = next)
+	{
+		next = tex->GetNextUsed();
+		if (Texture::GetTotalContentSize() > contentBudget && CanEvictContent(tex))
+		{
+			tex->EvictContent();
+			stats.evictions++;
+		}
+		else if (Texture::GetTotalUploadedSize() > uploadBudget && tex->IsLoaded())
+		{
+			tex->EvictUpload();
+			stats.evictions++;
+		}
+		// Nothing left to evict : walked again once drawn
+		if (!tex->IsLoaded() && !tex->GetContentData()) tex->RemoveFromUsed();
+	}
+	stats.uploadedBytes = Texture::GetTotalUploadedSize();
+	stats.contentBytes = Texture::GetTotalContentSize();
+	stats.resident = Texture::GetUploadedCount();
+	stats.evicted = Texture::GetEvictedCount();
+}
+
+bool Resources::TextureManager::RestoreContent(Texture* tex)
+{
+	const u64 hash = tex->GetContentHash();
+	if (hash == 0 || !cache.Contains(hash, tex->GetContentSize()) || !tex->MapContent(cache.GetFilePath(hash))) return false;
+	// Evicted again first if it isn't drawn
+	tex->AddToLeastUsed();
+	return true;
+}
+
+bool Resources::TextureManager::CanEvictContent(const Texture* tex)
+{
+	// Only what can be mapped back from the cache, once the decoders and the transfers are done with it
+	// A complete mapped content is a complete cache file : received in it, mapped from it, or copied to it when loaded
+	return tex->IsComplete() && tex->IsMapped() && tex->GetContentHash() != 0 && !tex->IsDecoding() && !tex->HasReaders();
+}
+
+void Resources::TextureManager::IndexContent(Texture* tex)
+{
+	const u64 hash = tex->GetContentHash();
+	if (hash == 0) return;
+	auto range = contents.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == tex) return;
+	}
+	contents.emplace(hash, tex);
+}